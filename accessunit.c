@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "accessunit.h"
+#include "logging.h"
+
+/* Most pictures have a handful of slice segments at most. */
+#define ACCESS_UNIT_INITIAL_CAPACITY 16
+
+static int add_slice_segment(
+    hevc_access_unit *au,
+    const hevc_nal_index *index,
+    const hevc_nal_entry *entry)
+{
+    VdpBitstreamBuffer *buffer;
+
+    if(au->count == au->capacity)
+    {
+        uint32_t capacity = au->capacity ?
+                            au->capacity * 2 : ACCESS_UNIT_INITIAL_CAPACITY;
+        VdpBitstreamBuffer *buffers =
+            realloc(au->buffers, capacity * sizeof(VdpBitstreamBuffer));
+
+        if(buffers == NULL)
+        {
+            HEVC_LOG_ERROR("Error: MALLOC: access unit buffers.\n");
+            return -1;
+        }
+        au->buffers = buffers;
+        au->capacity = capacity;
+    }
+
+    buffer = &au->buffers[au->count++];
+    buffer->struct_version = VDP_BITSTREAM_BUFFER_VERSION;
+    buffer->bitstream = hevc_nal_index_data(index, entry);
+    buffer->bitstream_bytes = entry->size;
+    au->bytes += entry->size;
+
+    return 0;
+}
+
+int hevc_access_unit_assemble(
+    hevc_access_unit *au,
+    hevc_nal_index *index,
+    uint32_t n)
+{
+    const hevc_nal_entry *entry;
+    uint32_t m;
+
+    au->count = 0;
+    au->bytes = 0;
+    au->first = n;
+    au->last = n;
+
+    entry = hevc_nal_index_get(index, n);
+    if(entry == NULL || add_slice_segment(au, index, entry) < 0)
+        return -1;
+
+    /*
+       The remaining slice segments of the picture follow, with maybe
+       suffix NAL units in between, 7.4.2.4.4. Those are passed over. A new
+       first_slice_segment_in_pic_flag, or any other NAL unit, ends it.
+     */
+    for(m = au->last + 1;
+            (entry = hevc_nal_index_peek(index, m)) != NULL; m++)
+    {
+        if(NAL_INDEX_IS_SUFFIX(entry->type))
+            continue;
+        if(!NAL_INDEX_IS_VCL(entry->type) ||
+                entry->first_slice_segment_in_pic_flag)
+            break;
+        if(add_slice_segment(au, index, entry) < 0)
+            return -1;
+        au->last = m;
+    }
+
+    return 0;
+}
+
+void hevc_access_unit_free(hevc_access_unit *au)
+{
+    free(au->buffers);
+    memset(au, 0, sizeof(*au));
+}
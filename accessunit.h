@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    accessunit: gathers the slice segments of one coded picture.
+
+    VDPAU takes the slice segment NAL units of a picture as an array of
+    VdpBitstreamBuffer, and concatenates them itself. Every slice segment
+    gets its own entry, pointing straight at the NAL unit index, so building
+    a picture never copies or rescans bitstream data.
+ */
+
+#ifndef __ACCESS_UNIT_H__
+#define __ACCESS_UNIT_H__
+
+#include <stdint.h>
+#include <vdpau/vdpau.h>
+#include "nalindex.h"
+
+typedef struct _hevc_access_unit
+{
+    /* One entry per slice segment NAL unit, in decoding order. */
+    VdpBitstreamBuffer *buffers;
+    uint32_t count;
+    uint32_t capacity;
+    /* Total of buffers[].bitstream_bytes. */
+    uint32_t bytes;
+    /* Index entries of the first and last slice segment. */
+    uint32_t first;
+    uint32_t last;
+} hevc_access_unit;
+
+/*
+   Starts a picture at entry n, which holds the first slice segment, and
+   adds every following slice segment of the same picture, as told by
+   first_slice_segment_in_pic_flag. Suffix NAL units in between them, see
+   NAL_INDEX_IS_SUFFIX(), are left out, and last is the last slice segment.
+   Returns 0, or -1 if memory runs out.
+ */
+int hevc_access_unit_assemble(
+    hevc_access_unit *au,
+    hevc_nal_index *index,
+    uint32_t n);
+
+void hevc_access_unit_free(hevc_access_unit *au);
+
+#endif /* __ACCESS_UNIT_H__ */
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "bench.h"
+
+#define BENCH_INITIAL_CAPACITY 4096
+
+const char *const hevc_bench_stage_names[BENCH_STAGE_COUNT] =
+{
+    "scan",
+    "parse",
+    "dpb",
+    "decode",
+    "mix",
+    "present"
+};
+
+/* Table 7-1, nal_unit_type names. Reserved types are left NULL. */
+static const char *nal_type_names[64] =
+{
+    "TRAIL_N", "TRAIL_R", "TSA_N", "TSA_R",
+    "STSA_N", "STSA_R", "RADL_N", "RADL_R",
+    "RASL_N", "RASL_R", NULL, NULL,
+    NULL, NULL, NULL, NULL,
+    "BLA_W_LP", "BLA_W_RADL", "BLA_N_LP", "IDR_W_RADL",
+    "IDR_N_LP", "CRA_NUT", NULL, NULL,
+    NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, NULL,
+    "VPS_NUT", "SPS_NUT", "PPS_NUT", "AUD_NUT",
+    "EOS_NUT", "EOB_NUT", "FD_NUT", "PREFIX_SEI_NUT",
+    "SUFFIX_SEI_NUT"
+};
+
+/* A well mixed function of n, the SplitMix64 finalizer. */
+static uint64_t mix(uint64_t n)
+{
+    n = (n ^ (n >> 30)) * 0xbf58476d1ce4e5b9ull;
+    n = (n ^ (n >> 27)) * 0x94d049bb133111ebull;
+    return n ^ (n >> 31);
+}
+
+void hevc_bench_add(hevc_bench *bench, hevc_bench_stage stage, uint64_t ns)
+{
+    hevc_bench_samples *samples = &bench->stages[stage];
+    uint64_t i;
+
+    samples->count++;
+    samples->total_ns += ns;
+
+    if(samples->stored == samples->capacity &&
+            samples->capacity < BENCH_MAX_SAMPLES)
+    {
+        uint32_t capacity = samples->capacity ?
+                            samples->capacity * 2 : BENCH_INITIAL_CAPACITY;
+        uint64_t *grown = realloc(samples->ns, capacity * sizeof(uint64_t));
+
+        /* Without room for more, sample what there is room for. */
+        if(grown != NULL)
+        {
+            samples->ns = grown;
+            samples->capacity = capacity;
+        }
+    }
+
+    if(samples->stored < samples->capacity)
+    {
+        samples->ns[samples->stored++] = ns;
+        return;
+    }
+
+    /*
+       Reservoir sampling: run number count replaces a random one of the
+       stored samples with probability stored / count, which keeps them a
+       uniform sample of every run so far.
+     */
+    i = mix(samples->count) % samples->count;
+    if(i < samples->stored)
+        samples->ns[i] = ns;
+}
+
+void hevc_bench_start(hevc_bench *bench)
+{
+    bench->start_ns = hevc_bench_now();
+}
+
+void hevc_bench_stop(hevc_bench *bench)
+{
+    bench->end_ns = hevc_bench_now();
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted samples. */
+static uint64_t percentile(const hevc_bench_samples *samples, uint32_t p)
+{
+    uint64_t rank;
+
+    if(samples->stored == 0)
+        return 0;
+
+    rank = ((uint64_t) samples->stored * p + 99) / 100;
+    if(rank == 0)
+        rank = 1;
+
+    return samples->ns[rank - 1];
+}
+
+void hevc_bench_report(hevc_bench *bench, FILE *out, int json)
+{
+    double seconds = (bench->end_ns - bench->start_ns) * 1e-9;
+    double fps = seconds > 0 ? bench->pictures / seconds : 0;
+    double bytes_per_second = seconds > 0 ? bench->bytes / seconds : 0;
+    struct rusage usage;
+    int i, first;
+
+    /* Peak resident set size of the whole process, in KiB on Linux. */
+    if(getrusage(RUSAGE_SELF, &usage) < 0)
+        usage.ru_maxrss = 0;
+
+    for(i = 0; i < BENCH_STAGE_COUNT; i++)
+    {
+        hevc_bench_samples *samples = &bench->stages[i];
+
+        qsort(samples->ns, samples->stored, sizeof(uint64_t), compare_ns);
+    }
+
+    if(json)
+    {
+        fprintf(out, "{\n");
+        fprintf(out, "  \"seconds\": %.6f,\n", seconds);
+        fprintf(out, "  \"pictures\": %llu,\n",
+                (unsigned long long) bench->pictures);
+        fprintf(out, "  \"fps\": %.3f,\n", fps);
+        fprintf(out, "  \"bytes\": %llu,\n",
+                (unsigned long long) bench->bytes);
+        fprintf(out, "  \"bytes_per_second\": %.0f,\n", bytes_per_second);
+        fprintf(out, "  \"max_rss_kib\": %ld,\n", usage.ru_maxrss);
+        fprintf(out, "  \"late_pictures\": %llu,\n",
+                (unsigned long long) bench->late_pictures);
+        fprintf(out, "  \"dropped_pictures\": %llu,\n",
+                (unsigned long long) bench->dropped_pictures);
+        fprintf(out, "  \"errors\": %llu,\n",
+                (unsigned long long) bench->errors);
+        fprintf(out, "  \"recoveries\": %llu,\n",
+                (unsigned long long) bench->recoveries);
+        fprintf(out, "  \"recovery_skipped_pictures\": %llu,\n",
+                (unsigned long long) bench->recovery_skipped_pictures);
+        fprintf(out, "  \"concealed_pictures\": %llu,\n",
+                (unsigned long long) bench->concealed_pictures);
+        fprintf(out, "  \"recovery_mean_ns\": %llu,\n",
+                (unsigned long long)(bench->recoveries ?
+                                     bench->recovery_ns / bench->recoveries :
+                                     0));
+        fprintf(out, "  \"recovery_max_ns\": %llu,\n",
+                (unsigned long long) bench->max_recovery_ns);
+        fprintf(out, "  \"stages\": {");
+        for(i = 0; i < BENCH_STAGE_COUNT; i++)
+        {
+            hevc_bench_samples *samples = &bench->stages[i];
+
+            fprintf(out, "%s\n    \"%s\": { \"count\": %llu, "
+                    "\"total_ns\": %llu, \"mean_ns\": %llu, "
+                    "\"p50_ns\": %llu, \"p99_ns\": %llu }",
+                    i ? "," : "",
+                    hevc_bench_stage_names[i],
+                    (unsigned long long) samples->count,
+                    (unsigned long long) samples->total_ns,
+                    (unsigned long long)(samples->count ?
+                                         samples->total_ns / samples->count :
+                                         0),
+                    (unsigned long long) percentile(samples, 50),
+                    (unsigned long long) percentile(samples, 99));
+        }
+        fprintf(out, "\n  },\n");
+        fprintf(out, "  \"nal_units\": {");
+        for(i = 0, first = 1; i < 64; i++)
+        {
+            if(!bench->nal_counts[i])
+                continue;
+            if(nal_type_names[i])
+                fprintf(out, "%s\n    \"%s\": %llu", first ? "" : ",",
+                        nal_type_names[i],
+                        (unsigned long long) bench->nal_counts[i]);
+            else
+                fprintf(out, "%s\n    \"RSV_%d\": %llu", first ? "" : ",", i,
+                        (unsigned long long) bench->nal_counts[i]);
+            first = 0;
+        }
+        fprintf(out, "\n  }\n}\n");
+        return;
+    }
+
+    fprintf(out, "Decoded %llu pictures in %.3f s: %.2f fps, %.2f MB/s\n",
+            (unsigned long long) bench->pictures, seconds, fps,
+            bytes_per_second / 1e6);
+    fprintf(out, "Peak resident set size: %ld KiB\n", usage.ru_maxrss);
+    fprintf(out, "Late pictures: %llu, dropped: %llu\n",
+            (unsigned long long) bench->late_pictures,
+            (unsigned long long) bench->dropped_pictures);
+    if(bench->errors)
+        fprintf(out, "Errors: %llu, recovered from: %llu, skipped: %llu, "
+                "concealed: %llu, recovery mean %.2f ms, max %.2f ms\n",
+                (unsigned long long) bench->errors,
+                (unsigned long long) bench->recoveries,
+                (unsigned long long) bench->recovery_skipped_pictures,
+                (unsigned long long) bench->concealed_pictures,
+                bench->recoveries ?
+                bench->recovery_ns * 1e-6 / bench->recoveries : 0.0,
+                bench->max_recovery_ns * 1e-6);
+    fprintf(out, "%-8s %10s %12s %12s %12s\n",
+            "stage", "count", "mean us", "p50 us", "p99 us");
+    for(i = 0; i < BENCH_STAGE_COUNT; i++)
+    {
+        hevc_bench_samples *samples = &bench->stages[i];
+
+        fprintf(out, "%-8s %10llu %12.2f %12.2f %12.2f\n",
+                hevc_bench_stage_names[i],
+                (unsigned long long) samples->count,
+                samples->count ?
+                samples->total_ns * 1e-3 / samples->count : 0.0,
+                percentile(samples, 50) * 1e-3,
+                percentile(samples, 99) * 1e-3);
+    }
+    fprintf(out, "NAL units by type:\n");
+    for(i = 0; i < 64; i++)
+    {
+        if(!bench->nal_counts[i])
+            continue;
+        if(nal_type_names[i])
+            fprintf(out, "  %-16s %llu\n", nal_type_names[i],
+                    (unsigned long long) bench->nal_counts[i]);
+        else
+            fprintf(out, "  RSV_%-12d %llu\n", i,
+                    (unsigned long long) bench->nal_counts[i]);
+    }
+}
+
+void hevc_bench_free(hevc_bench *bench)
+{
+    int i;
+
+    for(i = 0; i < BENCH_STAGE_COUNT; i++)
+        free(bench->stages[i].ns);
+
+    memset(bench, 0, sizeof(*bench));
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    bench: headless decode throughput measurements for -bench.
+
+    Every stage of the player is timed with CLOCK_MONOTONIC, and each timed
+    run of a stage is kept as one sample, so that the report can give the
+    mean as well as percentiles. Each stage is only ever timed by one
+    thread, so pipelined mode needs no locking either. With -trace, every
+    run is also kept as a span, see trace.h.
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include "trace.h"
+
+/* Samples kept per stage, 8 MiB worth. */
+#define BENCH_MAX_SAMPLES (1u << 20)
+
+typedef enum
+{
+    BENCH_STAGE_SCAN    = 0, /* Finding NAL units and access units. */
+    BENCH_STAGE_PARSE   = 1, /* gst_h265_parser_* and VDPAU conversion. */
+    BENCH_STAGE_DPB     = 2, /* POC, RPS and DPB bookkeeping. */
+    BENCH_STAGE_DECODE  = 3, /* VdpDecoderRender. */
+    BENCH_STAGE_MIX     = 4, /* VdpVideoMixerRender. */
+    BENCH_STAGE_PRESENT = 5, /* Presentation queue wait and display. */
+    BENCH_STAGE_COUNT
+} hevc_bench_stage;
+
+/* "scan", "parse" and so on, as in the report and the trace. */
+extern const char *const hevc_bench_stage_names[BENCH_STAGE_COUNT];
+
+typedef struct _hevc_bench_samples
+{
+    /*
+       Every run while there are at most BENCH_MAX_SAMPLES, a uniform
+       random sample of them after that, for the percentiles.
+     */
+    uint64_t *ns;
+    uint32_t stored;
+    uint32_t capacity;
+    /* Of every run. */
+    uint64_t count;
+    uint64_t total_ns;
+} hevc_bench_samples;
+
+typedef struct _hevc_bench
+{
+    uint8_t enabled;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    hevc_bench_samples stages[BENCH_STAGE_COUNT];
+    /* By nal_unit_type, Table 7-1. */
+    uint64_t nal_counts[64];
+    uint64_t bytes;
+    uint64_t pictures;
+    /* Counted even when not benchmarking, like pictures. */
+    uint64_t late_pictures;
+    uint64_t dropped_pictures;
+    /*
+       Error resilience: broken NAL units and pictures, how often decoding
+       got going again, the pictures skipped or concealed meanwhile, and
+       how long it took from each error to the next decoded picture.
+     */
+    uint64_t errors;
+    uint64_t recoveries;
+    uint64_t recovery_skipped_pictures;
+    uint64_t concealed_pictures;
+    uint64_t recovery_ns;
+    uint64_t max_recovery_ns;
+} hevc_bench;
+
+static inline uint64_t hevc_bench_now(void)
+{
+    return hevc_trace_now();
+}
+
+/*
+   Timestamps the start of a stage, or returns 0 when neither benchmarking
+   nor tracing.
+ */
+static inline uint64_t hevc_bench_begin(const hevc_bench *bench)
+{
+    return bench->enabled || hevc_trace_enabled ? hevc_bench_now() : 0;
+}
+
+void hevc_bench_add(hevc_bench *bench, hevc_bench_stage stage, uint64_t ns);
+
+/* Records one run of stage, which started at begin. */
+static inline void hevc_bench_end(
+    hevc_bench *bench,
+    hevc_bench_stage stage,
+    uint64_t begin)
+{
+    uint64_t end;
+
+    if(bench->enabled || hevc_trace_enabled)
+    {
+        end = hevc_bench_now();
+        if(bench->enabled)
+            hevc_bench_add(bench, stage, end - begin);
+        if(hevc_trace_enabled)
+            hevc_trace_add(hevc_bench_stage_names[stage], begin, end);
+    }
+}
+
+static inline void hevc_bench_count_nal(
+    hevc_bench *bench,
+    uint8_t type,
+    uint32_t bytes)
+{
+    if(bench->enabled)
+    {
+        bench->nal_counts[type & 63]++;
+        bench->bytes += bytes;
+    }
+}
+
+void hevc_bench_start(hevc_bench *bench);
+void hevc_bench_stop(hevc_bench *bench);
+
+/*
+   Prints the report, as text, or as a JSON object if json is set. The peak
+   resident set size in it is that of the whole process so far.
+ */
+void hevc_bench_report(hevc_bench *bench, FILE *out, int json);
+
+void hevc_bench_free(hevc_bench *bench);
+
+#endif /* __BENCH_H__ */
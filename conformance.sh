@@ -0,0 +1,176 @@
+#!/bin/sh
+# Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License, version 2.1, as published by the Free Software Foundation.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this program.  If not, see
+# <http://www.gnu.org/licenses/>.
+
+
+# conformance: decodes every H.265/HEVC conformance bitstream in a directory,
+# such as the JCT-VC streams mirrored at
+# http://fate-suite.ffmpeg.org/hevc-conformance/, checks the output against
+# the reference MD5 sums next to them, and writes a JSON report.
+#
+# A stream is any *.bit, *.bin, *.265 or *.hevc file. Its reference is the
+# first of <stream>.md5, <stream>_yuv.md5 or <stream>.yuv.md5 that exists,
+# with the extension of the stream left out. A reference with one MD5 sum
+# per picture is compared picture by picture; one with a single sum is
+# compared against the whole decoded YUV file. Either has to be of the
+# output that vdpau_hw_hevc -o writes: cropped, and 16 bit samples beyond
+# 8 bits, as the HM reference decoder writes it.
+#
+# Every stream is then decoded once more with -bench and -nodisplay, for the
+# pictures per second and the peak resident set size. Streams are reported
+# in name order, so that the reports of two commits can be compared line by
+# line.
+#
+# Exits with 1 if any stream failed.
+
+usage()
+{
+    echo "Usage: $0 [-p player] [-r report.json] directory [player options]" >&2
+    exit 2
+}
+
+player=./vdpau_hw_hevc
+report=-
+
+while getopts p:r: opt
+do
+    case $opt in
+    p) player=$OPTARG ;;
+    r) report=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ $# -ge 1 ] || usage
+dir=$1
+shift
+
+tmp=$(mktemp -d) || exit 2
+trap 'rm -rf "$tmp"' EXIT
+
+# The first line of "key": value in vdpau_hw_hevc's -benchjson report.
+bench_value()
+{
+    sed -n "s/^ *\"$1\": *\([0-9.]*\),*$/\1/p" "$tmp/bench.json" | head -n 1
+}
+
+# Lower case MD5 sums, one per line, from any md5sum like file.
+md5_sums()
+{
+    grep -o '[0-9a-fA-F]\{32\}' "$1" | tr A-F a-f
+}
+
+passed=0
+failed=0
+unchecked=0
+first=1
+{
+    echo "{"
+    echo "  \"commit\": \"$(git rev-parse --short HEAD 2>/dev/null)\","
+    echo "  \"player_options\": \"$*\","
+    echo "  \"streams\": ["
+    for stream in $(ls "$dir" | grep -E '\.(bit|bin|265|hevc)$' | sort)
+    do
+        name=${stream%.*}
+        reference=
+        for candidate in "$name.md5" "${name}_yuv.md5" "$name.yuv.md5"
+        do
+            if [ -f "$dir/$candidate" ]
+            then
+                reference=$dir/$candidate
+                break
+            fi
+        done
+
+        # Correctness run. -nodisplay skips the argument after it.
+        status=unchecked
+        mismatch=null
+        if [ -z "$reference" ]
+        then
+            "$player" "$@" -md5 "$tmp/out.md5" -nodisplay "$dir/$stream" \
+                >/dev/null 2>&1 || status=error
+        elif [ "$(md5_sums "$reference" | wc -l)" -eq 1 ]
+        then
+            if ! "$player" "$@" -o "$tmp/out.yuv" -nodisplay "$dir/$stream" \
+                    >/dev/null 2>&1
+            then
+                status=error
+            elif [ "$(md5_sums "$reference")" = \
+                    "$(md5sum < "$tmp/out.yuv" | cut -c1-32)" ]
+            then
+                status=pass
+            else
+                status=fail
+            fi
+            rm -f "$tmp/out.yuv"
+        else
+            if ! "$player" "$@" -md5 "$tmp/out.md5" -nodisplay "$dir/$stream" \
+                    >/dev/null 2>&1
+            then
+                status=error
+            else
+                md5_sums "$reference" > "$tmp/ref.md5"
+                # The first picture that differs or is missing, from 0.
+                mismatch=$(paste -d ' ' "$tmp/ref.md5" "$tmp/out.md5" |
+                           awk '$1 != $2 { print NR - 1; exit }')
+                if [ -z "$mismatch" ]
+                then
+                    status=pass
+                    mismatch=null
+                else
+                    status=fail
+                fi
+            fi
+        fi
+        rm -f "$tmp/out.md5"
+
+        # Performance run, without the read back.
+        rm -f "$tmp/bench.json"
+        "$player" "$@" -benchjson "$tmp/bench.json" -nodisplay "$dir/$stream" \
+            >/dev/null 2>&1 || status=error
+        pictures=$(bench_value pictures)
+        fps=$(bench_value fps)
+        max_rss_kib=$(bench_value max_rss_kib)
+
+        case $status in
+        pass) passed=$((passed + 1)) ;;
+        unchecked) unchecked=$((unchecked + 1)) ;;
+        *) failed=$((failed + 1)) ;;
+        esac
+        [ $first = 1 ] || echo ","
+        first=0
+        printf '    { "stream": "%s", "status": "%s", "pictures": %s, ' \
+            "$stream" "$status" "${pictures:-0}"
+        printf '"first_mismatch": %s, "fps": %s, "max_rss_kib": %s }' \
+            "$mismatch" "${fps:-0}" "${max_rss_kib:-0}"
+        printf '%s: %s\n' "$stream" "$status" >&2
+    done
+    echo
+    echo "  ],"
+    echo "  \"passed\": $passed,"
+    echo "  \"failed\": $failed,"
+    echo "  \"unchecked\": $unchecked"
+    echo "}"
+} > "$tmp/report.json"
+
+if [ "$report" = - ]
+then
+    cat "$tmp/report.json"
+else
+    cp "$tmp/report.json" "$report"
+fi
+echo "$passed passed, $failed failed, $unchecked without a reference" >&2
+
+[ $failed -eq 0 ]
@@ -154,9 +154,9 @@ gst_h265_parser_get_vps (GstH265Parser * parser, guint8 vps_id)
 {
   GstH265VPS *vps;
 
-  vps = &parser->vps[vps_id];
+  vps = parser->vps[vps_id];
 
-  if (vps->valid)
+  if (vps && vps->valid)
     return vps;
 
   return NULL;
@@ -167,9 +167,9 @@ gst_h265_parser_get_sps (GstH265Parser * parser, guint8 sps_id)
 {
   GstH265SPS *sps;
 
-  sps = &parser->sps[sps_id];
+  sps = parser->sps[sps_id];
 
-  if (sps->valid)
+  if (sps && sps->valid)
     return sps;
 
   return NULL;
@@ -180,9 +180,9 @@ gst_h265_parser_get_pps (GstH265Parser * parser, guint8 pps_id)
 {
   GstH265PPS *pps;
 
-  pps = &parser->pps[pps_id];
+  pps = parser->pps[pps_id];
 
-  if (pps->valid)
+  if (pps && pps->valid)
     return pps;
 
   return NULL;
@@ -961,7 +961,7 @@ gst_h265_parser_parse_buffering_period (GstH265Parser * parser,
   GstH265SPS *sps;
   guint8 sps_id;
   guint i;
-  guint n;
+  guint n, cpb_cnt;
 
   GST_DEBUG ("parsing \"Buffering period\"");
 
@@ -987,38 +987,40 @@ gst_h265_parser_parse_buffering_period (GstH265Parser * parser,
       READ_UINT8 (nr, per->irap_cpb_params_present_flag, 1);
 
     if (per->irap_cpb_params_present_flag) {
-      READ_UINT8 (nr, per->cpb_delay_offset,
+      READ_UINT32 (nr, per->cpb_delay_offset,
           (hrd->au_cpb_removal_delay_length_minus1 + 1));
-      READ_UINT8 (nr, per->dpb_delay_offset,
+      READ_UINT32 (nr, per->dpb_delay_offset,
           (hrd->dpb_output_delay_length_minus1 + 1));
     }
 
     n = hrd->initial_cpb_removal_delay_length_minus1 + 1;
+    /* CpbCnt of the highest sub-layer, which is what gets decoded */
+    cpb_cnt = hrd->cpb_cnt_minus1[sps->max_sub_layers_minus1];
 
     READ_UINT8 (nr, per->concatenation_flag, 1);
-    READ_UINT8 (nr, per->au_cpb_removal_delay_delta_minus1,
+    READ_UINT32 (nr, per->au_cpb_removal_delay_delta_minus1,
         (hrd->au_cpb_removal_delay_length_minus1 + 1));
 
     if (hrd->nal_hrd_parameters_present_flag) {
-      for (i = 0; i <= hrd->cpb_cnt_minus1[i]; i++) {
-        READ_UINT8 (nr, per->nal_initial_cpb_removal_delay[i], n);
-        READ_UINT8 (nr, per->nal_initial_cpb_removal_offset[i], n);
+      for (i = 0; i <= cpb_cnt; i++) {
+        READ_UINT32 (nr, per->nal_initial_cpb_removal_delay[i], n);
+        READ_UINT32 (nr, per->nal_initial_cpb_removal_offset[i], n);
         if (hrd->sub_pic_hrd_params_present_flag
             || per->irap_cpb_params_present_flag) {
-          READ_UINT8 (nr, per->nal_initial_alt_cpb_removal_delay[i], n);
-          READ_UINT8 (nr, per->nal_initial_alt_cpb_removal_offset[i], n);
+          READ_UINT32 (nr, per->nal_initial_alt_cpb_removal_delay[i], n);
+          READ_UINT32 (nr, per->nal_initial_alt_cpb_removal_offset[i], n);
         }
       }
     }
 
     if (hrd->vcl_hrd_parameters_present_flag) {
-      for (i = 0; i <= hrd->cpb_cnt_minus1[i]; i++) {
-        READ_UINT8 (nr, per->vcl_initial_cpb_removal_delay[i], n);
-        READ_UINT8 (nr, per->vcl_initial_cpb_removal_offset[i], n);
+      for (i = 0; i <= cpb_cnt; i++) {
+        READ_UINT32 (nr, per->vcl_initial_cpb_removal_delay[i], n);
+        READ_UINT32 (nr, per->vcl_initial_cpb_removal_offset[i], n);
         if (hrd->sub_pic_hrd_params_present_flag
             || per->irap_cpb_params_present_flag) {
-          READ_UINT8 (nr, per->vcl_initial_alt_cpb_removal_delay[i], n);
-          READ_UINT8 (nr, per->vcl_initial_alt_cpb_removal_offset[i], n);
+          READ_UINT32 (nr, per->vcl_initial_alt_cpb_removal_delay[i], n);
+          READ_UINT32 (nr, per->vcl_initial_alt_cpb_removal_offset[i], n);
         }
       }
     }
@@ -1070,16 +1072,19 @@ gst_h265_parser_parse_pic_timing (GstH265Parser * parser,
       tim->pic_struct = 0;
     }
 
-    if (vui->hrd_parameters_present_flag) {
+    /* CpbDpbDelaysPresentFlag */
+    if (vui->hrd_parameters_present_flag
+        && (vui->hrd_params.nal_hrd_parameters_present_flag
+            || vui->hrd_params.vcl_hrd_parameters_present_flag)) {
       GstH265HRDParams *hrd = &vui->hrd_params;
 
-      READ_UINT8 (nr, tim->au_cpb_removal_delay_minus1,
+      READ_UINT32 (nr, tim->au_cpb_removal_delay_minus1,
           (hrd->au_cpb_removal_delay_length_minus1 + 1));
-      READ_UINT8 (nr, tim->pic_dpb_output_delay,
+      READ_UINT32 (nr, tim->pic_dpb_output_delay,
           (hrd->dpb_output_delay_length_minus1 + 1));
 
       if (hrd->sub_pic_hrd_params_present_flag)
-        READ_UINT8 (nr, tim->pic_dpb_output_du_delay,
+        READ_UINT32 (nr, tim->pic_dpb_output_du_delay,
             (hrd->dpb_output_delay_du_length_minus1 + 1));
 
       if (hrd->sub_pic_hrd_params_present_flag
@@ -1096,7 +1101,7 @@ gst_h265_parser_parse_pic_timing (GstH265Parser * parser,
         tim->du_cpb_removal_delay_increment_minus1 =
             g_new0 (guint8, (tim->num_decoding_units_minus1 + 1));
 
-        for (i = 0; i <= (tim->num_decoding_units_minus1 + 1); i++) {
+        for (i = 0; i <= tim->num_decoding_units_minus1; i++) {
           READ_UE (nr, tim->num_nalus_in_du_minus1[i]);
 
           if (!tim->du_common_cpb_removal_delay_flag
@@ -1139,11 +1144,23 @@ gst_h265_parser_new (void)
  * gst_h265_parser_free:
  * @parser: the #GstH265Parser to free
  *
- * Frees @parser and sets it to %NULL
+ * Frees @parser, with all the parameter sets it holds, and sets it to %NULL
  */
 void
 gst_h265_parser_free (GstH265Parser * parser)
 {
+  guint i;
+
+  for (i = 0; i < GST_H265_MAX_VPS_COUNT; i++)
+    if (parser->vps[i])
+      g_slice_free (GstH265VPS, parser->vps[i]);
+  for (i = 0; i < GST_H265_MAX_SPS_COUNT; i++)
+    if (parser->sps[i])
+      g_slice_free (GstH265SPS, parser->sps[i]);
+  for (i = 0; i < GST_H265_MAX_PPS_COUNT; i++)
+    if (parser->pps[i])
+      g_slice_free (GstH265PPS, parser->pps[i]);
+
   g_slice_free (GstH265Parser, parser);
   parser = NULL;
 }
@@ -1374,8 +1391,11 @@ gst_h265_parser_parse_vps (GstH265Parser * parser, GstH265NalUnit * nalu,
   if (res == GST_H265_PARSER_OK) {
     GST_DEBUG ("adding video parameter set with id: %d to array", vps->id);
 
-    parser->vps[vps->id] = *vps;
-    parser->last_vps = &parser->vps[vps->id];
+    /* slots are allocated on first use, and stay where they are */
+    if (!parser->vps[vps->id])
+      parser->vps[vps->id] = g_slice_new (GstH265VPS);
+    *parser->vps[vps->id] = *vps;
+    parser->last_vps = parser->vps[vps->id];
   }
 
   return res;
@@ -1510,8 +1530,11 @@ gst_h265_parser_parse_sps (GstH265Parser * parser, GstH265NalUnit * nalu,
   if (res == GST_H265_PARSER_OK) {
     GST_DEBUG ("adding sequence parameter set with id: %d to array", sps->id);
 
-    parser->sps[sps->id] = *sps;
-    parser->last_sps = &parser->sps[sps->id];
+    /* slots are allocated on first use, and stay where they are */
+    if (!parser->sps[sps->id])
+      parser->sps[sps->id] = g_slice_new (GstH265SPS);
+    *parser->sps[sps->id] = *sps;
+    parser->last_sps = parser->sps[sps->id];
   }
 
   return res;
@@ -1698,10 +1721,10 @@ gst_h265_parse_sps (GstH265Parser * parser, GstH265NalUnit * nalu,
         && !vui->field_seq_flag && !vui->frame_field_info_present_flag) {
       sps->fps_num = vui->time_scale;
       sps->fps_den = vui->num_units_in_tick;
-      printf("framerate %d/%d", sps->fps_num, sps->fps_den);
+      GST_DEBUG ("framerate %d/%d", sps->fps_num, sps->fps_den);
     }
   } else {
-    printf("No VUI, unknown framerate");
+    GST_DEBUG ("No VUI, unknown framerate");
   }
 
   sps->valid = TRUE;
@@ -1861,28 +1884,19 @@ gst_h265_parser_parse_pps (GstH265Parser * parser,
   if (res == GST_H265_PARSER_OK) {
     GST_DEBUG ("adding picture parameter set with id: %d to array", pps->id);
 
-    parser->pps[pps->id] = *pps;
-    parser->last_pps = &parser->pps[pps->id];
+    /* slots are allocated on first use, and stay where they are */
+    if (!parser->pps[pps->id])
+      parser->pps[pps->id] = g_slice_new (GstH265PPS);
+    *parser->pps[pps->id] = *pps;
+    parser->last_pps = parser->pps[pps->id];
   }
 
   return res;
 }
 
-/**
- * gst_h265_parser_parse_slice_hdr:
- * @parser: a #GstH265Parser
- * @nalu: The #GST_H265_NAL_SLICE #GstH265NalUnit to parse
- * @slice: The #GstH265SliceHdr to fill.
- *
- * Parses @data, and fills the @slice structure.
- * The resulting @slice_hdr structure shall be deallocated with
- * gst_h265_slice_hdr_free() when it is no longer needed
- *
- * Returns: a #GstH265ParserResult
- */
-GstH265ParserResult
-gst_h265_parser_parse_slice_hdr (GstH265Parser * parser,
-    GstH265NalUnit * nalu, GstH265SliceHdr * slice)
+static GstH265ParserResult
+gst_h265_parser_parse_slice_hdr_internal (GstH265Parser * parser,
+    GstH265NalUnit * nalu, GstH265SliceHdr * slice, gboolean minimal)
 {
   NalReader nr;
   gint pps_id;
@@ -1906,7 +1920,7 @@ gst_h265_parser_parse_slice_hdr (GstH265Parser * parser,
     return GST_H265_PARSER_ERROR;
   }
 
-  nal_reader_init (&nr, nalu->data + nalu->offset + nalu->header_bytes,
+  nal_reader_init_rbsp (&nr, nalu->data + nalu->offset + nalu->header_bytes,
       nalu->size - nalu->header_bytes);
 
   GST_DEBUG ("parsing \"Slice header\", slice type");
@@ -1973,6 +1987,10 @@ gst_h265_parser_parse_slice_hdr (GstH265Parser * parser,
   slice->num_entry_point_offsets = 0;
   slice->entry_point_offset_minus1 = NULL;
 
+  /* Only the first slice segment carries anything VDPAU needs */
+  if (minimal && !slice->first_slice_segment_in_pic_flag)
+    goto done;
+
   if (!slice->first_slice_segment_in_pic_flag) {
     const guint n = ceil_log2 (PicSizeInCtbsY);
 
@@ -1999,7 +2017,7 @@ gst_h265_parser_parse_slice_hdr (GstH265Parser * parser,
           (sps->log2_max_pic_order_cnt_lsb_minus4 + 4));
 
       READ_UINT8 (&nr, slice->short_term_ref_pic_set_sps_flag, 1);
-      bit_position = nr.byte * 8 - nr.bits_in_cache; /* VDPAU bit counting */
+      bit_position = nal_reader_get_pos (&nr); /* VDPAU bit counting */
       if (!slice->short_term_ref_pic_set_sps_flag) {
         if (!gst_h265_parser_parse_short_term_ref_pic_sets
             (&slice->short_term_ref_pic_sets, &nr,
@@ -2011,9 +2029,9 @@ gst_h265_parser_parse_slice_hdr (GstH265Parser * parser,
         CHECK_ALLOWED_MAX (slice->short_term_ref_pic_set_idx,
             sps->num_short_term_ref_pic_sets - 1);
       }
-      slice->NumShortTermPictureSliceHeaderBits = nr.byte * 8 - nr.bits_in_cache - bit_position;
+      slice->NumShortTermPictureSliceHeaderBits = nal_reader_get_pos (&nr) - bit_position;
 
-      bit_position = nr.byte * 8 - nr.bits_in_cache; /* VDPAU bit counting */
+      bit_position = nal_reader_get_pos (&nr); /* VDPAU bit counting */
       if (sps->long_term_ref_pics_present_flag) {
         guint32 limit;
 
@@ -2046,12 +2064,16 @@ gst_h265_parser_parse_slice_hdr (GstH265Parser * parser,
             READ_UE (&nr, slice->delta_poc_msb_cycle_lt[i]);
         }
       }
-      slice->NumLongTermPictureSliceHeaderBits = nr.byte * 8 - nr.bits_in_cache - bit_position;
+      slice->NumLongTermPictureSliceHeaderBits = nal_reader_get_pos (&nr) - bit_position;
 
       if (sps->temporal_mvp_enabled_flag)
         READ_UINT8 (&nr, slice->temporal_mvp_enabled_flag, 1);
     }
 
+    /* Everything from here on is left to the VDPAU implementation */
+    if (minimal)
+      goto done;
+
     if (sps->sample_adaptive_offset_enabled_flag) {
       READ_UINT8 (&nr, slice->sao_luma_flag, 1);
       READ_UINT8 (&nr, slice->sao_chroma_flag, 1);
@@ -2182,6 +2204,7 @@ gst_h265_parser_parse_slice_hdr (GstH265Parser * parser,
         goto error;
   }
 
+done:
   slice->header_size = nal_reader_get_pos (&nr);
   slice->n_emulation_prevention_bytes = nal_reader_get_epb_count (&nr);
 
@@ -2196,62 +2219,109 @@ error:
 }
 
 /**
- * gst_h265_parser_parse_sei:
+ * gst_h265_parser_parse_slice_hdr:
  * @parser: a #GstH265Parser
- * @nalu: The #GST_H265_NAL_SEI #GstH265NalUnit to parse
- * @sei: The #GstH265SEIMessage to fill.
+ * @nalu: The #GST_H265_NAL_SLICE #GstH265NalUnit to parse
+ * @slice: The #GstH265SliceHdr to fill.
  *
- * Parses @data, and fills the @sei structures.
- * The resulting @sei  structure shall be deallocated with
- * gst_h265_sei_free() when it is no longer needed
+ * Parses @data, and fills the @slice structure.
+ * The resulting @slice_hdr structure shall be deallocated with
+ * gst_h265_slice_hdr_free() when it is no longer needed
  *
  * Returns: a #GstH265ParserResult
  */
 GstH265ParserResult
-gst_h265_parser_parse_sei (GstH265Parser * parser,
-    GstH265NalUnit * nalu, GstH265SEIMessage * sei)
+gst_h265_parser_parse_slice_hdr (GstH265Parser * parser,
+    GstH265NalUnit * nalu, GstH265SliceHdr * slice)
+{
+  return gst_h265_parser_parse_slice_hdr_internal (parser, nalu, slice, FALSE);
+}
+
+/**
+ * gst_h265_parser_parse_slice_hdr_vdpau:
+ * @parser: a #GstH265Parser
+ * @nalu: The #GST_H265_NAL_SLICE #GstH265NalUnit to parse
+ * @slice: The #GstH265SliceHdr to fill.
+ *
+ * Like gst_h265_parser_parse_slice_hdr(), but only parses what
+ * VdpPictureInfoHEVC needs, and stops after slice_temporal_mvp_enabled_flag,
+ * which follows the long-term reference pictures. The
+ * NumShortTermPictureSliceHeaderBits and NumLongTermPictureSliceHeaderBits
+ * are exact. Of a slice segment other than the first of a picture, only
+ * first_slice_segment_in_pic_flag, no_output_of_prior_pics_flag and the
+ * PPS are parsed. Fields that are not parsed keep their default values, and
+ * header_size is the number of bits parsed. Nothing has to be freed.
+ *
+ * Returns: a #GstH265ParserResult
+ */
+GstH265ParserResult
+gst_h265_parser_parse_slice_hdr_vdpau (GstH265Parser * parser,
+    GstH265NalUnit * nalu, GstH265SliceHdr * slice)
+{
+  return gst_h265_parser_parse_slice_hdr_internal (parser, nalu, slice, TRUE);
+}
+
+/* RBSP bit position of @nr, without the emulation prevention bytes */
+static guint
+nal_reader_get_rbsp_pos (const NalReader * nr)
+{
+  return nal_reader_get_pos (nr) - 8 * nal_reader_get_epb_count (nr);
+}
+
+static GstH265ParserResult
+gst_h265_parser_parse_sei_message (GstH265Parser * parser,
+    NalReader * nr, GstH265SEIMessage * sei)
 {
-  NalReader nr;
   guint32 payloadSize;
   guint8 payload_type_byte, payload_size_byte;
+  guint start, consumed;
 #ifndef GST_DISABLE_GST_DEBUG
   guint remaining, payload_size;
 #endif
   GstH265ParserResult res;
-  GST_DEBUG ("parsing \"Sei message\"");
-  nal_reader_init (&nr, nalu->data + nalu->offset + 1, nalu->size - 1);
-  /* init */
+
   memset (sei, 0, sizeof (*sei));
   sei->payloadType = 0;
   do {
-    READ_UINT8 (&nr, payload_type_byte, 8);
+    READ_UINT8 (nr, payload_type_byte, 8);
     sei->payloadType += payload_type_byte;
   } while (payload_type_byte == 0xff);
   payloadSize = 0;
   do {
-    READ_UINT8 (&nr, payload_size_byte, 8);
+    READ_UINT8 (nr, payload_size_byte, 8);
     payloadSize += payload_size_byte;
   }
   while (payload_size_byte == 0xff);
 #ifndef GST_DISABLE_GST_DEBUG
-  remaining = nal_reader_get_remaining (&nr) * 8;
+  remaining = nal_reader_get_remaining (nr) * 8;
   payload_size = payloadSize < remaining ? payloadSize : remaining;
   GST_DEBUG
       ("SEI message received: payloadType  %u, payloadSize = %u bytes",
       sei->payloadType, payload_size);
 #endif
+  start = nal_reader_get_rbsp_pos (nr);
   if (sei->payloadType == GST_H265_SEI_BUF_PERIOD) {
     /* size not set; might depend on emulation_prevention_three_byte */
     res = gst_h265_parser_parse_buffering_period (parser,
-        &sei->payload.buffering_period, &nr);
+        &sei->payload.buffering_period, nr);
   } else if (sei->payloadType == GST_H265_SEI_PIC_TIMING) {
     /* size not set; might depend on emulation_prevention_three_byte */
     res = gst_h265_parser_parse_pic_timing (parser,
-        &sei->payload.pic_timing, &nr);
+        &sei->payload.pic_timing, nr);
   } else
     res = GST_H265_PARSER_OK;
+  if (res != GST_H265_PARSER_OK)
+    goto error;
 
-  return res;
+  /* Skip what is left of the payload, reserved and extension bits
+   * included, to get to the next sei_message () */
+  consumed = nal_reader_get_rbsp_pos (nr) - start;
+  if (consumed > payloadSize * 8)
+    goto error;
+  if (!nal_reader_skip_long (nr, payloadSize * 8 - consumed))
+    goto error;
+
+  return GST_H265_PARSER_OK;
 
 error:
   GST_WARNING ("error parsing \"Sei message\"");
@@ -2260,6 +2330,66 @@ error:
   return GST_H265_PARSER_ERROR;
 }
 
+/**
+ * gst_h265_parser_parse_sei:
+ * @parser: a #GstH265Parser
+ * @nalu: The #GST_H265_NAL_SEI #GstH265NalUnit to parse
+ * @sei: The #GstH265SEIMessage to fill.
+ *
+ * Parses the first SEI message in @nalu, and fills the @sei structures.
+ * The resulting @sei  structure shall be deallocated with
+ * gst_h265_sei_free() when it is no longer needed
+ *
+ * Returns: a #GstH265ParserResult
+ */
+GstH265ParserResult
+gst_h265_parser_parse_sei (GstH265Parser * parser,
+    GstH265NalUnit * nalu, GstH265SEIMessage * sei)
+{
+  guint n_messages;
+
+  return gst_h265_parser_parse_sei_messages (parser, nalu, sei, 1,
+      &n_messages);
+}
+
+/**
+ * gst_h265_parser_parse_sei_messages:
+ * @parser: a #GstH265Parser
+ * @nalu: The #GST_H265_NAL_SEI #GstH265NalUnit to parse
+ * @messages: An array of @max_messages #GstH265SEIMessage to fill.
+ * @max_messages: The size of @messages
+ * @n_messages: (out): The number of messages filled in
+ *
+ * Parses up to @max_messages of the SEI messages in @nalu, in order. Every
+ * message filled in shall be deallocated with gst_h265_sei_free() when it
+ * is no longer needed, also on errors.
+ *
+ * Returns: a #GstH265ParserResult
+ */
+GstH265ParserResult
+gst_h265_parser_parse_sei_messages (GstH265Parser * parser,
+    GstH265NalUnit * nalu, GstH265SEIMessage * messages,
+    guint max_messages, guint * n_messages)
+{
+  NalReader nr;
+  GstH265ParserResult res = GST_H265_PARSER_OK;
+
+  GST_DEBUG ("parsing \"Sei message\"");
+  *n_messages = 0;
+  nal_reader_init_rbsp (&nr, nalu->data + nalu->offset + nalu->header_bytes,
+      nalu->size - nalu->header_bytes);
+
+  do {
+    res = gst_h265_parser_parse_sei_message (parser, &nr,
+        &messages[*n_messages]);
+    if (res != GST_H265_PARSER_OK)
+      break;
+    (*n_messages)++;
+  } while (*n_messages < max_messages && nal_reader_has_more_data (&nr));
+
+  return res;
+}
+
 /**
  * gst_h265_slice_hdr_copy:
  * @dst_slice: The destination #GstH265SliceHdr to copy into
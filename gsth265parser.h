@@ -27,6 +27,7 @@
 #endif
 
 #include <gst/gst.h>
+#include "logging.h"
 
 G_BEGIN_DECLS
 
@@ -41,12 +42,12 @@ G_BEGIN_DECLS
 
 #ifdef GST_WARNING
 #undef GST_WARNING
-#define GST_WARNING printf
+#define GST_WARNING HEVC_LOG_WARNING
 #endif
 
 #ifdef GST_DEBUG
 #undef GST_DEBUG
-#define GST_DEBUG printf
+#define GST_DEBUG HEVC_LOG_TRACE
 #endif
 
 #define READ_UE_MAX(nr, val, max) { \
@@ -959,9 +960,9 @@ struct _GstH265PicTiming
   guint8 source_scan_type;
   guint8 duplicate_flag;
 
-  guint8 au_cpb_removal_delay_minus1;
-  guint8 pic_dpb_output_delay;
-  guint8 pic_dpb_output_du_delay;
+  guint32 au_cpb_removal_delay_minus1;
+  guint32 pic_dpb_output_delay;
+  guint32 pic_dpb_output_du_delay;
   guint32 num_decoding_units_minus1;
   guint8 du_common_cpb_removal_delay_flag;
   guint8 du_common_cpb_removal_delay_increment_minus1;
@@ -974,22 +975,22 @@ struct _GstH265BufferingPeriod
   GstH265SPS *sps;
 
   guint8 irap_cpb_params_present_flag;
-  guint8 cpb_delay_offset;
-  guint8 dpb_delay_offset;
+  guint32 cpb_delay_offset;
+  guint32 dpb_delay_offset;
   guint8 concatenation_flag;
-  guint8 au_cpb_removal_delay_delta_minus1;
+  guint32 au_cpb_removal_delay_delta_minus1;
 
   /* seq->vui_parameters->nal_hrd_parameters_present_flag */
-  guint8 nal_initial_cpb_removal_delay[32];
-  guint8 nal_initial_cpb_removal_offset[32];
-  guint8 nal_initial_alt_cpb_removal_delay[32];
-  guint8 nal_initial_alt_cpb_removal_offset [32];
+  guint32 nal_initial_cpb_removal_delay[32];
+  guint32 nal_initial_cpb_removal_offset[32];
+  guint32 nal_initial_alt_cpb_removal_delay[32];
+  guint32 nal_initial_alt_cpb_removal_offset [32];
 
   /* seq->vui_parameters->vcl_hrd_parameters_present_flag */
-  guint8 vcl_initial_cpb_removal_delay[32];
-  guint8 vcl_initial_cpb_removal_offset[32];
-  guint8 vcl_initial_alt_cpb_removal_delay[32];
-  guint8 vcl_initial_alt_cpb_removal_offset[32];
+  guint32 vcl_initial_cpb_removal_delay[32];
+  guint32 vcl_initial_cpb_removal_offset[32];
+  guint32 vcl_initial_alt_cpb_removal_delay[32];
+  guint32 vcl_initial_alt_cpb_removal_offset[32];
 };
 
 struct _GstH265SEIMessage
@@ -1011,9 +1012,10 @@ struct _GstH265SEIMessage
 struct _GstH265Parser
 {
   /*< private >*/
-  GstH265VPS vps[GST_H265_MAX_VPS_COUNT];
-  GstH265SPS sps[GST_H265_MAX_SPS_COUNT];
-  GstH265PPS pps[GST_H265_MAX_PPS_COUNT];
+  /* indexed by id, allocated once a parameter set with that id is parsed */
+  GstH265VPS *vps[GST_H265_MAX_VPS_COUNT];
+  GstH265SPS *sps[GST_H265_MAX_SPS_COUNT];
+  GstH265PPS *pps[GST_H265_MAX_PPS_COUNT];
   GstH265VPS *last_vps;
   GstH265SPS *last_sps;
   GstH265PPS *last_pps;
@@ -1047,6 +1049,10 @@ GstH265ParserResult gst_h265_parser_parse_slice_hdr (GstH265Parser   * parser,
                                                      GstH265NalUnit  * nalu,
                                                      GstH265SliceHdr * slice);
 
+GstH265ParserResult gst_h265_parser_parse_slice_hdr_vdpau (GstH265Parser   * parser,
+                                                     GstH265NalUnit  * nalu,
+                                                     GstH265SliceHdr * slice);
+
 GstH265ParserResult gst_h265_parser_parse_vps       (GstH265Parser   * parser,
                                                      GstH265NalUnit  * nalu,
                                                      GstH265VPS      * vps);
@@ -1064,6 +1070,12 @@ GstH265ParserResult gst_h265_parser_parse_sei       (GstH265Parser   * parser,
                                                      GstH265NalUnit  * nalu,
                                                      GstH265SEIMessage * sei);
 
+GstH265ParserResult gst_h265_parser_parse_sei_messages (GstH265Parser   * parser,
+                                                     GstH265NalUnit  * nalu,
+                                                     GstH265SEIMessage * messages,
+                                                     guint             max_messages,
+                                                     guint           * n_messages);
+
 void                gst_h265_parser_free            (GstH265Parser  * parser);
 
 GstH265ParserResult gst_h265_parse_vps              (GstH265NalUnit * nalu,
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+
+#define LOG_DEFAULT_RING_SIZE (256u << 10)
+/* Longer messages are truncated. */
+#define LOG_MAX_MESSAGE 1024
+
+int hevc_log_level = HEVC_LOG_LEVEL_INFO;
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static hevc_log_target log_target = HEVC_LOG_TARGET_STDERR;
+static FILE *log_file;
+static char *log_ring;
+static size_t log_ring_size;
+/* Bytes ever written to the ring, the write position is this modulo
+   log_ring_size. */
+static uint64_t log_ring_written;
+
+static const char *level_names[] =
+{
+    "none",
+    "error",
+    "warning",
+    "info",
+    "debug",
+    "trace"
+};
+
+static void ring_write(const char *data, size_t size)
+{
+    size_t pos, n;
+
+    /* Only the tail of an oversized message fits. */
+    if(size > log_ring_size)
+    {
+        log_ring_written += size - log_ring_size;
+        data += size - log_ring_size;
+        size = log_ring_size;
+    }
+
+    pos = log_ring_written % log_ring_size;
+    n = log_ring_size - pos;
+    if(n > size)
+        n = size;
+    memcpy(log_ring + pos, data, n);
+    memcpy(log_ring, data + n, size - n);
+    log_ring_written += size;
+}
+
+static void ring_dump(FILE *out)
+{
+    size_t pos, skip = 0;
+
+    if(log_ring_written <= log_ring_size)
+    {
+        fwrite(log_ring, 1, log_ring_written, out);
+        return;
+    }
+
+    /* The ring wrapped, so the oldest line is cut short. Skip it. */
+    pos = log_ring_written % log_ring_size;
+    while(skip < log_ring_size &&
+            log_ring[(pos + skip) % log_ring_size] != '\n')
+        skip++;
+    skip++;
+    if(skip >= log_ring_size)
+        return;
+    pos = (pos + skip) % log_ring_size;
+
+    fprintf(out, "[... %llu earlier bytes of log output dropped]\n",
+            (unsigned long long)(log_ring_written - log_ring_size + skip));
+    if(pos + (log_ring_size - skip) <= log_ring_size)
+    {
+        fwrite(log_ring + pos, 1, log_ring_size - skip, out);
+    }
+    else
+    {
+        fwrite(log_ring + pos, 1, log_ring_size - pos, out);
+        fwrite(log_ring, 1, log_ring_size - skip - (log_ring_size - pos), out);
+    }
+}
+
+void hevc_log_write(int level, const char *format, ...)
+{
+    char message[LOG_MAX_MESSAGE + 1];
+    va_list args;
+    int size;
+
+    va_start(args, format);
+    size = vsnprintf(message, LOG_MAX_MESSAGE, format, args);
+    va_end(args);
+    if(size < 0)
+        return;
+    if(size >= LOG_MAX_MESSAGE)
+        size = LOG_MAX_MESSAGE - 1;
+    if(size == 0 || message[size - 1] != '\n')
+        message[size++] = '\n';
+
+    pthread_mutex_lock(&log_mutex);
+    switch(log_target)
+    {
+    case HEVC_LOG_TARGET_RING:
+        ring_write(message, size);
+        break;
+    case HEVC_LOG_TARGET_FILE:
+        fwrite(message, 1, size, log_file);
+        break;
+    default:
+        fwrite(message, 1, size, stderr);
+        break;
+    }
+    pthread_mutex_unlock(&log_mutex);
+}
+
+int hevc_log_set_target(
+    hevc_log_target target,
+    const char *path,
+    size_t ring_size)
+{
+    FILE *file = NULL;
+    char *ring = NULL;
+
+    switch(target)
+    {
+    case HEVC_LOG_TARGET_FILE:
+        file = fopen(path, "w");
+        if(file == NULL)
+        {
+            HEVC_LOG_ERROR("Error: unable to open the log file %s.", path);
+            return -1;
+        }
+        break;
+    case HEVC_LOG_TARGET_RING:
+        if(ring_size == 0)
+            ring_size = LOG_DEFAULT_RING_SIZE;
+        ring = malloc(ring_size);
+        if(ring == NULL)
+        {
+            HEVC_LOG_ERROR("Error: MALLOC: log ring buffer.");
+            return -1;
+        }
+        break;
+    default:
+        break;
+    }
+
+    hevc_log_close();
+
+    pthread_mutex_lock(&log_mutex);
+    log_target = target;
+    log_file = file;
+    log_ring = ring;
+    log_ring_size = ring_size;
+    log_ring_written = 0;
+    pthread_mutex_unlock(&log_mutex);
+
+    return 0;
+}
+
+int hevc_log_parse_level(const char *name)
+{
+    char *end;
+    long level;
+    int i;
+
+    for(i = 0; i < (int)(sizeof(level_names) / sizeof(level_names[0])); i++)
+    {
+        if(!strcmp(name, level_names[i]))
+            return i;
+    }
+
+    level = strtol(name, &end, 10);
+    if(*name == '\0' || *end != '\0' ||
+            level < HEVC_LOG_LEVEL_NONE || level > HEVC_LOG_LEVEL_TRACE)
+        return -1;
+    return (int)level;
+}
+
+void hevc_log_close(void)
+{
+    pthread_mutex_lock(&log_mutex);
+    if(log_file)
+        fclose(log_file);
+    if(log_ring)
+    {
+        ring_dump(stderr);
+        free(log_ring);
+    }
+    log_target = HEVC_LOG_TARGET_STDERR;
+    log_file = NULL;
+    log_ring = NULL;
+    log_ring_size = 0;
+    log_ring_written = 0;
+    pthread_mutex_unlock(&log_mutex);
+}
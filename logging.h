@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    logging: leveled diagnostics for the player and the parser.
+
+    Every message has a level. Messages above HEVC_LOG_MAX_LEVEL are
+    removed at compile time, arguments and all, so the default build does
+    not pay for per-NAL unit chatter at all. Build with
+    -DHEVC_LOG_MAX_LEVEL=HEVC_LOG_LEVEL_TRACE (make LOG_MAX_LEVEL=5) to
+    compile everything in.
+
+    Messages that are compiled in are further filtered by a runtime level,
+    and are written to stderr, to a file, or to an in-memory ring buffer
+    that keeps the most recent output and is dumped to stderr on
+    hevc_log_close(). Writing is serialized, so any thread can log.
+ */
+
+#ifndef __LOGGING_H__
+#define __LOGGING_H__
+
+#include <stddef.h>
+
+#define HEVC_LOG_LEVEL_NONE    0
+#define HEVC_LOG_LEVEL_ERROR   1
+#define HEVC_LOG_LEVEL_WARNING 2
+#define HEVC_LOG_LEVEL_INFO    3 /* Once per stream or sequence. */
+#define HEVC_LOG_LEVEL_DEBUG   4 /* Once per picture. */
+#define HEVC_LOG_LEVEL_TRACE   5 /* Once per NAL unit, or more often. */
+
+#ifndef HEVC_LOG_MAX_LEVEL
+#define HEVC_LOG_MAX_LEVEL HEVC_LOG_LEVEL_INFO
+#endif
+
+typedef enum
+{
+    HEVC_LOG_TARGET_STDERR = 0,
+    HEVC_LOG_TARGET_FILE   = 1,
+    HEVC_LOG_TARGET_RING   = 2
+} hevc_log_target;
+
+/* Runtime level, HEVC_LOG_LEVEL_INFO unless changed. */
+extern int hevc_log_level;
+
+/*
+   The level test is a constant for the compiler when level is above
+   HEVC_LOG_MAX_LEVEL, so the whole call goes away. The arguments are still
+   seen by the compiler, so they can not rot or leave variables unused.
+ */
+#define HEVC_LOG(level, ...) \
+    do { \
+        if((level) <= HEVC_LOG_MAX_LEVEL && (level) <= hevc_log_level) \
+            hevc_log_write((level), __VA_ARGS__); \
+    } while (0)
+
+#define HEVC_LOG_ERROR(...)   HEVC_LOG(HEVC_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define HEVC_LOG_WARNING(...) HEVC_LOG(HEVC_LOG_LEVEL_WARNING, __VA_ARGS__)
+#define HEVC_LOG_INFO(...)    HEVC_LOG(HEVC_LOG_LEVEL_INFO, __VA_ARGS__)
+#define HEVC_LOG_DEBUG(...)   HEVC_LOG(HEVC_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define HEVC_LOG_TRACE(...)   HEVC_LOG(HEVC_LOG_LEVEL_TRACE, __VA_ARGS__)
+
+/*
+   Writes one message. A newline is added unless format already ends with
+   one. Use the macros above instead of calling this directly.
+ */
+void hevc_log_write(int level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/*
+   Selects where messages go. path names the file for HEVC_LOG_TARGET_FILE,
+   ring_size is the ring buffer size in bytes for HEVC_LOG_TARGET_RING, or
+   0 for a default. Returns 0, or -1 if the target could not be set up, in
+   which case messages keep going to stderr.
+ */
+int hevc_log_set_target(
+    hevc_log_target target,
+    const char *path,
+    size_t ring_size);
+
+/* Parses a level name ("error" ... "trace") or number, or returns -1. */
+int hevc_log_parse_level(const char *name);
+
+/* Closes the log file, or dumps and frees the ring buffer. */
+void hevc_log_close(void);
+
+#endif /* __LOGGING_H__ */
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "md5.h"
+
+#define ROTATE(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* Per round: the shift amounts of RFC 1321 3.4. */
+static const uint8_t shifts[4][4] =
+{
+    { 7, 12, 17, 22 },
+    { 5,  9, 14, 20 },
+    { 4, 11, 16, 23 },
+    { 6, 10, 15, 21 }
+};
+
+/* floor(abs(sin(i + 1)) * 2^32) */
+static const uint32_t sines[64] =
+{
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+/* RFC 1321 3.4, on one 64 byte block. */
+static void transform(uint32_t state[4], const uint8_t block[64])
+{
+    uint32_t x[16], a, b, c, d, f, t;
+    int i, k;
+
+    for(i = 0; i < 16; i++)
+    {
+        x[i] = (uint32_t)block[4 * i] |
+               (uint32_t)block[4 * i + 1] << 8 |
+               (uint32_t)block[4 * i + 2] << 16 |
+               (uint32_t)block[4 * i + 3] << 24;
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    for(i = 0; i < 64; i++)
+    {
+        switch(i >> 4)
+        {
+        case 0:
+            f = (b & c) | (~b & d);
+            k = i;
+            break;
+        case 1:
+            f = (d & b) | (~d & c);
+            k = (5 * i + 1) & 15;
+            break;
+        case 2:
+            f = b ^ c ^ d;
+            k = (3 * i + 5) & 15;
+            break;
+        default:
+            f = c ^ (b | ~d);
+            k = (7 * i) & 15;
+            break;
+        }
+        t = d;
+        d = c;
+        c = b;
+        b += ROTATE(a + f + sines[i] + x[k], shifts[i >> 4][i & 3]);
+        a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+void hevc_md5_init(hevc_md5 *md5)
+{
+    md5->state[0] = 0x67452301;
+    md5->state[1] = 0xefcdab89;
+    md5->state[2] = 0x98badcfe;
+    md5->state[3] = 0x10325476;
+    md5->length = 0;
+}
+
+void hevc_md5_update(hevc_md5 *md5, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    size_t used = md5->length & 63, n;
+
+    md5->length += size;
+    if(used)
+    {
+        n = 64 - used < size ? 64 - used : size;
+        memcpy(md5->block + used, p, n);
+        p += n;
+        size -= n;
+        if(used + n < 64)
+            return;
+        transform(md5->state, md5->block);
+    }
+    for(; size >= 64; p += 64, size -= 64)
+        transform(md5->state, p);
+    memcpy(md5->block, p, size);
+}
+
+void hevc_md5_final(hevc_md5 *md5, uint8_t digest[MD5_DIGEST_SIZE])
+{
+    static const uint8_t padding[64] = { 0x80 };
+    uint64_t bits = md5->length << 3;
+    uint8_t length[8];
+    int i;
+
+    for(i = 0; i < 8; i++)
+        length[i] = bits >> (8 * i);
+    /* 3.1 and 3.2: a one bit, zeros up to 56 mod 64, the length. */
+    hevc_md5_update(md5, padding, 1 + ((119 - (md5->length & 63)) & 63));
+    hevc_md5_update(md5, length, 8);
+
+    for(i = 0; i < 16; i++)
+        digest[i] = md5->state[i >> 2] >> (8 * (i & 3));
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    md5: RFC 1321 message digests, for checking decoded pictures against
+    the MD5 sums that come with conformance streams.
+ */
+
+#ifndef __MD5_H__
+#define __MD5_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MD5_DIGEST_SIZE 16
+
+typedef struct _hevc_md5
+{
+    uint32_t state[4];
+    uint64_t length;
+    uint8_t block[64];
+} hevc_md5;
+
+void hevc_md5_init(hevc_md5 *md5);
+void hevc_md5_update(hevc_md5 *md5, const void *data, size_t size);
+void hevc_md5_final(hevc_md5 *md5, uint8_t digest[MD5_DIGEST_SIZE]);
+
+#endif /* __MD5_H__ */
@@ -0,0 +1,626 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nalutils.h"
+#include "nalindex.h"
+#include "logging.h"
+
+#define NAL_INDEX_INITIAL_CAPACITY 4096
+
+/*
+   Streamed input only keeps the entries between the last release and the
+   read position, which is a picture's worth of NAL units plus one.
+ */
+#define NAL_INDEX_STREAM_CAPACITY 4096
+
+/*
+   scan_for_start_codes() takes a guint size, so very large mappings are
+   scanned in windows. Consecutive windows overlap by three bytes so that a
+   start code straddling a window boundary is still found.
+ */
+#define NAL_INDEX_SCAN_WINDOW (1u << 30)
+
+/* The largest ring buffer we accept, so that it fits in one scan window. */
+#define NAL_INDEX_MAX_RING_SIZE NAL_INDEX_SCAN_WINDOW
+
+/*
+   Returns the offset of the next 0x000001 start code prefix at or after pos,
+   or -1 if there is none.
+ */
+static int64_t find_start_code(
+    const uint8_t *data,
+    uint64_t pos,
+    uint64_t size)
+{
+    while(size - pos >= 4)
+    {
+        uint64_t window = size - pos;
+        gint off;
+
+        if(window > NAL_INDEX_SCAN_WINDOW)
+            window = NAL_INDEX_SCAN_WINDOW;
+
+        off = scan_for_start_codes(data + pos, (guint) window);
+        if(off >= 0)
+            return pos + off;
+
+        if(window == size - pos)
+            break;
+        pos += window - 3;
+    }
+
+    return -1;
+}
+
+static int add_entry(
+    hevc_nal_index *index,
+    uint64_t sc_pos,
+    uint64_t end_pos)
+{
+    const uint8_t *header = index->data + (sc_pos & index->data_mask) + 3;
+    hevc_nal_entry *entry;
+
+    if(index->streaming)
+    {
+        if(index->count - index->base == index->capacity)
+        {
+            HEVC_LOG_ERROR("Error: more than %u NAL units buffered.\n",
+                           index->capacity);
+            return -1;
+        }
+        entry = &index->entries[index->count++ & (index->capacity - 1)];
+    }
+    else
+    {
+        if(index->count == index->capacity)
+        {
+            uint32_t capacity = index->capacity ?
+                                index->capacity * 2 :
+                                NAL_INDEX_INITIAL_CAPACITY;
+            hevc_nal_entry *entries =
+                realloc(index->entries, capacity * sizeof(hevc_nal_entry));
+
+            if(entries == NULL)
+            {
+                HEVC_LOG_ERROR("Error: MALLOC: NAL index entries.\n");
+                return -1;
+            }
+            index->entries = entries;
+            index->capacity = capacity;
+        }
+        entry = &index->entries[index->count++];
+    }
+
+    entry->offset = sc_pos;
+    entry->size = (uint32_t)(end_pos - sc_pos);
+    /* Implement nal_unit_header(), 7.3.1.2, here. */
+    entry->type = (header[0] & 0x7e) >> 1;
+    entry->layer_id = ((header[0] & 0x1) << 5) | (header[1] >> 3);
+    entry->temporal_id_plus1 = header[1] & 0x7;
+    /* first_slice_segment_in_pic_flag is the first bit after the header. */
+    if(NAL_INDEX_IS_VCL(entry->type) && entry->size > 5)
+        entry->first_slice_segment_in_pic_flag = header[2] >> 7;
+    else
+        entry->first_slice_segment_in_pic_flag = 0;
+
+    return 0;
+}
+
+/*
+   Records the NAL unit starting at sc_pos and ending right before end_pos.
+
+   Trailing zero bytes are stripped, the same way
+   gst_h265_parser_identify_nalu() does. This also drops the leading zero
+   byte of a four byte start code from the end of the preceding NAL unit.
+   Returns the trimmed end, or -1 on failure.
+ */
+static int64_t complete_entry(
+    hevc_nal_index *index,
+    uint64_t sc_pos,
+    uint64_t end_pos)
+{
+    const uint8_t *data = index->data;
+    uint64_t mask = index->data_mask;
+
+    while(end_pos > sc_pos + 3 && data[(end_pos - 1) & mask] == 0x00)
+        end_pos--;
+
+    if(end_pos - sc_pos > UINT32_MAX)
+    {
+        HEVC_LOG_WARNING("Skipping jumbo sized NALU at %#0" PRIx64 "\n",
+                         sc_pos);
+    }
+    /* A NAL unit must at least hold its two byte header. */
+    else if(end_pos - sc_pos >= 5)
+    {
+        if(add_entry(index, sc_pos, end_pos) < 0)
+            return -1;
+    }
+
+    return end_pos;
+}
+
+/*
+   Builds the NAL unit index in one linear pass over the mapping, from byte
+   start on.
+ */
+static int build_index(hevc_nal_index *index, uint64_t start)
+{
+    const uint8_t *data = index->data;
+    uint64_t size = index->data_size;
+    int64_t sc_pos, next_pos;
+
+    sc_pos = find_start_code(data, start, size);
+    while(sc_pos >= 0)
+    {
+        next_pos = find_start_code(data, sc_pos + 3, size);
+
+        if(complete_entry(index, sc_pos,
+                          next_pos >= 0 ? (uint64_t) next_pos : size) < 0)
+            return -1;
+
+        sc_pos = next_pos;
+    }
+
+    return 0;
+}
+
+static int open_mapped(
+    hevc_nal_index *index,
+    const struct stat *st,
+    uint64_t start)
+{
+    void *data;
+
+    data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, index->fd, 0);
+    if(data == MAP_FAILED)
+    {
+        HEVC_LOG_ERROR("Error: unable to mmap the input.\n");
+        return -1;
+    }
+    index->data = data;
+    index->data_size = st->st_size;
+    index->data_mask = UINT64_MAX;
+
+    /* The index pass and most playback read the stream front to back. */
+    madvise(data, index->data_size, MADV_SEQUENTIAL);
+
+    if(build_index(index, start) < 0)
+        return -1;
+
+    HEVC_LOG_INFO("Indexed %u NAL units in %zu bytes.\n",
+                  index->count, (size_t)(index->data_size - start));
+
+    return 0;
+}
+
+/*
+   Maps the same ring_size bytes of memory twice, back to back, so that any
+   ring_size long window of the ring is contiguous.
+ */
+static uint8_t *create_ring(size_t ring_size)
+{
+    uint8_t *ring;
+    int fd;
+
+    fd = memfd_create("nalindex", 0);
+    if(fd < 0)
+        return NULL;
+    if(ftruncate(fd, ring_size) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    ring = mmap(NULL, 2 * ring_size, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    if(mmap(ring, ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(ring + ring_size, ring_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(ring, 2 * ring_size);
+        close(fd);
+        return NULL;
+    }
+
+    /* The mappings keep the memory alive. */
+    close(fd);
+
+    return ring;
+}
+
+static int open_streamed(
+    hevc_nal_index *index,
+    size_t ring_size,
+    int flush_ms)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t size = page_size;
+
+    if(ring_size > NAL_INDEX_MAX_RING_SIZE)
+        ring_size = NAL_INDEX_MAX_RING_SIZE;
+    /* A power of two, so that stream offsets wrap with a mask. */
+    while(size < ring_size)
+        size <<= 1;
+
+    index->data = create_ring(size);
+    if(index->data == NULL)
+    {
+        HEVC_LOG_ERROR("Error: unable to create a %zu byte ring buffer.\n",
+                       size);
+        return -1;
+    }
+    index->data_size = size;
+    index->data_mask = size - 1;
+
+    index->entries = malloc(NAL_INDEX_STREAM_CAPACITY * sizeof(hevc_nal_entry));
+    if(index->entries == NULL)
+    {
+        HEVC_LOG_ERROR("Error: MALLOC: NAL index entries.\n");
+        return -1;
+    }
+    index->capacity = NAL_INDEX_STREAM_CAPACITY;
+
+    index->streaming = 1;
+    index->flush_ms = flush_ms;
+    index->flushed = UINT32_MAX;
+    index->pending = -1;
+
+    HEVC_LOG_INFO("Streaming input through a %zu byte ring buffer.\n",
+                  size);
+
+    return 0;
+}
+
+/*
+   Opens the input and either maps or streams it.
+   Returns 0 on success, or -1 on failure, in which case nothing needs to be
+   released.
+ */
+int hevc_nal_index_open(
+    hevc_nal_index *index,
+    const char *path,
+    size_t ring_size,
+    int flush_ms)
+{
+    struct stat st;
+    int status;
+
+    memset(index, 0, sizeof(*index));
+
+    if(!strcmp(path, "-"))
+        index->fd = STDIN_FILENO;
+    else
+        index->fd = open(path, O_RDONLY);
+    if(index->fd < 0)
+    {
+        index->fd = -1;
+        return -1;
+    }
+
+    if(fstat(index->fd, &st) < 0)
+        goto failure;
+
+    if(S_ISREG(st.st_mode) && ring_size == 0)
+    {
+        if(st.st_size == 0)
+        {
+            HEVC_LOG_ERROR("Error: %s is empty.\n", path);
+            goto failure;
+        }
+        status = open_mapped(index, &st, 0);
+    }
+    else
+    {
+        status = open_streamed(index,
+                               ring_size ? ring_size :
+                               NAL_INDEX_DEFAULT_RING_SIZE,
+                               flush_ms);
+    }
+    if(status < 0)
+        goto failure;
+
+    return 0;
+failure:
+    hevc_nal_index_close(index);
+    return -1;
+}
+
+int hevc_nal_index_open_at(
+    hevc_nal_index *index,
+    const char *path,
+    uint64_t start)
+{
+    struct stat st;
+
+    memset(index, 0, sizeof(*index));
+
+    index->fd = open(path, O_RDONLY);
+    if(index->fd < 0)
+    {
+        index->fd = -1;
+        return -1;
+    }
+
+    if(fstat(index->fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+            start >= (uint64_t)st.st_size)
+    {
+        HEVC_LOG_ERROR("Error: %s has no byte %" PRIu64 " to start at.\n",
+                       path, start);
+        goto failure;
+    }
+    if(open_mapped(index, &st, start) < 0)
+        goto failure;
+
+    return 0;
+failure:
+    hevc_nal_index_close(index);
+    return -1;
+}
+
+void hevc_nal_index_close(hevc_nal_index *index)
+{
+    if(index->data)
+        munmap((void *) index->data,
+               index->streaming ? 2 * index->data_size : index->data_size);
+    if(index->fd > STDIN_FILENO)
+        close(index->fd);
+    free(index->entries);
+
+    memset(index, 0, sizeof(*index));
+    index->fd = -1;
+}
+
+/* Indexes every NAL unit whose end is now known. */
+static int stream_scan(hevc_nal_index *index)
+{
+    while(index->fill - index->scan_pos >= 4)
+    {
+        uint64_t sc_pos;
+        gint off;
+
+        off = scan_for_start_codes(
+                  index->data + (index->scan_pos & index->data_mask),
+                  (guint)(index->fill - index->scan_pos));
+        if(off < 0)
+        {
+            /* Every position up to fill - 4 has been checked. */
+            index->scan_pos = index->fill - 3;
+            break;
+        }
+        sc_pos = index->scan_pos + off;
+
+        if(index->pending >= 0 &&
+                complete_entry(index, index->pending, sc_pos) < 0)
+            return -1;
+
+        index->pending = sc_pos;
+        index->scan_pos = sc_pos + 3;
+    }
+
+    return 0;
+}
+
+/* Hands out the NAL unit still being read as it is. */
+static int stream_flush(hevc_nal_index *index)
+{
+    uint32_t count = index->count;
+    int64_t end_pos;
+
+    end_pos = complete_entry(index, index->pending, index->fill);
+    if(end_pos < 0)
+        return -1;
+
+    /* Anything after the trimmed end may still be part of a start code. */
+    index->pending = -1;
+    index->scan_pos = end_pos;
+    if(index->count != count)
+        index->flushed = index->count - 1;
+
+    return 0;
+}
+
+/* Free space in the ring buffer. */
+static size_t stream_space(hevc_nal_index *index)
+{
+    uint64_t keep;
+
+    /* Oldest byte still needed. */
+    if(index->base < index->count)
+        keep = index->entries[index->base & (index->capacity - 1)].offset;
+    else if(index->pending >= 0)
+        keep = index->pending;
+    else
+        keep = index->scan_pos;
+
+    return index->data_size - (size_t)(index->fill - keep);
+}
+
+/* Reads more input and indexes it. Returns -1 on failure. */
+static int stream_read(hevc_nal_index *index)
+{
+    size_t space;
+    ssize_t bytes;
+
+    space = stream_space(index);
+    if(space == 0)
+    {
+        HEVC_LOG_ERROR("Error: NAL unit larger than the %zu byte ring "
+                       "buffer.\n", index->data_size);
+        return -1;
+    }
+
+    if(index->flush_ms >= 0 && index->pending >= 0)
+    {
+        struct pollfd pfd = { index->fd, POLLIN, 0 };
+        int ready;
+
+        do
+            ready = poll(&pfd, 1, index->flush_ms);
+        while(ready < 0 && errno == EINTR);
+
+        if(ready == 0)
+            return stream_flush(index);
+    }
+
+    do
+        bytes = read(index->fd,
+                     (uint8_t *) index->data + (index->fill & index->data_mask),
+                     space);
+    while(bytes < 0 && errno == EINTR);
+
+    if(bytes < 0)
+    {
+        HEVC_LOG_ERROR("Error: reading the input: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if(bytes == 0)
+    {
+        index->eof = 1;
+        if(index->pending >= 0)
+            return stream_flush(index);
+        return 0;
+    }
+
+    index->fill += bytes;
+
+    return stream_scan(index);
+}
+
+int hevc_nal_index_open_push(hevc_nal_index *index, size_t ring_size)
+{
+    memset(index, 0, sizeof(*index));
+    index->fd = -1;
+
+    if(open_streamed(index,
+                     ring_size ? ring_size : NAL_INDEX_DEFAULT_RING_SIZE,
+                     -1) < 0)
+    {
+        hevc_nal_index_close(index);
+        return -1;
+    }
+
+    return 0;
+}
+
+ssize_t hevc_nal_index_push(
+    hevc_nal_index *index,
+    const uint8_t *data,
+    size_t size)
+{
+    size_t space;
+
+    if(index->eof)
+        return size ? -1 : 0;
+
+    if(size == 0)
+    {
+        index->eof = 1;
+        if(index->pending >= 0 && stream_flush(index) < 0)
+            return -1;
+        return 0;
+    }
+
+    space = stream_space(index);
+    if(space == 0)
+    {
+        /* Nothing left to release, so nothing will ever fit. */
+        if(index->base == index->count)
+        {
+            HEVC_LOG_ERROR("Error: NAL unit larger than the %zu byte ring "
+                           "buffer.\n", index->data_size);
+            return -1;
+        }
+        return 0;
+    }
+    if(size > space)
+        size = space;
+
+    /* The second mapping makes this contiguous across the wrap. */
+    memcpy((uint8_t *) index->data + (index->fill & index->data_mask),
+           data, size);
+    index->fill += size;
+
+    if(stream_scan(index) < 0)
+        return -1;
+
+    return size;
+}
+
+const hevc_nal_entry *hevc_nal_index_get(hevc_nal_index *index, uint32_t n)
+{
+    if(!index->streaming)
+        return n < index->count ? &index->entries[n] : NULL;
+
+    if(n < index->base)
+        return NULL;
+
+    while(n >= index->count)
+    {
+        /* Pushed input only grows in hevc_nal_index_push(). */
+        if(index->eof || index->fd < 0)
+            return NULL;
+        if(stream_read(index) < 0)
+        {
+            /* Treat it as the end of the stream. */
+            index->eof = 1;
+            index->pending = -1;
+            return NULL;
+        }
+    }
+
+    return &index->entries[n & (index->capacity - 1)];
+}
+
+const hevc_nal_entry *hevc_nal_index_peek(hevc_nal_index *index, uint32_t n)
+{
+    if(index->streaming && n >= index->count &&
+            index->flushed != UINT32_MAX && index->flushed + 1 == n)
+        return NULL;
+
+    return hevc_nal_index_get(index, n);
+}
+
+void hevc_nal_index_release(hevc_nal_index *index, uint32_t n)
+{
+    if(!index->streaming)
+        return;
+
+    if(n > index->count)
+        n = index->count;
+    if(n > index->base)
+        index->base = n;
+}
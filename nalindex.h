@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    nalindex: a zero-copy NAL unit index over a memory mapped H.265/HEVC
+    elementary stream.
+
+    The whole stream is mapped read-only once, and a single linear pass
+    records the location and nal_unit_header() of every NAL unit. Callers
+    hand pointers into the mapping straight to the parser and to
+    VdpDecoderRender, so no NAL unit data is ever copied.
+
+    Input that cannot be mapped (stdin, pipes, sockets, character devices)
+    is streamed instead. It is read() into a fixed size ring buffer that is
+    mapped twice, back to back, so every NAL unit held in the ring is
+    contiguous in memory. Entries are then indexed on demand, only as far
+    as the caller asks for them, and memory stays bounded no matter how
+    long the stream is.
+
+    Streamed input can also be pushed by the caller, with
+    hevc_nal_index_push(), instead of being read from a file descriptor.
+
+    Callers walk the index with hevc_nal_index_get() and
+    hevc_nal_index_peek(), and hand back entries they no longer need with
+    hevc_nal_index_release(). Both kinds of input behave the same through
+    these calls.
+ */
+
+#ifndef __NAL_INDEX_H__
+#define __NAL_INDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* VCL NAL unit types are 0 through 31, see Table 7-1. */
+#define NAL_INDEX_IS_VCL(type) ((type) < 32)
+
+/*
+   7.4.2.4.4: FD_NUT, SUFFIX_SEI_NUT, RSV_NVCL45..47 and UNSPEC56..63 may
+   only come after the first VCL NAL unit of an access unit, including in
+   between the slice segments of its picture. Every other non-VCL NAL unit
+   type ends the access unit.
+ */
+#define NAL_INDEX_IS_SUFFIX(type) \
+    ((type) == 38 || (type) == 40 || ((type) >= 45 && (type) <= 47) || \
+     (type) >= 56)
+
+/*
+   One entry per NAL unit.
+
+   offset and size cover the 0x000001 start code prefix, the NAL unit header
+   and the payload, with any trailing_zero_8bits removed. This is exactly the
+   byte range to pass to VDPAU in a VdpBitstreamBuffer. offset counts from
+   the start of the stream, also for streamed input.
+ */
+typedef struct _hevc_nal_entry
+{
+    uint64_t offset;
+    uint32_t size;
+    uint8_t  type;
+    uint8_t  layer_id;
+    uint8_t  temporal_id_plus1;
+    /* Only meaningful for VCL NAL units. */
+    uint8_t  first_slice_segment_in_pic_flag;
+} hevc_nal_entry;
+
+/* Default ring buffer size for streamed input. */
+#define NAL_INDEX_DEFAULT_RING_SIZE (16u << 20)
+
+typedef struct _hevc_nal_index
+{
+    /* -1 for pushed input. */
+    int fd;
+    /* The mapping, or the ring buffer when streaming. */
+    const uint8_t *data;
+    size_t data_size;
+    /* Turns an entry offset into an offset into data. */
+    uint64_t data_mask;
+    /*
+       All entries for a mapped file. A ring of capacity entries when
+       streaming, where entry n lives at entries[n & (capacity - 1)].
+     */
+    hevc_nal_entry *entries;
+    /* Number of entries indexed so far. */
+    uint32_t count;
+    uint32_t capacity;
+
+    /* Streamed input only. */
+    uint8_t  streaming;
+    uint8_t  eof;
+    /* Low-latency flush timeout in ms, or -1 to wait for the next NAL. */
+    int      flush_ms;
+    /* Oldest entry still held by the caller. */
+    uint32_t base;
+    /* Last entry completed by a low-latency flush, or UINT32_MAX. */
+    uint32_t flushed;
+    /* Stream offset of the next byte to read(). */
+    uint64_t fill;
+    /* Where the next start code search begins. */
+    uint64_t scan_pos;
+    /* Start code of the NAL unit still being read, or -1. */
+    int64_t  pending;
+} hevc_nal_index;
+
+/*
+   Opens path, or stdin for "-". Regular files are mapped and indexed up
+   front unless ring_size is not 0. Everything else is streamed through a
+   ring buffer of ring_size bytes, or NAL_INDEX_DEFAULT_RING_SIZE if
+   ring_size is 0.
+
+   With flush_ms >= 0, a streamed NAL unit is handed out once the producer
+   has stalled for flush_ms milliseconds, instead of waiting for the start
+   code of the next one. This assumes the producer writes whole access
+   units: a stall also ends the current picture for hevc_nal_index_peek().
+ */
+int hevc_nal_index_open(
+    hevc_nal_index *index,
+    const char *path,
+    size_t ring_size,
+    int flush_ms);
+
+/*
+   Maps the regular file path, but only indexes the NAL units from byte
+   start on, which must be where one begins. Entry offsets still count from
+   the start of the file. Nothing before start is read.
+ */
+int hevc_nal_index_open_at(
+    hevc_nal_index *index,
+    const char *path,
+    uint64_t start);
+void hevc_nal_index_close(hevc_nal_index *index);
+
+/*
+   Sets up streamed input that is handed over with hevc_nal_index_push(),
+   through a ring buffer of ring_size bytes, or NAL_INDEX_DEFAULT_RING_SIZE
+   if ring_size is 0.
+ */
+int hevc_nal_index_open_push(hevc_nal_index *index, size_t ring_size);
+
+/*
+   Appends up to size bytes to pushed input, and indexes every NAL unit
+   that is now complete. Returns how many bytes fit into the ring buffer,
+   which may be fewer than size until the caller releases entries, or -1
+   if the ring buffer is too small for a single NAL unit. A size of 0 ends
+   the stream.
+
+   hevc_nal_index_get() returns NULL for entries that have not been pushed
+   yet, and eof tells whether any more can come.
+ */
+ssize_t hevc_nal_index_push(
+    hevc_nal_index *index,
+    const uint8_t *data,
+    size_t size);
+
+/*
+   Returns entry n, reading more input if needed, or NULL at the end of the
+   stream or on a read error. Entries before the last released one are
+   gone.
+ */
+const hevc_nal_entry *hevc_nal_index_get(hevc_nal_index *index, uint32_t n);
+
+/*
+   Like hevc_nal_index_get(), but returns NULL instead of waiting when the
+   producer stalled right before entry n. Use this to look ahead.
+ */
+const hevc_nal_entry *hevc_nal_index_peek(hevc_nal_index *index, uint32_t n);
+
+/*
+   The caller is done with every entry before n, and their data may be
+   overwritten by streamed input.
+ */
+void hevc_nal_index_release(hevc_nal_index *index, uint32_t n);
+
+/* Pointer to the first byte (start code) of a NAL unit. */
+static inline const uint8_t *hevc_nal_index_data(
+    const hevc_nal_index *index,
+    const hevc_nal_entry *entry)
+{
+    return index->data + (entry->offset & index->data_mask);
+}
+
+#endif /* __NAL_INDEX_H__ */
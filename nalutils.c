@@ -73,11 +73,144 @@ nal_reader_init (NalReader * nr, const guint8 * data, guint size)
   /* fill with something other than 0 to detect emulation prevention bytes */
   nr->first_byte = 0xff;
   nr->cache = 0xff;
+
+  nr->rbsp = NULL;
+  nr->rbsp_size = 0;
+  nr->rbsp_pos = 0;
+  nr->rbsp_raw = 0;
+  nr->rbsp_after_epb = 0;
+  nr->epb = NULL;
+  nr->rbsp_n_epb = 0;
+}
+
+/* Scratch space for nal_reader_init_rbsp (). The 8 zero bytes after the
+ * prefix let the 64 bit window load run past its end. */
+static __thread guint8 rbsp_scratch[NAL_READER_RBSP_SIZE + 1 + 8];
+/* With the zero counting below, 00 00 03 00 03 00 03 ... has an EPB in
+ * every other byte. */
+static __thread guint rbsp_epb[NAL_READER_RBSP_SIZE / 2 + 1];
+
+/* Unescapes the next NAL_READER_RBSP_CHUNK bytes of the prefix, so that a
+ * slice header only pays for roughly its own size. Returns FALSE when the
+ * prefix is complete. */
+static gboolean
+nal_reader_rbsp_unescape (NalReader * nr)
+{
+  const guint8 *data = nr->data, *three;
+  guint8 *out = rbsp_scratch + nr->rbsp_size;
+  guint n_epb = nr->rbsp_n_epb;
+  guint limit, i = nr->rbsp_raw, run;
+
+  limit = MIN (MIN (nr->size, NAL_READER_RBSP_SIZE),
+      i + NAL_READER_RBSP_CHUNK);
+  if (i >= limit)
+    return FALSE;
+
+  /* Copy runs up to each 0x03, and drop the ones that follow two zero
+   * bytes, exactly like nal_reader_read () does: the zeros are counted in
+   * the output, and the byte right after an EPB is never one. */
+  while (i < limit) {
+    three = memchr (data + i, 0x03, limit - i);
+    run = three ? three - (data + i) : limit - i;
+    memcpy (out, data + i, run);
+    out += run;
+    i += run;
+    if (!three)
+      break;
+
+    if (i != nr->rbsp_after_epb && out - rbsp_scratch >= 2 &&
+        out[-1] == 0x00 && out[-2] == 0x00) {
+      rbsp_epb[n_epb++] = out - rbsp_scratch;
+      nr->rbsp_after_epb = i + 1;
+      /* Never stop right after an EPB, so that the next chunk, or leaving
+       * RBSP mode, does not have to carry over that the next byte is
+       * data. */
+      if (i + 1 == limit && limit < nr->size)
+        limit++;
+    } else {
+      *out++ = 0x03;
+    }
+    i++;
+  }
+
+  memset (out, 0, 8);
+
+  nr->rbsp_raw = i;
+  nr->rbsp_size = out - rbsp_scratch;
+  nr->rbsp_n_epb = n_epb;
+  return TRUE;
+}
+
+void
+nal_reader_init_rbsp (NalReader * nr, const guint8 * data, guint size)
+{
+  nal_reader_init (nr, data, size);
+
+  nr->rbsp = rbsp_scratch;
+  nr->epb = rbsp_epb;
+  nr->rbsp_raw = 0;
+  nr->rbsp_after_epb = G_MAXUINT;
+  nal_reader_rbsp_unescape (nr);
+}
+
+/* EPBs before the first k bytes of the RBSP, which is how many
+ * nal_reader_read () would have skipped after loading those k bytes. */
+static inline guint
+nal_reader_rbsp_epb_before (const NalReader * nr, guint k)
+{
+  guint n = 0;
+
+  while (n < nr->rbsp_n_epb && nr->epb[n] < k)
+    n++;
+  return n;
+}
+
+/* Switches over to the normal mode at the current position, with the state
+ * nal_reader_read () would have had. */
+static void
+nal_reader_leave_rbsp (NalReader * nr)
+{
+  guint k = (nr->rbsp_pos + 7) / 8;
+
+  nr->n_epb = nal_reader_rbsp_epb_before (nr, k);
+  nr->byte = k + nr->n_epb;
+  nr->bits_in_cache = k * 8 - nr->rbsp_pos;
+  nr->first_byte = k >= 1 ? nr->rbsp[k - 1] : 0xff;
+  nr->cache = k >= 2 ? nr->rbsp[k - 2] : 0xff;
+  nr->rbsp = NULL;
+}
+
+/* TRUE if the next nbits are in the RBSP prefix, unescaping more of it as
+ * needed. Otherwise leaves RBSP mode, for the caller to go on in the normal
+ * mode. */
+static inline gboolean
+nal_reader_rbsp_has_bits (NalReader * nr, guint nbits)
+{
+  while (G_UNLIKELY (nr->rbsp_pos + nbits > nr->rbsp_size * 8)) {
+    if (!nal_reader_rbsp_unescape (nr)) {
+      nal_reader_leave_rbsp (nr);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/* The next 57 or more bits of the RBSP, MSB first. */
+static inline guint64
+nal_reader_rbsp_peek (const NalReader * nr)
+{
+  guint64 window;
+
+  memcpy (&window, nr->rbsp + nr->rbsp_pos / 8, sizeof (window));
+  return GUINT64_FROM_BE (window) << (nr->rbsp_pos % 8);
 }
 
 inline gboolean
 nal_reader_read (NalReader * nr, guint nbits)
 {
+  if (nr->rbsp && nal_reader_rbsp_has_bits (nr, nbits))
+    return TRUE;
+
   if (G_UNLIKELY (nr->byte * 8 + (nbits - nr->bits_in_cache) > nr->size * 8)) {
     GST_DEBUG ("Can not read %u bits, bits in cache %u, Byte * 8 %u, size in "
         "bits %u", nbits, nr->bits_in_cache, nr->byte * 8, nr->size * 8);
@@ -118,6 +251,11 @@ nal_reader_skip (NalReader * nr, guint nbits)
 {
   g_assert (nbits <= 8 * sizeof (nr->cache));
 
+  if (nr->rbsp && nal_reader_rbsp_has_bits (nr, nbits)) {
+    nr->rbsp_pos += nbits;
+    return TRUE;
+  }
+
   if (G_UNLIKELY (!nal_reader_read (nr, nbits)))
     return FALSE;
 
@@ -145,21 +283,27 @@ nal_reader_skip_long (NalReader * nr, guint nbits)
 }
 
 inline guint
-nal_reader_get_pos (const NalReader * nr)
+nal_reader_get_epb_count (const NalReader * nr)
 {
-  return nr->byte * 8 - nr->bits_in_cache;
+  if (nr->rbsp)
+    return nal_reader_rbsp_epb_before (nr, (nr->rbsp_pos + 7) / 8);
+  return nr->n_epb;
 }
 
 inline guint
-nal_reader_get_remaining (const NalReader * nr)
+nal_reader_get_pos (const NalReader * nr)
 {
-  return (nr->size - nr->byte) * 8 + nr->bits_in_cache;
+  if (nr->rbsp)
+    return nr->rbsp_pos + 8 * nal_reader_get_epb_count (nr);
+  return nr->byte * 8 - nr->bits_in_cache;
 }
 
 inline guint
-nal_reader_get_epb_count (const NalReader * nr)
+nal_reader_get_remaining (const NalReader * nr)
 {
-  return nr->n_epb;
+  if (nr->rbsp)
+    return nr->size * 8 - nal_reader_get_pos (nr);
+  return (nr->size - nr->byte) * 8 + nr->bits_in_cache;
 }
 
 #define NAL_READER_READ_BITS(bits) \
@@ -168,14 +312,20 @@ nal_reader_get_bits_uint##bits (NalReader *nr, guint##bits *val, guint nbits) \
 { \
   guint shift; \
   \
+  if (nr->rbsp && nal_reader_rbsp_has_bits (nr, nbits)) { \
+    /* Two shifts, as nbits can be 0 */ \
+    *val = nal_reader_rbsp_peek (nr) >> 1 >> (63 - nbits); \
+    nr->rbsp_pos += nbits; \
+    return TRUE; \
+  } \
+  \
   if (!nal_reader_read (nr, nbits)) \
     return FALSE; \
   \
-  /* bring the required bits down and truncate */ \
+  /* bring the required bits down and truncate. The cache can hold more \
+   * than a byte beyond them after nal_reader_get_ue() looked ahead. */ \
   shift = nr->bits_in_cache - nbits; \
-  *val = nr->first_byte >> shift; \
-  \
-  *val |= nr->cache << (8 - shift); \
+  *val = ((nr->cache << 8) | nr->first_byte) >> shift; \
   /* mask out required bits */ \
   if (nbits < bits) \
     *val &= ((guint##bits)1 << nbits) - 1; \
@@ -201,6 +351,57 @@ nal_reader_peek_bits_uint##bits (const NalReader *nr, guint##bits *val, guint nb
 
 NAL_READER_PEEK_BITS (8);
 
+/* Decodes ue(v) codes of up to 32 bits, that is values below 65535, from
+ * a 32 bit window: count the leading zeros, and take the code in one go.
+ * Returns FALSE, leaving nr untouched, when the code is longer or the
+ * window runs past the end of the data. */
+static inline gboolean
+nal_reader_get_ue_fast (NalReader * nr, guint32 * val)
+{
+  NalReader tmp;
+  guint32 window;
+  guint leading_zeros, nbits;
+
+  if (nr->rbsp) {
+    /* Past the unescaped bytes the window reads zeros, which can only make
+     * the code look longer than what is left. */
+    while (G_UNLIKELY (nr->rbsp_pos + 32 > nr->rbsp_size * 8)
+        && nal_reader_rbsp_unescape (nr));
+    window = nal_reader_rbsp_peek (nr) >> 32;
+    if (G_UNLIKELY (window < 0x10000))
+      return FALSE;
+
+    leading_zeros = __builtin_clz (window);
+    nbits = 2 * leading_zeros + 1;
+    if (G_UNLIKELY (!nal_reader_rbsp_has_bits (nr, nbits)))
+      return FALSE;
+    *val = (window >> (32 - nbits)) - 1;
+    nr->rbsp_pos += nbits;
+    return TRUE;
+  }
+
+  tmp = *nr;
+  if (G_UNLIKELY (!nal_reader_get_bits_uint32 (&tmp, &window, 32)))
+    return FALSE;
+  if (G_UNLIKELY (window < 0x10000))
+    return FALSE;
+
+  leading_zeros = __builtin_clz (window);
+  nbits = 2 * leading_zeros + 1;
+  *val = (window >> (32 - nbits)) - 1;
+
+  if (G_LIKELY (tmp.n_epb == nr->n_epb)) {
+    /* Keep the read ahead bits in the cache. */
+    tmp.bits_in_cache += 32 - nbits;
+    *nr = tmp;
+    return TRUE;
+  }
+
+  /* An emulation prevention byte came up past the end of the code. It must
+   * not be counted yet, so consume just the code from the original state. */
+  return nal_reader_skip (nr, nbits);
+}
+
 gboolean
 nal_reader_get_ue (NalReader * nr, guint32 * val)
 {
@@ -208,6 +409,10 @@ nal_reader_get_ue (NalReader * nr, guint32 * val)
   guint8 bit;
   guint32 value;
 
+  if (G_LIKELY (nal_reader_get_ue_fast (nr, val)))
+    return TRUE;
+
+  /* Long codes, and codes near the end of the data. */
   if (G_UNLIKELY (!nal_reader_get_bits_uint8 (nr, &bit, 1))) {
 
     return FALSE;
@@ -250,7 +455,8 @@ nal_reader_get_se (NalReader * nr, gint32 * val)
 gboolean
 nal_reader_is_byte_aligned (NalReader * nr)
 {
-  if (nr->bits_in_cache != 0)
+  /* The cache can hold more than the bits of the current byte. */
+  if (nal_reader_get_pos (nr) % 8 != 0)
     return FALSE;
   return TRUE;
 }
@@ -298,8 +504,14 @@ nal_reader_has_more_data (NalReader * nr)
 
 /***********  end of nal parser ***************/
 
-inline gint
-scan_for_start_codes (const guint8 * data, guint size)
+/****** Start code scanning ******/
+
+/* The scalar scanner in GstByteReader is the reference implementation. The
+ * vector scanners below only ever walk whole blocks of candidate positions
+ * and hand the remaining tail to it, so all of them return exactly the same
+ * offset: the first position i <= size - 4 with data[i..i+2] == 00 00 01. */
+static gint
+scan_for_start_codes_scalar (const guint8 * data, guint size)
 {
   GstByteReader br;
   gst_byte_reader_init (&br, data, size);
@@ -308,3 +520,132 @@ scan_for_start_codes (const guint8 * data, guint size)
   return gst_byte_reader_masked_scan_uint32 (&br, 0xffffff00, 0x00000100,
       0, size);
 }
+
+/* Finishes a vector scan: positions before i were all rejected. */
+static inline gint
+scan_for_start_codes_tail (const guint8 * data, guint size, guint i)
+{
+  gint off;
+
+  if (size - i < 4)
+    return -1;
+
+  off = scan_for_start_codes_scalar (data + i, size - i);
+  return off < 0 ? -1 : (gint) i + off;
+}
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define HAVE_X86_START_CODE_SCAN 1
+#include <immintrin.h>
+
+/* A block of N candidate positions starting at i reads up to data[i+N+1];
+ * the last candidate must also leave one byte after the start code. */
+__attribute__ ((target ("sse2")))
+static gint
+scan_for_start_codes_sse2 (const guint8 * data, guint size)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i one = _mm_set1_epi8 (1);
+  guint i = 0;
+
+  while (i + 16 + 3 <= size) {
+    __m128i b0 = _mm_loadu_si128 ((const __m128i *) (data + i));
+    __m128i b1 = _mm_loadu_si128 ((const __m128i *) (data + i + 1));
+    __m128i b2 = _mm_loadu_si128 ((const __m128i *) (data + i + 2));
+    __m128i m = _mm_and_si128 (_mm_and_si128 (_mm_cmpeq_epi8 (b0, zero),
+            _mm_cmpeq_epi8 (b1, zero)), _mm_cmpeq_epi8 (b2, one));
+    guint mask = (guint) _mm_movemask_epi8 (m);
+
+    if (mask)
+      return i + __builtin_ctz (mask);
+    i += 16;
+  }
+
+  return scan_for_start_codes_tail (data, size, i);
+}
+
+__attribute__ ((target ("avx2")))
+static gint
+scan_for_start_codes_avx2 (const guint8 * data, guint size)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i one = _mm256_set1_epi8 (1);
+  guint i = 0;
+
+  while (i + 32 + 3 <= size) {
+    __m256i b0 = _mm256_loadu_si256 ((const __m256i *) (data + i));
+    __m256i b1 = _mm256_loadu_si256 ((const __m256i *) (data + i + 1));
+    __m256i b2 = _mm256_loadu_si256 ((const __m256i *) (data + i + 2));
+    __m256i m =
+        _mm256_and_si256 (_mm256_and_si256 (_mm256_cmpeq_epi8 (b0, zero),
+            _mm256_cmpeq_epi8 (b1, zero)), _mm256_cmpeq_epi8 (b2, one));
+    guint mask = (guint) _mm256_movemask_epi8 (m);
+
+    if (mask)
+      return i + __builtin_ctz (mask);
+    i += 32;
+  }
+
+  return scan_for_start_codes_tail (data, size, i);
+}
+#endif
+
+#if defined (__GNUC__) && (defined (__aarch64__) || defined (__ARM_NEON))
+#define HAVE_NEON_START_CODE_SCAN 1
+#include <arm_neon.h>
+
+static gint
+scan_for_start_codes_neon (const guint8 * data, guint size)
+{
+  const uint8x16_t zero = vdupq_n_u8 (0);
+  const uint8x16_t one = vdupq_n_u8 (1);
+  guint i = 0;
+
+  while (i + 16 + 3 <= size) {
+    uint8x16_t m = vandq_u8 (vandq_u8 (vceqq_u8 (vld1q_u8 (data + i), zero),
+            vceqq_u8 (vld1q_u8 (data + i + 1), zero)),
+        vceqq_u8 (vld1q_u8 (data + i + 2), one));
+    /* Narrow to one nibble per byte, there is no movemask on NEON. */
+    guint64 mask =
+        vget_lane_u64 (vreinterpret_u64_u8 (vshrn_n_u16 (vreinterpretq_u16_u8
+                (m), 4)), 0);
+
+    if (mask)
+      return i + (__builtin_ctzll (mask) >> 2);
+    i += 16;
+  }
+
+  return scan_for_start_codes_tail (data, size, i);
+}
+#endif
+
+typedef gint (*ScanForStartCodesFunc) (const guint8 * data, guint size);
+
+static ScanForStartCodesFunc
+scan_for_start_codes_select (void)
+{
+#ifdef HAVE_X86_START_CODE_SCAN
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    return scan_for_start_codes_avx2;
+  if (__builtin_cpu_supports ("sse2"))
+    return scan_for_start_codes_sse2;
+#endif
+#ifdef HAVE_NEON_START_CODE_SCAN
+  return scan_for_start_codes_neon;
+#endif
+  return scan_for_start_codes_scalar;
+}
+
+/* Every caller picks the same implementation, so racing first calls are
+ * harmless. */
+static ScanForStartCodesFunc scan_for_start_codes_impl = NULL;
+
+gint
+scan_for_start_codes (const guint8 * data, guint size)
+{
+  if (G_UNLIKELY (scan_for_start_codes_impl == NULL))
+    scan_for_start_codes_impl = scan_for_start_codes_select ();
+
+  return scan_for_start_codes_impl (data, size);
+}
@@ -36,15 +36,16 @@
 #include <gst/base/gstbytereader.h>
 #include <gst/base/gstbitreader.h>
 #include <string.h>
+#include "logging.h"
 
 #ifdef GST_WARNING
 #undef GST_WARNING
-#define GST_WARNING printf
+#define GST_WARNING HEVC_LOG_WARNING
 #endif
 
 #ifdef GST_DEBUG
 #undef GST_DEBUG
-#define GST_DEBUG printf
+#define GST_DEBUG HEVC_LOG_TRACE
 #endif
 
 guint ceil_log2 (guint32 v);
@@ -59,10 +60,38 @@ typedef struct
   guint bits_in_cache;          /* bitpos in the cache of next bit */
   guint8 first_byte;
   guint64 cache;                /* cached bytes */
+
+  /* RBSP mode, see nal_reader_init_rbsp () */
+  const guint8 *rbsp;           /* Unescaped prefix, NULL once left */
+  guint rbsp_size;              /* Bytes in rbsp */
+  guint rbsp_pos;               /* Bit position in rbsp */
+  guint rbsp_raw;               /* Bytes of data unescaped so far */
+  guint rbsp_after_epb;         /* Byte of data right after the last EPB */
+  const guint *epb;             /* rbsp index of the byte after each EPB */
+  guint rbsp_n_epb;             /* Number of entries in epb */
 } NalReader;
 
+/* Prefix of a NAL unit that nal_reader_init_rbsp () unescapes, in chunks
+ * as the reader gets to them. */
+#ifndef NAL_READER_RBSP_SIZE
+#define NAL_READER_RBSP_SIZE 1024
+#endif
+#ifndef NAL_READER_RBSP_CHUNK
+#define NAL_READER_RBSP_CHUNK 64
+#endif
+
 void nal_reader_init (NalReader * nr, const guint8 * data, guint size);
 
+/* Like nal_reader_init (), but strips the emulation prevention bytes from
+ * the first NAL_READER_RBSP_SIZE bytes once, and reads those with a plain
+ * 64 bit window. Reading past the prefix continues in the normal
+ * mode. Positions and the EPB count are the same as with nal_reader_init ().
+ *
+ * The unescaped bytes live in a per-thread scratch buffer, so only one
+ * reader per thread can be in RBSP mode at any time (copies of it are
+ * fine). */
+void nal_reader_init_rbsp (NalReader * nr, const guint8 * data, guint size);
+
 gboolean nal_reader_read (NalReader * nr, guint nbits);
 gboolean nal_reader_skip (NalReader * nr, guint nbits);
 gboolean nal_reader_skip_long (NalReader * nr, guint nbits);
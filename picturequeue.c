@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picturequeue.h"
+#include "logging.h"
+
+int hevc_picture_queue_init(hevc_picture_queue *queue, uint32_t depth)
+{
+    memset(queue, 0, sizeof(*queue));
+
+    if(depth < 1 || depth > PICTURE_QUEUE_MAX_DEPTH)
+    {
+        HEVC_LOG_ERROR("Error: picture queue depth must be 1 to %d.\n",
+                       PICTURE_QUEUE_MAX_DEPTH);
+        return -1;
+    }
+
+    queue->jobs = calloc(depth, sizeof(hevc_picture_job));
+    if(queue->jobs == NULL)
+    {
+        HEVC_LOG_ERROR("Error: MALLOC: picture queue.\n");
+        return -1;
+    }
+    queue->depth = depth;
+
+    sem_init(&queue->free_slots, 0, depth);
+    sem_init(&queue->used_slots, 0, 0);
+    atomic_init(&queue->completed, 0);
+
+    return 0;
+}
+
+void hevc_picture_queue_destroy(hevc_picture_queue *queue)
+{
+    uint32_t i;
+
+    if(queue->jobs == NULL)
+        return;
+
+    for(i = 0; i < queue->depth; i++)
+        free(queue->jobs[i].buffers);
+    free(queue->jobs);
+
+    sem_destroy(&queue->free_slots);
+    sem_destroy(&queue->used_slots);
+
+    memset(queue, 0, sizeof(*queue));
+}
+
+static void wait_for_slot(sem_t *sem)
+{
+    while(sem_wait(sem) < 0 && errno == EINTR)
+        ;
+}
+
+hevc_picture_job *hevc_picture_queue_back(hevc_picture_queue *queue)
+{
+    wait_for_slot(&queue->free_slots);
+    return &queue->jobs[queue->head % queue->depth];
+}
+
+void hevc_picture_queue_push(hevc_picture_queue *queue)
+{
+    queue->head++;
+    sem_post(&queue->used_slots);
+}
+
+hevc_picture_job *hevc_picture_queue_front(hevc_picture_queue *queue)
+{
+    wait_for_slot(&queue->used_slots);
+    return &queue->jobs[queue->tail % queue->depth];
+}
+
+void hevc_picture_queue_pop(hevc_picture_queue *queue)
+{
+    hevc_picture_job *job = &queue->jobs[queue->tail % queue->depth];
+
+    atomic_store_explicit(&queue->completed, job->release,
+                          memory_order_release);
+    queue->tail++;
+    sem_post(&queue->free_slots);
+}
+
+int hevc_picture_job_set_buffers(
+    hevc_picture_job *job,
+    const VdpBitstreamBuffer *buffers,
+    uint32_t count)
+{
+    if(count > job->buffer_capacity)
+    {
+        VdpBitstreamBuffer *grown =
+            realloc(job->buffers, count * sizeof(VdpBitstreamBuffer));
+
+        if(grown == NULL)
+        {
+            HEVC_LOG_ERROR("Error: MALLOC: picture job buffers.\n");
+            return -1;
+        }
+        job->buffers = grown;
+        job->buffer_capacity = count;
+    }
+
+    memcpy(job->buffers, buffers, count * sizeof(VdpBitstreamBuffer));
+    job->buffer_count = count;
+
+    return 0;
+}
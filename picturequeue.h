@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    picturequeue: hands fully prepared pictures from the parsing thread to
+    the thread that owns the VDPAU device.
+
+    The queue is a bounded single producer, single consumer ring. Each side
+    owns its end of the ring and never takes a lock. Two counting semaphores
+    pass slots back and forth, and only put a thread to sleep when the ring
+    is full or empty.
+ */
+
+#ifndef __PICTURE_QUEUE_H__
+#define __PICTURE_QUEUE_H__
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <vdpau/vdpau.h>
+
+#define PICTURE_QUEUE_MAX_DEPTH 64
+
+/* A full DPB plus the current picture. */
+#define PICTURE_JOB_MAX_OUTPUTS 17
+
+/* Everything VdpDecoderRender and the display path need for one picture. */
+typedef struct _hevc_picture_job
+{
+    VdpPictureInfoHEVC info;
+    VdpVideoSurface target;
+    /* -1 if there is nothing to decode, only pictures to output. */
+    int8_t target_index;
+    /* Conformance cropping window of the target picture. */
+    VdpRect crop;
+    uint8_t end_of_stream;
+    /*
+       Pictures to present, in output order. The first output_before are
+       shown before the picture is decoded, since their surfaces may be
+       reused for it.
+     */
+    VdpVideoSurface output[PICTURE_JOB_MAX_OUTPUTS];
+    /* DPB entry and PicOrderCntVal of each output picture, and whether it
+       may be dropped for being late. */
+    int8_t output_index[PICTURE_JOB_MAX_OUTPUTS];
+    int32_t output_poc[PICTURE_JOB_MAX_OUTPUTS];
+    uint8_t output_droppable[PICTURE_JOB_MAX_OUTPUTS];
+    /* Output time of each from the HRD or VUI, in ns, or -1 for none. */
+    int64_t output_time[PICTURE_JOB_MAX_OUTPUTS];
+    uint8_t output_count;
+    uint8_t output_before;
+    /* Presentation period of the outputs in ns, 0 for as soon as possible. */
+    uint64_t period;
+    /* Slice segment NAL units, in decoding order. */
+    VdpBitstreamBuffer *buffers;
+    uint32_t buffer_count;
+    uint32_t buffer_capacity;
+    /*
+       NAL index entries before this one are no longer needed once the
+       picture has been rendered.
+     */
+    uint32_t release;
+} hevc_picture_job;
+
+typedef struct _hevc_picture_queue
+{
+    hevc_picture_job *jobs;
+    uint32_t depth;
+    /* Only touched by the producer. */
+    uint32_t head;
+    /* Only touched by the consumer. */
+    uint32_t tail;
+    sem_t free_slots;
+    sem_t used_slots;
+    /* release of the last job the consumer finished. */
+    atomic_uint completed;
+} hevc_picture_queue;
+
+int hevc_picture_queue_init(hevc_picture_queue *queue, uint32_t depth);
+void hevc_picture_queue_destroy(hevc_picture_queue *queue);
+
+/* Producer: waits for a free slot and returns it to be filled in. */
+hevc_picture_job *hevc_picture_queue_back(hevc_picture_queue *queue);
+/* Producer: hands the slot returned by hevc_picture_queue_back() over. */
+void hevc_picture_queue_push(hevc_picture_queue *queue);
+
+/* Consumer: waits for the oldest queued job. */
+hevc_picture_job *hevc_picture_queue_front(hevc_picture_queue *queue);
+/* Consumer: done with the job returned by hevc_picture_queue_front(). */
+void hevc_picture_queue_pop(hevc_picture_queue *queue);
+
+/* The release value of the last finished job, 0 if there was none yet. */
+static inline uint32_t hevc_picture_queue_completed(hevc_picture_queue *queue)
+{
+    return atomic_load_explicit(&queue->completed, memory_order_acquire);
+}
+
+/* Copies the bitstream descriptors, not the bitstream, into the job. */
+int hevc_picture_job_set_buffers(
+    hevc_picture_job *job,
+    const VdpBitstreamBuffer *buffers,
+    uint32_t count);
+
+#endif /* __PICTURE_QUEUE_H__ */
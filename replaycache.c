@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "replaycache.h"
+#include "logging.h"
+
+/* First allocation of the arena, which then doubles as needed. */
+#define REPLAY_CACHE_INITIAL_SIZE (1u << 20)
+
+static size_t align8(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+void hevc_replay_cache_init(hevc_replay_cache *cache, size_t limit)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->limit = limit;
+    cache->state = limit ? HEVC_REPLAY_RECORDING : HEVC_REPLAY_OFF;
+}
+
+void hevc_replay_cache_destroy(hevc_replay_cache *cache)
+{
+    free(cache->arena);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static void turn_off(hevc_replay_cache *cache)
+{
+    free(cache->arena);
+    cache->arena = NULL;
+    cache->size = 0;
+    cache->capacity = 0;
+    cache->count = 0;
+    cache->next = 0;
+    cache->state = HEVC_REPLAY_OFF;
+}
+
+/* Makes room for size more bytes. Returns -1 past the limit. */
+static int reserve(hevc_replay_cache *cache, size_t size)
+{
+    size_t capacity = cache->capacity;
+    uint8_t *grown;
+
+    if(cache->size + size <= capacity)
+        return 0;
+    if(cache->size + size > cache->limit)
+    {
+        HEVC_LOG_INFO("The stream does not fit the replay cache of %zu "
+                      "KiB, every loop parses it again.\n",
+                      cache->limit >> 10);
+        return -1;
+    }
+
+    if(!capacity)
+        capacity = REPLAY_CACHE_INITIAL_SIZE;
+    while(capacity < cache->size + size)
+        capacity *= 2;
+    if(capacity > cache->limit)
+        capacity = cache->limit;
+
+    grown = realloc(cache->arena, capacity);
+    if(grown == NULL)
+    {
+        HEVC_LOG_ERROR("Error: MALLOC: replay cache.\n");
+        return -1;
+    }
+    cache->arena = grown;
+    cache->capacity = capacity;
+
+    return 0;
+}
+
+void hevc_replay_cache_record(
+    hevc_replay_cache *cache,
+    const hevc_picture_job *job)
+{
+    size_t size, buffers_size;
+    hevc_picture_job *copy;
+    VdpBitstreamBuffer *buffers;
+    uint8_t *data;
+    uint32_t i;
+
+    if(cache->state != HEVC_REPLAY_RECORDING)
+        return;
+
+    buffers_size = job->buffer_count * sizeof(VdpBitstreamBuffer);
+    size = align8(sizeof(*job)) + buffers_size;
+    for(i = 0; i < job->buffer_count; i++)
+        size += job->buffers[i].bitstream_bytes;
+    size = align8(size);
+    if(reserve(cache, size) < 0)
+    {
+        turn_off(cache);
+        return;
+    }
+
+    copy = (hevc_picture_job *)(cache->arena + cache->size);
+    buffers = (VdpBitstreamBuffer *)((uint8_t *)copy + align8(sizeof(*job)));
+    data = (uint8_t *)buffers + buffers_size;
+
+    /* The bitstream follows the descriptors, in order. It is pointed to
+       once the pass is recorded, since the arena may move until then. */
+    *copy = *job;
+    copy->buffers = NULL;
+    copy->buffer_capacity = 0;
+    for(i = 0; i < job->buffer_count; i++)
+    {
+        buffers[i] = job->buffers[i];
+        memcpy(data, job->buffers[i].bitstream,
+               job->buffers[i].bitstream_bytes);
+        buffers[i].bitstream = NULL;
+        data += job->buffers[i].bitstream_bytes;
+    }
+
+    cache->size += size;
+    cache->count++;
+}
+
+/* Points the bitstream buffers of every record back into the arena. */
+static void resolve_buffers(hevc_replay_cache *cache)
+{
+    hevc_picture_job *job;
+    VdpBitstreamBuffer *buffers;
+    const uint8_t *data;
+    size_t offset;
+    uint32_t i;
+
+    for(offset = 0; offset < cache->size;
+            offset = align8(data - cache->arena))
+    {
+        job = (hevc_picture_job *)(cache->arena + offset);
+        buffers = (VdpBitstreamBuffer *)((uint8_t *)job +
+                                         align8(sizeof(*job)));
+        data = (const uint8_t *)(buffers + job->buffer_count);
+        for(i = 0; i < job->buffer_count; i++)
+        {
+            buffers[i].bitstream = data;
+            data += buffers[i].bitstream_bytes;
+        }
+    }
+}
+
+hevc_replay_state hevc_replay_cache_rewind(hevc_replay_cache *cache)
+{
+    if(cache->disable || (cache->state == HEVC_REPLAY_RECORDING &&
+                          !cache->count))
+        turn_off(cache);
+
+    if(cache->state == HEVC_REPLAY_RECORDING)
+    {
+        resolve_buffers(cache);
+        cache->state = HEVC_REPLAY_READY;
+        HEVC_LOG_INFO("Replaying %u jobs from a %zu KiB cache.\n",
+                      cache->count, cache->size >> 10);
+    }
+    cache->next = 0;
+    cache->disable = 0;
+
+    return cache->state;
+}
+
+int hevc_replay_cache_next(hevc_replay_cache *cache, hevc_picture_job *job)
+{
+    const hevc_picture_job *record;
+    VdpBitstreamBuffer *buffers;
+    uint32_t buffer_capacity;
+    const uint8_t *end;
+
+    record = (const hevc_picture_job *)(cache->arena + cache->next);
+    /* The job keeps its own descriptor array. */
+    buffers = job->buffers;
+    buffer_capacity = job->buffer_capacity;
+    *job = *record;
+    job->buffers = buffers;
+    job->buffer_capacity = buffer_capacity;
+    job->buffer_count = 0;
+
+    buffers = (VdpBitstreamBuffer *)((uint8_t *)record +
+                                     align8(sizeof(*record)));
+    if(hevc_picture_job_set_buffers(job, buffers, record->buffer_count) < 0)
+        return -1;
+
+    /* The bitstream of the last buffer ends the record. */
+    end = (const uint8_t *)(buffers + record->buffer_count);
+    if(record->buffer_count)
+        end = (const uint8_t *)buffers[record->buffer_count - 1].bitstream +
+              buffers[record->buffer_count - 1].bitstream_bytes;
+    cache->next = align8(end - cache->arena);
+
+    return 0;
+}
+
+void hevc_replay_cache_disable(hevc_replay_cache *cache)
+{
+    if(cache->state == HEVC_REPLAY_RECORDING)
+        turn_off(cache);
+    else
+        cache->disable = 1;
+}
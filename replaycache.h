@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    replaycache: the picture jobs of one pass through a stream, to replay
+    when looping.
+
+    With -l, every pass after the first re-reads, re-scans and re-parses the
+    same file to end up with the same jobs for the render stage. The first
+    pass records each job that is submitted instead, with the
+    VdpPictureInfoHEVC and bitstream of the picture, into one contiguous
+    arena. Later passes hand those to VdpDecoderRender and the display path
+    as they are. The jobs keep referring to the session's video surfaces,
+    so a pass may only be replayed as long as those are not replaced.
+
+    The arena grows up to a limit. A stream that needs more is not cached,
+    and every pass parses it again.
+ */
+
+#ifndef __REPLAY_CACHE_H__
+#define __REPLAY_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "picturequeue.h"
+
+/* Default limit of the arena. */
+#define REPLAY_CACHE_DEFAULT_SIZE (256u << 20)
+
+typedef enum _hevc_replay_state
+{
+    /* Nothing is recorded nor replayed. */
+    HEVC_REPLAY_OFF,
+    /* The first pass is being recorded. */
+    HEVC_REPLAY_RECORDING,
+    /* The pass is complete, and is replayed from next on. */
+    HEVC_REPLAY_READY
+} hevc_replay_state;
+
+typedef struct _hevc_replay_cache
+{
+    hevc_replay_state state;
+    /*
+       Records back to back, each 8 byte aligned: a hevc_picture_job, its
+       VdpBitstreamBuffers, then their bitstream.
+     */
+    uint8_t *arena;
+    size_t size;
+    size_t capacity;
+    size_t limit;
+    uint32_t count;
+    /* Offset of the next record to replay. */
+    size_t next;
+    /* Turned off, once the current pass is over. */
+    uint8_t disable;
+} hevc_replay_cache;
+
+/* Starts recording, into up to limit bytes. With a limit of 0, it is off. */
+void hevc_replay_cache_init(hevc_replay_cache *cache, size_t limit);
+void hevc_replay_cache_destroy(hevc_replay_cache *cache);
+
+/*
+   Recording: appends a copy of job, its bitstream included. Once the
+   limit is reached, or memory runs out, the cache is off.
+ */
+void hevc_replay_cache_record(
+    hevc_replay_cache *cache,
+    const hevc_picture_job *job);
+
+/*
+   The end of a pass. A recorded pass is replayed from now on, and a
+   replayed one starts over, unless hevc_replay_cache_disable() was called
+   meanwhile. Returns the state for the next pass.
+ */
+hevc_replay_state hevc_replay_cache_rewind(hevc_replay_cache *cache);
+
+/*
+   Replaying: whether the pass has another job, and fills job in with it.
+   The bitstream buffers of the job point into the arena. Returns 0, or -1
+   if memory runs out.
+ */
+static inline int hevc_replay_cache_more(const hevc_replay_cache *cache)
+{
+    return cache->next < cache->size;
+}
+
+int hevc_replay_cache_next(hevc_replay_cache *cache, hevc_picture_job *job);
+
+/*
+   Stops recording right away, or replaying at the end of the current pass,
+   which may still be in flight.
+ */
+void hevc_replay_cache_disable(hevc_replay_cache *cache);
+
+#endif /* __REPLAY_CACHE_H__ */
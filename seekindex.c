@@ -0,0 +1,554 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "gsth265parser.h"
+#include "nalindex.h"
+#include "seekindex.h"
+#include "logging.h"
+
+/*
+   Sidecar layout, all little endian:
+
+   header: "HEVCIDX" and a 0 byte, u32 version, u32 count, u32 num_nals,
+           u32 pictures, u64 period, u64 stream_size, u64 mtime seconds,
+           u32 mtime nanoseconds
+   count points: u64 offset, u32 picture, s32 poc, u8 type, u8 vps_id,
+           u8 sps_id, u8 pps_id, u32 first_nal, u16 num_nals
+   num_nals parameter sets: u64 offset, u32 size
+ */
+#define SEEK_INDEX_MAGIC "HEVCIDX"
+#define SEEK_INDEX_VERSION 1
+#define SEEK_INDEX_HEADER_SIZE 52
+#define SEEK_INDEX_POINT_SIZE 26
+#define SEEK_INDEX_NAL_SIZE 12
+
+/* 7.4.3.1, 7.4.3.2.1 and 7.4.3.3.1 limits of the parameter set ids. */
+#define MAX_VPS_COUNT 16
+#define MAX_SPS_COUNT 16
+#define MAX_PPS_COUNT 64
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, v);
+    put_u16(p + 2, v >> 16);
+    return p + 4;
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v)
+{
+    put_u32(p, v);
+    put_u32(p + 4, v >> 32);
+    return p + 8;
+}
+
+static uint16_t get_u16(const uint8_t **p)
+{
+    uint16_t v = (*p)[0] | (*p)[1] << 8;
+
+    *p += 2;
+    return v;
+}
+
+static uint32_t get_u32(const uint8_t **p)
+{
+    uint32_t v = get_u16(p);
+
+    return v | (uint32_t)get_u16(p) << 16;
+}
+
+static uint64_t get_u64(const uint8_t **p)
+{
+    uint64_t v = get_u32(p);
+
+    return v | (uint64_t)get_u32(p) << 32;
+}
+
+static char *sidecar_path(const char *path)
+{
+    size_t length = strlen(path);
+    char *sidecar = malloc(length + sizeof(SEEK_INDEX_SUFFIX));
+
+    if(sidecar == NULL)
+        return NULL;
+    memcpy(sidecar, path, length);
+    memcpy(sidecar + length, SEEK_INDEX_SUFFIX, sizeof(SEEK_INDEX_SUFFIX));
+    return sidecar;
+}
+
+static int add_point(hevc_seek_index *si, const hevc_seek_point *point)
+{
+    if(si->count == si->capacity)
+    {
+        uint32_t capacity = si->capacity ? si->capacity * 2 : 256;
+        hevc_seek_point *points =
+            realloc(si->points, capacity * sizeof(*points));
+
+        if(points == NULL)
+            return -1;
+        si->points = points;
+        si->capacity = capacity;
+    }
+    si->points[si->count++] = *point;
+    return 0;
+}
+
+static int add_nal(hevc_seek_index *si, const hevc_seek_nal *nal)
+{
+    if(si->num_nals == si->nals_capacity)
+    {
+        uint32_t capacity = si->nals_capacity ? si->nals_capacity * 2 : 1024;
+        hevc_seek_nal *nals = realloc(si->nals, capacity * sizeof(*nals));
+
+        if(nals == NULL)
+            return -1;
+        si->nals = nals;
+        si->nals_capacity = capacity;
+    }
+    si->nals[si->num_nals++] = *nal;
+    return 0;
+}
+
+/* The parameter set NAL units seen last, by id, with a size of 0 for none. */
+typedef struct _hevc_seek_parameter_sets
+{
+    hevc_seek_nal vps[MAX_VPS_COUNT];
+    hevc_seek_nal sps[MAX_SPS_COUNT];
+    hevc_seek_nal pps[MAX_PPS_COUNT];
+} hevc_seek_parameter_sets;
+
+static int add_parameter_sets(
+    hevc_seek_index *si,
+    hevc_seek_point *point,
+    const hevc_seek_parameter_sets *sets)
+{
+    const hevc_seek_nal *nal = sets->vps;
+    uint32_t i;
+
+    point->first_nal = si->num_nals;
+    point->num_nals = 0;
+    for(i = 0; i < sizeof(*sets) / sizeof(*nal); i++)
+    {
+        if(nal[i].size == 0)
+            continue;
+        if(add_nal(si, &nal[i]) < 0)
+            return -1;
+        point->num_nals++;
+    }
+    return 0;
+}
+
+/*
+   8.3.1 PicOrderCntVal of every picture, for the points. Decoding from
+   the start of the stream only resets PicOrderCntMsb at IRAP pictures
+   with NoRaslOutputFlag, which a CRA picture only has as the first one.
+ */
+typedef struct _hevc_seek_poc
+{
+    int32_t prevPicOrderCntLsb;
+    int32_t prevPicOrderCntMsb;
+    uint8_t first_picture;
+} hevc_seek_poc;
+
+static int32_t picture_order_count(
+    hevc_seek_poc *state,
+    const GstH265NalUnit *nalu,
+    const GstH265SliceHdr *slice)
+{
+    int32_t MaxPicOrderCntLsb =
+        1 << (slice->pps->sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+    int32_t lsb = 0, msb;
+    uint8_t irap = nalu->type >= GST_H265_NAL_SLICE_BLA_W_LP &&
+                   nalu->type <= 23;
+
+    if(nalu->type != GST_H265_NAL_SLICE_IDR_W_RADL &&
+            nalu->type != GST_H265_NAL_SLICE_IDR_N_LP)
+        lsb = slice->pic_order_cnt_lsb;
+
+    if(irap && (state->first_picture ||
+                nalu->type <= GST_H265_NAL_SLICE_IDR_N_LP))
+        msb = 0;
+    else if(lsb < state->prevPicOrderCntLsb &&
+            state->prevPicOrderCntLsb - lsb >= MaxPicOrderCntLsb / 2)
+        msb = state->prevPicOrderCntMsb + MaxPicOrderCntLsb;
+    else if(lsb > state->prevPicOrderCntLsb &&
+            lsb - state->prevPicOrderCntLsb > MaxPicOrderCntLsb / 2)
+        msb = state->prevPicOrderCntMsb - MaxPicOrderCntLsb;
+    else
+        msb = state->prevPicOrderCntMsb;
+
+    /* prevTid0Pic: not RADL, RASL or a sub-layer non-reference picture. */
+    if(nalu->temporal_id_plus1 == 1 &&
+            !(nalu->type >= GST_H265_NAL_SLICE_RADL_N &&
+              nalu->type <= GST_H265_NAL_SLICE_RASL_R) &&
+            !(nalu->type <= 14 && !(nalu->type & 1)))
+    {
+        state->prevPicOrderCntLsb = lsb;
+        state->prevPicOrderCntMsb = msb;
+    }
+    state->first_picture = 0;
+
+    return msb + lsb;
+}
+
+/* The pass over a mapped stream that finds every point. */
+static int build(hevc_seek_index *si, hevc_nal_index *index)
+{
+    GstH265Parser *parser;
+    GstH265NalUnit nalu;
+    GstH265VPS *vps;
+    GstH265SPS *sps;
+    GstH265PPS *pps;
+    GstH265SliceHdr *slice;
+    hevc_seek_parameter_sets *sets;
+    hevc_seek_poc poc_state;
+    hevc_seek_point point;
+    hevc_seek_nal nal;
+    const hevc_nal_entry *entry;
+    const GstH265VUIParams *vui;
+    uint32_t n;
+    int status = -1;
+
+    parser = gst_h265_parser_new();
+    vps = calloc(1, sizeof(*vps));
+    sps = calloc(1, sizeof(*sps));
+    pps = calloc(1, sizeof(*pps));
+    slice = calloc(1, sizeof(*slice));
+    sets = calloc(1, sizeof(*sets));
+    if(parser == NULL || vps == NULL || sps == NULL || pps == NULL ||
+            slice == NULL || sets == NULL)
+    {
+        HEVC_LOG_ERROR("Error: MALLOC: seek index.\n");
+        goto done;
+    }
+    memset(&poc_state, 0, sizeof(poc_state));
+    poc_state.first_picture = 1;
+
+    for(n = 0; (entry = hevc_nal_index_get(index, n)) != NULL; n++)
+    {
+        if(entry->layer_id != 0)
+            continue;
+        if(entry->type != GST_H265_NAL_VPS &&
+                entry->type != GST_H265_NAL_SPS &&
+                entry->type != GST_H265_NAL_PPS &&
+                entry->type != GST_H265_NAL_EOS &&
+                !(NAL_INDEX_IS_VCL(entry->type) &&
+                  entry->first_slice_segment_in_pic_flag))
+            continue;
+
+        if(gst_h265_parser_identify_nalu_unchecked(
+                    parser,
+                    (const guint8 *) hevc_nal_index_data(index, entry),
+                    0,
+                    (gsize) entry->size,
+                    &nalu) != GST_H265_PARSER_OK)
+            continue;
+        nal.offset = entry->offset;
+        nal.size = entry->size;
+
+        switch(nalu.type)
+        {
+        case GST_H265_NAL_VPS:
+            if(gst_h265_parser_parse_vps(parser, &nalu, vps) ==
+                    GST_H265_PARSER_OK)
+                sets->vps[vps->id] = nal;
+            break;
+        case GST_H265_NAL_SPS:
+            if(gst_h265_parser_parse_sps(parser, &nalu, sps, TRUE) !=
+                    GST_H265_PARSER_OK)
+                break;
+            sets->sps[sps->id] = nal;
+            vui = &sps->vui_params;
+            if(si->period == 0 && sps->vui_parameters_present_flag &&
+                    vui->timing_info_present_flag &&
+                    vui->num_units_in_tick && vui->time_scale)
+                si->period = (uint64_t)vui->num_units_in_tick *
+                             1000000000ull / vui->time_scale;
+            break;
+        case GST_H265_NAL_PPS:
+            if(gst_h265_parser_parse_pps(parser, &nalu, pps) ==
+                    GST_H265_PARSER_OK)
+                sets->pps[pps->id] = nal;
+            break;
+        case GST_H265_NAL_EOS:
+            poc_state.first_picture = 1;
+            break;
+        default:
+            si->pictures++;
+            if(gst_h265_parser_parse_slice_hdr_vdpau(
+                       parser, &nalu, slice) != GST_H265_PARSER_OK)
+                break;
+            point.poc = picture_order_count(&poc_state, &nalu, slice);
+            if(nalu.type < GST_H265_NAL_SLICE_BLA_W_LP || nalu.type > 23)
+                break;
+            point.offset = entry->offset;
+            point.picture = si->pictures - 1;
+            point.type = nalu.type;
+            point.pps_id = slice->pps->id;
+            point.sps_id = slice->pps->sps->id;
+            point.vps_id = slice->pps->sps->vps->id;
+            if(add_parameter_sets(si, &point, sets) < 0 ||
+                    add_point(si, &point) < 0)
+            {
+                HEVC_LOG_ERROR("Error: MALLOC: seek index.\n");
+                goto done;
+            }
+            break;
+        }
+    }
+    status = 0;
+
+done:
+    if(parser)
+        gst_h265_parser_free(parser);
+    free(vps);
+    free(sps);
+    free(pps);
+    free(slice);
+    free(sets);
+    return status;
+}
+
+static int save(const hevc_seek_index *si, const char *sidecar)
+{
+    uint8_t record[SEEK_INDEX_HEADER_SIZE], *p;
+    size_t length = strlen(sidecar);
+    char *temporary;
+    FILE *out;
+    uint32_t i;
+    int status = -1;
+
+    /* Renamed into place, so readers never see half an index. */
+    temporary = malloc(length + 5);
+    if(temporary == NULL)
+        return -1;
+    memcpy(temporary, sidecar, length);
+    memcpy(temporary + length, ".tmp", 5);
+    out = fopen(temporary, "wb");
+    if(out == NULL)
+        goto done;
+
+    memcpy(record, SEEK_INDEX_MAGIC, 8);
+    p = put_u32(record + 8, SEEK_INDEX_VERSION);
+    p = put_u32(p, si->count);
+    p = put_u32(p, si->num_nals);
+    p = put_u32(p, si->pictures);
+    p = put_u64(p, si->period);
+    p = put_u64(p, si->stream_size);
+    p = put_u64(p, si->stream_mtime.tv_sec);
+    put_u32(p, si->stream_mtime.tv_nsec);
+    fwrite(record, SEEK_INDEX_HEADER_SIZE, 1, out);
+
+    for(i = 0; i < si->count; i++)
+    {
+        const hevc_seek_point *point = &si->points[i];
+
+        p = put_u64(record, point->offset);
+        p = put_u32(p, point->picture);
+        p = put_u32(p, point->poc);
+        *p++ = point->type;
+        *p++ = point->vps_id;
+        *p++ = point->sps_id;
+        *p++ = point->pps_id;
+        p = put_u32(p, point->first_nal);
+        put_u16(p, point->num_nals);
+        fwrite(record, SEEK_INDEX_POINT_SIZE, 1, out);
+    }
+    for(i = 0; i < si->num_nals; i++)
+    {
+        p = put_u64(record, si->nals[i].offset);
+        put_u32(p, si->nals[i].size);
+        fwrite(record, SEEK_INDEX_NAL_SIZE, 1, out);
+    }
+
+    status = ferror(out) ? -1 : 0;
+    if(fclose(out) != 0 || status < 0 || rename(temporary, sidecar) < 0)
+    {
+        remove(temporary);
+        status = -1;
+    }
+done:
+    free(temporary);
+    return status;
+}
+
+/* Returns 0, or -1 if there is no valid sidecar for the stream. */
+static int load(hevc_seek_index *si, const char *sidecar)
+{
+    uint8_t *data = NULL;
+    const uint8_t *p;
+    long size;
+    FILE *in;
+    uint32_t i, count, num_nals;
+    int status = -1;
+
+    in = fopen(sidecar, "rb");
+    if(in == NULL)
+        return -1;
+    if(fseek(in, 0, SEEK_END) < 0 || (size = ftell(in)) <
+            SEEK_INDEX_HEADER_SIZE)
+        goto done;
+    rewind(in);
+    data = malloc(size);
+    if(data == NULL || fread(data, size, 1, in) != 1)
+        goto done;
+
+    if(memcmp(data, SEEK_INDEX_MAGIC, 8))
+        goto done;
+    p = data + 8;
+    if(get_u32(&p) != SEEK_INDEX_VERSION)
+        goto done;
+    count = get_u32(&p);
+    num_nals = get_u32(&p);
+    if(size != SEEK_INDEX_HEADER_SIZE +
+            (long)count * SEEK_INDEX_POINT_SIZE +
+            (long)num_nals * SEEK_INDEX_NAL_SIZE)
+        goto done;
+    si->pictures = get_u32(&p);
+    si->period = get_u64(&p);
+    if(get_u64(&p) != si->stream_size ||
+            get_u64(&p) != (uint64_t)si->stream_mtime.tv_sec ||
+            get_u32(&p) != (uint32_t)si->stream_mtime.tv_nsec)
+        goto done;
+
+    si->points = malloc(count * sizeof(*si->points) + 1);
+    si->nals = malloc(num_nals * sizeof(*si->nals) + 1);
+    if(si->points == NULL || si->nals == NULL)
+        goto done;
+    si->count = si->capacity = count;
+    si->num_nals = si->nals_capacity = num_nals;
+    for(i = 0; i < count; i++)
+    {
+        hevc_seek_point *point = &si->points[i];
+
+        point->offset = get_u64(&p);
+        point->picture = get_u32(&p);
+        point->poc = (int32_t)get_u32(&p);
+        point->type = *p++;
+        point->vps_id = *p++;
+        point->sps_id = *p++;
+        point->pps_id = *p++;
+        point->first_nal = get_u32(&p);
+        point->num_nals = get_u16(&p);
+        if((uint64_t)point->first_nal + point->num_nals > num_nals)
+            goto done;
+    }
+    for(i = 0; i < num_nals; i++)
+    {
+        si->nals[i].offset = get_u64(&p);
+        si->nals[i].size = get_u32(&p);
+        if(si->nals[i].offset + si->nals[i].size > si->stream_size)
+            goto done;
+    }
+    status = 0;
+
+done:
+    fclose(in);
+    free(data);
+    return status;
+}
+
+int hevc_seek_index_open(hevc_seek_index *si, const char *path)
+{
+    hevc_nal_index index;
+    struct stat st;
+    char *sidecar;
+    int status = -1;
+
+    memset(si, 0, sizeof(*si));
+    if(stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        HEVC_LOG_ERROR("Error: %s is not a file to seek in.\n", path);
+        return -1;
+    }
+    si->stream_size = st.st_size;
+    si->stream_mtime = st.st_mtim;
+
+    sidecar = sidecar_path(path);
+    if(sidecar == NULL)
+        return -1;
+
+    if(load(si, sidecar) == 0)
+    {
+        HEVC_LOG_INFO("Loaded %u random access points from %s.\n",
+                      si->count, sidecar);
+        status = 0;
+        goto done;
+    }
+    hevc_seek_index_close(si);
+    si->stream_size = st.st_size;
+    si->stream_mtime = st.st_mtim;
+
+    if(hevc_nal_index_open(&index, path, 0, -1) < 0)
+        goto done;
+    status = build(si, &index);
+    hevc_nal_index_close(&index);
+    if(status < 0)
+        goto done;
+
+    HEVC_LOG_INFO("Indexed %u random access points in %u pictures.\n",
+                  si->count, si->pictures);
+    if(save(si, sidecar) < 0)
+        HEVC_LOG_WARNING("Unable to write the seek index %s.\n", sidecar);
+
+done:
+    if(status < 0)
+        hevc_seek_index_close(si);
+    free(sidecar);
+    return status;
+}
+
+void hevc_seek_index_close(hevc_seek_index *si)
+{
+    free(si->points);
+    free(si->nals);
+    memset(si, 0, sizeof(*si));
+}
+
+const hevc_seek_point *hevc_seek_index_find(
+    const hevc_seek_index *si,
+    uint32_t picture)
+{
+    uint32_t low = 0, high = si->count;
+
+    if(si->count == 0)
+        return NULL;
+
+    /* The first point after picture. */
+    while(low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+
+        if(si->points[mid].picture <= picture)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return &si->points[low ? low - 1 : 0];
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+    seekindex: the random access points of a mapped H.265/HEVC elementary
+    stream, kept in a sidecar file next to it.
+
+    Building the index takes one pass over the whole stream, parsing the
+    parameter sets and the first slice segment header of every picture.
+    It records every IRAP picture (IDR, CRA or BLA), with the parameter
+    sets it needs. The result is written to <stream>.idx, and later runs
+    load that instead, as long as the stream keeps its size and
+    modification time.
+
+    Decoding can then start at any IRAP picture: map the stream from its
+    offset on, and parse its parameter sets from where the index says
+    they are first.
+ */
+
+#ifndef __SEEK_INDEX_H__
+#define __SEEK_INDEX_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define SEEK_INDEX_SUFFIX ".idx"
+
+/* Where a parameter set NAL unit is, start code included. */
+typedef struct _hevc_seek_nal
+{
+    uint64_t offset;
+    uint32_t size;
+} hevc_seek_nal;
+
+/* One IRAP picture. */
+typedef struct _hevc_seek_point
+{
+    /* Of its first slice segment NAL unit. */
+    uint64_t offset;
+    /* How many pictures precede it in decoding order. */
+    uint32_t picture;
+    /* PicOrderCntVal, as decoding from the start of the stream gets it. */
+    int32_t poc;
+    uint8_t type;
+    /* The parameter sets the picture activates. */
+    uint8_t vps_id;
+    uint8_t sps_id;
+    uint8_t pps_id;
+    /*
+       nals[first_nal] and up: the latest of every parameter set so far,
+       which is all that pictures from here on can refer to before the
+       bitstream repeats them.
+     */
+    uint32_t first_nal;
+    uint16_t num_nals;
+} hevc_seek_point;
+
+typedef struct _hevc_seek_index
+{
+    hevc_seek_point *points;
+    uint32_t count;
+    uint32_t capacity;
+    hevc_seek_nal *nals;
+    uint32_t num_nals;
+    uint32_t nals_capacity;
+    /* Pictures in the whole stream. */
+    uint32_t pictures;
+    /* E.3.1 period of the first SPS with VUI timing, in ns, or 0. */
+    uint64_t period;
+    /* The stream the index belongs to. */
+    uint64_t stream_size;
+    struct timespec stream_mtime;
+} hevc_seek_index;
+
+/*
+   Loads the sidecar of path, or builds the index and writes the sidecar
+   if it is missing or out of date. A sidecar that can not be written is
+   only a warning. Returns 0, or -1 on failure.
+ */
+int hevc_seek_index_open(hevc_seek_index *si, const char *path);
+void hevc_seek_index_close(hevc_seek_index *si);
+
+/*
+   The last IRAP picture at or before picture, in decoding order, or the
+   first one. NULL if the stream has none.
+ */
+const hevc_seek_point *hevc_seek_index_find(
+    const hevc_seek_index *si,
+    uint32_t picture);
+
+#endif /* __SEEK_INDEX_H__ */
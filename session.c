@@ -0,0 +1,4486 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <vdpau/vdpau_x11.h>
+#include "win_x11.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "gsth265parser.h"
+#include "nalindex.h"
+#include "accessunit.h"
+#include "picturequeue.h"
+#include "replaycache.h"
+#include "seekindex.h"
+#include "surfacepool.h"
+#include "bench.h"
+#include "logging.h"
+#include "session.h"
+
+/* maxDpbPicBuf of (A-2), for the profiles VDPAU decodes. */
+#define MAX_DPB_PIC_BUF 6
+
+#define HEVC_MAX_REFERENCES 16
+
+#define NUM_OUTPUT_SURFACES 8
+
+/* SEI messages parsed per SEI NAL unit, the rest are ignored. */
+#define MAX_SEI_MESSAGES 8
+
+#define ARSIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+/*
+   Presentation timing messages, at info level. Build with DEBUG_TIMES set
+   to any of these, see the Makefile.
+ */
+#define DEBUG_TIMES_PRINT_SCHEDULED_AT      1
+#define DEBUG_TIMES_PRINT_DISPLAYED_AT      2
+#define DEBUG_TIMES_PRINT_DISPLAYED_AT_LATE 4
+#define DEBUG_TIMES_PRINT_STREAM_TIME       8
+#ifndef DEBUG_TIMES
+#define DEBUG_TIMES 0
+#endif
+
+/*
+   A picture that can not be dropped, and is this many periods late, starts
+   the presentation schedule over.
+ */
+#define RESYNC_PERIODS 4
+
+#define CHECK_STATE \
+    if (vdp_st != VDP_STATUS_OK) { \
+        HEVC_LOG_ERROR("Error at %s:%d (%d)", \
+                       __FILE__, __LINE__, (int)vdp_st); \
+        exit(1); \
+    }
+
+/* Open addressing, with twice as many buckets as DPB entries. */
+#define POC_TABLE_SIZE 32
+
+/* TemporalId is at most sps_max_sub_layers_minus1, which is at most 6. */
+#define MAX_TEMPORAL_ID 6
+
+/* Exported, until hevc_session_release_frame(). */
+#define HELD_BY_CONSUMER 4
+#define QUEUED_FOR_DISPLAY 2
+#define QUEUED_FOR_REFERENCE 1
+#define NOT_QUEUED 0
+
+/*
+   Local decoder state.
+
+   Video players must use the VdpPictureInfoHEVC.RefPics[] array to store the
+   Specification mandated decoded picture buffer (DPB).
+
+   However, for video player reference picture management, that list alone is
+   insufficient. Player applications must keep track of additional state per
+   picture.
+
+   hevc_decoder_context keeps track of all decoder state that must be
+   maintained by a video player, but is not included as part of the
+   VdpPictureInfoHEVC structure. In particular, this structure maintains a
+   list of scratch frames, which can be used in the DPB.
+ */
+
+typedef enum
+{
+    UNUSED_FOR_REFERENCE          = 0,
+    USED_FOR_SHORT_TERM_REFERENCE = 1,
+    USED_FOR_LONG_TERM_REFERENCE  = 2,
+} dpb_reference_value;
+
+/* Maps a picture order count, or its LSBs, to the DPB entries that have it. */
+typedef struct _hevc_poc_table
+{
+    int32_t poc[POC_TABLE_SIZE];
+    /* DPB entry, or -1 for an empty bucket. */
+    int8_t entry[POC_TABLE_SIZE];
+} hevc_poc_table;
+
+/*
+   The pictures in the DPB, looked up by PicOrderCntVal and by
+   slice_pic_order_cnt_lsb, and in output order. Kept in sync with
+   pi->RefPics[] by store_current_picture() and
+   empty_picture_storage_buffer().
+ */
+typedef struct _hevc_dpb_index
+{
+    hevc_poc_table by_poc;
+    hevc_poc_table by_lsb;
+    /* DPB entries by increasing PicOrderCntVal, then entry. */
+    int8_t poc_order[HEVC_MAX_REFERENCES];
+    uint8_t count;
+} hevc_dpb_index;
+
+#if DEBUG_TIMES
+typedef struct _hevc_surface_times
+{
+    VdpTime schedule_time;
+    uint8_t is_start_of_stream;
+    uint8_t is_end_of_stream;
+} hevc_surface_times;
+#endif
+
+/*
+   Output times from the HRD buffering period and picture timing SEI
+   messages (C.2.3, C.5.2.3), or from the VUI when POC is proportional to
+   timing, in ns from the start of the stream. See get_output_time().
+ */
+typedef struct _hevc_hrd_timing
+{
+    /* The SEI messages of the current access unit. */
+    uint8_t BufferingPeriodPresent;
+    uint8_t PicTimingPresent;
+    uint32_t AuCpbRemovalDelayVal;
+    uint32_t PicDpbOutputDelay;
+    /* Since the first buffering period: clock tick 0 in ns, and the
+       nominal CPB removal time of the last buffering period picture, in
+       clock ticks from there. */
+    uint8_t started;
+    int64_t base_ns;
+    uint64_t RemovalTicksNb;
+    /* Without picture timing: the POC that base_ns belongs to. */
+    int32_t base_poc;
+    /* The last output time handed out, or -1. */
+    int64_t last_output_ns;
+} hevc_hrd_timing;
+
+typedef struct _hevc_decoder_context
+{
+    VdpVideoSurface scratch_frames[HEVC_MAX_REFERENCES];
+    /* scratch_frames[] that hold a surface. Allocated on first use, up to
+       MaxDpbSize. */
+    uint8_t num_scratch_frames;
+    uint8_t MaxDpbSize;
+    uint8_t NoOutputOfPriorPicsFlag;
+    uint8_t NoRaslOutputFlag;
+    uint8_t HandleCraAsBlaFlag;
+    int32_t prevPicOrderCntLsb;
+    int32_t prevPicOrderCntMsb;
+    uint8_t IsFirstPicture;
+    int32_t NumPocStFoll;
+    int32_t NumPocLtFoll;
+    /* 8.3.2 PocStFoll and PocLtFoll, for 8.3.3. */
+    int32_t PocStFoll[16];
+    int32_t PocLtFoll[16];
+    /* And the Curr lists, to conceal missing references. */
+    int32_t PocStCurrBefore[16];
+    int32_t PocStCurrAfter[16];
+    int32_t PocLtCurr[16];
+    int32_t current_slice_pic_order_cnt_lsb;
+    int32_t dpb_slice_pic_order_cnt_lsb[HEVC_MAX_REFERENCES];
+    hevc_dpb_index dpb_index;
+    uint8_t dpb_reference_values[HEVC_MAX_REFERENCES];
+    /* Doubles as the "needed for output" marking once in the DPB. */
+    uint8_t PicOutputFlag[HEVC_MAX_REFERENCES];
+    /* Table 7-1: the picture has one of the *_N nal_unit_types. */
+    uint8_t SubLayerNonReference[HEVC_MAX_REFERENCES];
+    uint32_t PicLatencyCount[HEVC_MAX_REFERENCES];
+    /* Sub-layers decoded, see picture_is_decoded(). */
+    uint8_t HighestTid;
+    /* Only IRAP pictures are decoded, each with an empty RPS. */
+    uint8_t irap_only;
+    /* From the active SPS, for HighestTid. */
+    uint8_t sps_max_num_reorder_pics;
+    uint8_t sps_max_dec_pic_buffering;
+    uint32_t SpsMaxLatencyPictures;
+    int8_t  dpb_fullness;
+    int8_t  RefPicSetStFoll[HEVC_MAX_REFERENCES];
+    int8_t  RefPicSetLtFoll[HEVC_MAX_REFERENCES];
+    int8_t  vdpau_initialized;
+    uint32_t serialNumbers[HEVC_MAX_REFERENCES];
+    /* Atomic, since consumers release exported frames from any thread. */
+    _Atomic uint8_t inUse[HEVC_MAX_REFERENCES];
+    /* Outputs are HELD_BY_CONSUMER as soon as they are bumped. */
+    uint8_t hold_outputs;
+    /* DPB entries bumped out for display, in output order. A full DPB and
+       the current picture can all be output at once. */
+    int displayQueue[HEVC_MAX_REFERENCES + 1];
+    /* PicOrderCntVal of each displayQueue entry, and whether it may be
+       dropped when late. */
+    int32_t displayPicOrderCnt[HEVC_MAX_REFERENCES + 1];
+    uint8_t displayDroppable[HEVC_MAX_REFERENCES + 1];
+    /* Output time of each DPB entry and displayQueue entry, or -1. */
+    int64_t OutputTime[HEVC_MAX_REFERENCES];
+    int64_t displayOutputTime[HEVC_MAX_REFERENCES + 1];
+    hevc_hrd_timing hrd;
+    /*
+       Parameter sets already converted for VDPAU, by id, see
+       cache_sps_info() and cache_pps_info(). Only the fields of the
+       respective parameter set are meaningful in each.
+     */
+    VdpPictureInfoHEVC *sps_info[GST_H265_MAX_SPS_COUNT];
+    VdpPictureInfoHEVC *pps_info[GST_H265_MAX_PPS_COUNT];
+    /* Whether the scaling lists to use come from the PPS, not its SPS. */
+    uint8_t pps_scaling_lists[GST_H265_MAX_PPS_COUNT];
+} hevc_decoder_context;
+
+static uint32_t min(uint32_t a, uint32_t b)
+{
+    return a<b?a:b;
+}
+
+static inline int check_for_error(GstH265ParserResult result)
+{
+    if(result != GST_H265_PARSER_OK)
+    {
+        HEVC_LOG_ERROR("Error in gsth265parser: %d", result);
+        return (-10 - result);
+    }
+}
+
+static int check_nalu_result(GstH265ParserResult result)
+{
+    if(result)
+    {
+        const char *name;
+
+        switch(result)
+        {
+        case 0:
+            name = "GST_H265_PARSER_OK";
+            break;
+        case 1:
+            name = "GST_H265_PARSER_BROKEN_DATA";
+            break;
+        case 2:
+            name = "GST_H265_PARSER_BROKEN_LINK";
+            break;
+        case 3:
+            name = "GST_H265_PARSER_ERROR";
+            break;
+        case 4:
+            name = "GST_H265_PARSER_NO_NAL";
+            break;
+        case 5:
+            name = "GST_H265_PARSER_NO_NAL_END";
+            break;
+        default:
+            name = "GST_H265_PARSER_UNKNOWN_ERROR";
+            break;
+        }
+        HEVC_LOG_ERROR("ERROR: gst_h265_parser_identify_nalu: %x %s",
+                       result, name);
+        return -1;
+    }
+    else
+    {
+        HEVC_LOG_TRACE("Got NAL.\n");
+    }
+    return 0;
+}
+
+static int free_gst_objects(
+    GstH265NalUnit** nalu,
+    GstH265SliceHdr** slice,
+    GstH265VPS** vps,
+    GstH265SPS** sps,
+    GstH265PPS** pps,
+    GstH265SEIMessage** sei)
+{
+    free(*nalu);
+    free(*slice);
+    free(*sps);
+    free(*vps);
+    free(*pps);
+    free(*sei);
+
+    return 0;
+}
+
+static int allocate_gst_objects(
+    GstH265NalUnit** nalu,
+    GstH265SliceHdr** slice,
+    GstH265VPS** vps,
+    GstH265SPS** sps,
+    GstH265PPS** pps,
+    GstH265SEIMessage** sei)
+{
+    *slice = calloc(1, sizeof(GstH265SliceHdr));
+    if(*slice == NULL) goto failure;
+    *vps = calloc(1, sizeof(GstH265VPS));
+    if(*vps == NULL) goto failure;
+    *sps = calloc(1, sizeof(GstH265SPS));
+    if(*sps == NULL) goto failure;
+    *pps = calloc(1, sizeof(GstH265PPS));
+    if(*pps == NULL) goto failure;
+    *sei = calloc(MAX_SEI_MESSAGES, sizeof(GstH265SEIMessage));
+    if(*sei == NULL) goto failure;
+    *nalu = calloc(1, sizeof(GstH265NalUnit));
+    if(*nalu == NULL) goto failure;
+
+    return 0;
+failure:
+    free_gst_objects(nalu, slice, vps, sps, pps, sei);
+    return -1;
+}
+
+static int update_picture_info_sps(
+    VdpPictureInfoHEVC *pi,
+    GstH265SPS *sps)
+{
+    int i, j;
+
+    pi->pic_width_in_luma_samples =
+        sps->pic_width_in_luma_samples;
+    pi->pic_height_in_luma_samples =
+        sps->pic_height_in_luma_samples;
+    pi->log2_min_luma_coding_block_size_minus3 =
+        sps->log2_min_luma_coding_block_size_minus3;
+    pi->log2_diff_max_min_luma_coding_block_size =
+        sps->log2_diff_max_min_luma_coding_block_size;
+    pi->log2_min_transform_block_size_minus2 =
+        sps->log2_min_transform_block_size_minus2;
+    pi->log2_diff_max_min_transform_block_size =
+        sps->log2_diff_max_min_transform_block_size;
+    pi->pcm_enabled_flag = sps->pcm_enabled_flag;
+    if(sps->pcm_enabled_flag)
+    {
+        pi->log2_min_pcm_luma_coding_block_size_minus3 =
+            sps->log2_min_pcm_luma_coding_block_size_minus3;
+        pi->log2_diff_max_min_pcm_luma_coding_block_size =
+            sps->log2_diff_max_min_pcm_luma_coding_block_size;
+        pi->pcm_sample_bit_depth_luma_minus1 =
+            sps->pcm_sample_bit_depth_luma_minus1;
+        pi->pcm_sample_bit_depth_chroma_minus1 =
+            sps->pcm_sample_bit_depth_chroma_minus1;
+        pi->pcm_loop_filter_disabled_flag =
+            sps->pcm_loop_filter_disabled_flag;
+    }
+    else
+    {
+        pi->log2_min_pcm_luma_coding_block_size_minus3 = 0;
+        pi->log2_diff_max_min_pcm_luma_coding_block_size = 0;
+        pi->pcm_sample_bit_depth_luma_minus1 = 0;
+        pi->pcm_sample_bit_depth_chroma_minus1 = 0;
+        pi->pcm_loop_filter_disabled_flag = 0;
+    }
+    pi->bit_depth_luma_minus8 = sps->bit_depth_luma_minus8;
+    pi->bit_depth_chroma_minus8 = sps->bit_depth_chroma_minus8;
+    pi->strong_intra_smoothing_enabled_flag =
+        sps->strong_intra_smoothing_enabled_flag;
+    pi->max_transform_hierarchy_depth_intra =
+        sps->max_transform_hierarchy_depth_intra;
+    pi->max_transform_hierarchy_depth_inter =
+        sps->max_transform_hierarchy_depth_inter;
+    pi->amp_enabled_flag = sps->amp_enabled_flag;
+    pi->separate_colour_plane_flag = sps->separate_colour_plane_flag;
+    pi->log2_max_pic_order_cnt_lsb_minus4 =
+        sps->log2_max_pic_order_cnt_lsb_minus4;
+    pi->num_short_term_ref_pic_sets = sps->num_short_term_ref_pic_sets;
+    pi->long_term_ref_pics_present_flag = sps->long_term_ref_pics_present_flag;
+    pi->num_long_term_ref_pics_sps = sps->num_long_term_ref_pics_sps;
+    pi->sps_temporal_mvp_enabled_flag =
+        sps->temporal_mvp_enabled_flag; /* non-compliant name in gstreamer */
+    pi->sample_adaptive_offset_enabled_flag =
+        sps->sample_adaptive_offset_enabled_flag;
+    pi->scaling_list_enabled_flag = sps->scaling_list_enabled_flag;
+    pi->chroma_format_idc = sps->chroma_format_idc;
+    /* non-compliant name. TODO - is layer zero correct here? */
+    pi->sps_max_dec_pic_buffering_minus1 =
+        sps->max_dec_pic_buffering_minus1[0];
+
+    /* 
+     * SPS Scaling Lists
+     *
+     * gstreamer takes care of initializing a default scaling list, or
+     * patching it if sps->scaling_list_data_present_flag is set.
+     */
+
+    for(i=0; i<6; i++)
+    {
+        for(j=0; j<16; j++)
+        {
+            pi->ScalingList4x4[i][j] =
+                sps->scaling_list.scaling_lists_4x4[i][j];
+        }
+    }
+
+    for(i=0; i<6; i++)
+    {
+        for(j=0; j<64; j++)
+        {
+            pi->ScalingList8x8[i][j] =
+                sps->scaling_list.scaling_lists_8x8[i][j];
+        }
+    }
+
+    for(i=0; i<6; i++)
+    {
+        for(j=0; j<64; j++)
+        {
+            pi->ScalingList16x16[i][j] =
+                sps->scaling_list.scaling_lists_16x16[i][j];
+        }
+    }
+
+    for(i=0; i<2; i++)
+    {
+        for(j=0; j<64; j++)
+        {
+            pi->ScalingList32x32[i][j] =
+                sps->scaling_list.scaling_lists_32x32[i][j];
+        }
+    }
+
+    for(i=0; i<6; i++)
+    {
+        pi->ScalingListDCCoeff16x16[i] =
+            sps->scaling_list.scaling_list_dc_coef_minus8_16x16[i] + 8;
+    }
+
+    for(i=0; i<2; i++)
+    {
+        pi->ScalingListDCCoeff32x32[i] =
+            sps->scaling_list.scaling_list_dc_coef_minus8_32x32[i] + 8;
+    }
+
+    return 0;
+}
+
+static int update_picture_info_pps(
+    VdpPictureInfoHEVC *pi,
+    GstH265PPS *pps)
+{
+    int i, j;
+
+    pi->dependent_slice_segments_enabled_flag =
+        pps->dependent_slice_segments_enabled_flag;
+    pi->slice_segment_header_extension_present_flag =
+        pps->slice_segment_header_extension_present_flag;
+    pi->sign_data_hiding_enabled_flag = pps->sign_data_hiding_enabled_flag;
+    pi->cu_qp_delta_enabled_flag = pps->cu_qp_delta_enabled_flag;
+    pi->diff_cu_qp_delta_depth = pps->diff_cu_qp_delta_depth;
+    pi->init_qp_minus26 = pps->init_qp_minus26;
+    pi->pps_cb_qp_offset = pps->cb_qp_offset;
+    pi->pps_cr_qp_offset = pps->cr_qp_offset;
+    pi->constrained_intra_pred_flag = pps->constrained_intra_pred_flag;
+    pi->weighted_pred_flag = pps->weighted_pred_flag;
+    pi->weighted_bipred_flag = pps->weighted_bipred_flag;
+    pi->transform_skip_enabled_flag = pps->transform_skip_enabled_flag;
+    pi->transquant_bypass_enabled_flag = pps->transquant_bypass_enabled_flag;
+    pi->entropy_coding_sync_enabled_flag =
+        pps->entropy_coding_sync_enabled_flag;
+    pi->log2_parallel_merge_level_minus2 =
+        pps->log2_parallel_merge_level_minus2;
+    pi->num_extra_slice_header_bits = pps->num_extra_slice_header_bits;
+    pi->loop_filter_across_tiles_enabled_flag =
+        pps->loop_filter_across_tiles_enabled_flag;
+    pi->pps_loop_filter_across_slices_enabled_flag =
+        pps->loop_filter_across_slices_enabled_flag;
+    pi->output_flag_present_flag = pps->output_flag_present_flag;
+    pi->num_ref_idx_l0_default_active_minus1 =
+        pps->num_ref_idx_l0_default_active_minus1;
+    pi->num_ref_idx_l1_default_active_minus1 =
+        pps->num_ref_idx_l1_default_active_minus1;
+    pi->lists_modification_present_flag = pps->lists_modification_present_flag;
+    pi->cabac_init_present_flag = pps->cabac_init_present_flag;
+    pi->pps_slice_chroma_qp_offsets_present_flag =
+        pps->slice_chroma_qp_offsets_present_flag;
+    pi->deblocking_filter_control_present_flag =
+        pps->deblocking_filter_control_present_flag;
+    pi->deblocking_filter_override_enabled_flag =
+        pps->deblocking_filter_override_enabled_flag;
+    pi->pps_deblocking_filter_disabled_flag =
+        pps->deblocking_filter_disabled_flag;
+    pi->pps_beta_offset_div2 = pps->beta_offset_div2;
+    pi->pps_tc_offset_div2 = pps->tc_offset_div2;
+    pi->tiles_enabled_flag = pps->tiles_enabled_flag;
+    pi->uniform_spacing_flag = pps->uniform_spacing_flag;
+    pi->num_tile_columns_minus1 = pps->num_tile_columns_minus1;
+    pi->num_tile_rows_minus1 = pps->num_tile_rows_minus1;
+
+    for(i=0; i<19 /* from gstreamer */; i++)
+    {
+        pi->column_width_minus1[i] = pps->column_width_minus1[i];
+    }
+    for(; i<22 /* from VDPAU */; i++)
+    {
+        pi->column_width_minus1[i] = 0;
+    }
+
+    for(i=0; i<20 /* from VDPAU */; i++)
+    {
+        pi->row_height_minus1[i] = pps->row_height_minus1[i];
+    }
+
+    /* 
+     * PPS Scaling Lists
+     *
+     * gstreamer takes care of initializing a default scaling list, or
+     * patching it if pps->scaling_list_data_present_flag is set.
+     */
+
+    for(i=0; i<6; i++)
+    {
+        for(j=0; j<16; j++)
+        {
+            pi->ScalingList4x4[i][j] =
+                pps->scaling_list.scaling_lists_4x4[i][j];
+        }
+    }
+
+    for(i=0; i<6; i++)
+    {
+        for(j=0; j<64; j++)
+        {
+            pi->ScalingList8x8[i][j] =
+                pps->scaling_list.scaling_lists_8x8[i][j];
+        }
+    }
+
+    for(i=0; i<6; i++)
+    {
+        for(j=0; j<64; j++)
+        {
+            pi->ScalingList16x16[i][j] =
+                pps->scaling_list.scaling_lists_16x16[i][j];
+        }
+    }
+
+    for(i=0; i<2; i++)
+    {
+        for(j=0; j<64; j++)
+        {
+            pi->ScalingList32x32[i][j] =
+                pps->scaling_list.scaling_lists_32x32[i][j];
+        }
+    }
+
+    for(i=0; i<6; i++)
+    {
+        pi->ScalingListDCCoeff16x16[i] =
+            pps->scaling_list.scaling_list_dc_coef_minus8_16x16[i] + 8;
+    }
+
+    for(i=0; i<2; i++)
+    {
+        pi->ScalingListDCCoeff32x32[i] =
+            pps->scaling_list.scaling_list_dc_coef_minus8_32x32[i] + 8;
+    }
+
+    return 0;
+}
+
+static int update_picture_info_vps()
+{
+    return 0;
+}
+
+/*
+   VdpPictureInfoHEVC keeps the SPS fields, the PPS fields and the scaling
+   lists together in groups. Each group is copied with a single memcpy from
+   the cached blocks of the active parameter sets.
+ */
+#define PICTURE_INFO_BEGIN(field) offsetof(VdpPictureInfoHEVC, field)
+#define PICTURE_INFO_END(field) \
+    (offsetof(VdpPictureInfoHEVC, field) + \
+     sizeof(((VdpPictureInfoHEVC *)0)->field))
+
+#define PICTURE_INFO_SPS_BEGIN PICTURE_INFO_BEGIN(chroma_format_idc)
+#define PICTURE_INFO_SPS_END \
+    PICTURE_INFO_END(strong_intra_smoothing_enabled_flag)
+#define PICTURE_INFO_PPS_BEGIN \
+    PICTURE_INFO_BEGIN(dependent_slice_segments_enabled_flag)
+#define PICTURE_INFO_PPS_END \
+    PICTURE_INFO_END(slice_segment_header_extension_present_flag)
+#define PICTURE_INFO_SCALING_LISTS_BEGIN PICTURE_INFO_BEGIN(ScalingList4x4)
+#define PICTURE_INFO_SCALING_LISTS_END \
+    PICTURE_INFO_END(ScalingListDCCoeff32x32)
+
+_Static_assert(PICTURE_INFO_SPS_END <= PICTURE_INFO_PPS_BEGIN &&
+               PICTURE_INFO_PPS_END <= PICTURE_INFO_BEGIN(IDRPicFlag),
+               "VdpPictureInfoHEVC parameter set fields are not grouped");
+
+static void copy_picture_info_fields(
+    VdpPictureInfoHEVC *pi,
+    const VdpPictureInfoHEVC *block,
+    size_t begin,
+    size_t end)
+{
+    memcpy((uint8_t *)pi + begin, (const uint8_t *)block + begin,
+           end - begin);
+}
+
+/* Returns the cache block for a parameter set id, allocating it once. */
+static VdpPictureInfoHEVC *get_parameter_set_block(VdpPictureInfoHEVC **block)
+{
+    if(*block == NULL)
+    {
+        *block = calloc(1, sizeof(**block));
+        if(*block == NULL)
+            HEVC_LOG_ERROR("Error: MALLOC: parameter set cache.\n");
+    }
+    return *block;
+}
+
+/* Converts a newly arrived SPS, replacing any SPS with the same id. */
+static int cache_sps_info(hevc_decoder_context *context, GstH265SPS *sps)
+{
+    VdpPictureInfoHEVC *block;
+
+    block = get_parameter_set_block(&context->sps_info[sps->id]);
+    if(block == NULL)
+        return -1;
+    return update_picture_info_sps(block, sps);
+}
+
+/* Converts a newly arrived PPS, replacing any PPS with the same id. */
+static int cache_pps_info(hevc_decoder_context *context, GstH265PPS *pps)
+{
+    VdpPictureInfoHEVC *block;
+
+    block = get_parameter_set_block(&context->pps_info[pps->id]);
+    if(block == NULL)
+        return -1;
+    /*
+       7.4.3.3.1 Scaling lists in the PPS override those of the SPS. When
+       the SPS enables scaling lists without sending any, gstreamer puts
+       the default lists in the PPS.
+     */
+    context->pps_scaling_lists[pps->id] =
+        pps->scaling_list_data_present_flag ||
+        (pps->sps->scaling_list_enabled_flag &&
+         !pps->sps->scaling_list_data_present_flag);
+    return update_picture_info_pps(block, pps);
+}
+
+static void free_parameter_set_cache(hevc_decoder_context *context)
+{
+    int i;
+
+    for(i = 0; i < GST_H265_MAX_SPS_COUNT; i++)
+    {
+        free(context->sps_info[i]);
+        context->sps_info[i] = NULL;
+    }
+    for(i = 0; i < GST_H265_MAX_PPS_COUNT; i++)
+    {
+        free(context->pps_info[i]);
+        context->pps_info[i] = NULL;
+    }
+}
+
+/* Table A.8 General tier and level limits, MaxLumaPs by general_level_idc. */
+typedef struct _hevc_level_limits
+{
+    uint8_t level_idc;
+    uint32_t MaxLumaPs;
+} hevc_level_limits;
+
+static const hevc_level_limits level_limits[] =
+{
+    {  30,    36864 }, /* 1 */
+    {  60,   122880 }, /* 2 */
+    {  63,   245760 }, /* 2.1 */
+    {  90,   552960 }, /* 3 */
+    {  93,   983040 }, /* 3.1 */
+    { 120,  2228224 }, /* 4 */
+    { 123,  2228224 }, /* 4.1 */
+    { 150,  8912896 }, /* 5 */
+    { 153,  8912896 }, /* 5.1 */
+    { 156,  8912896 }, /* 5.2 */
+    { 180, 35651584 }, /* 6 */
+    { 183, 35651584 }, /* 6.1 */
+    { 186, 35651584 }, /* 6.2 */
+};
+
+/* MaxLumaPs of the level, or of the next higher one the table has. */
+static uint32_t get_max_luma_ps(uint8_t level_idc)
+{
+    int i;
+
+    for(i = 0; i < ARSIZE(level_limits) - 1; i++)
+    {
+        if(level_limits[i].level_idc >= level_idc)
+            break;
+    }
+
+    return level_limits[i].MaxLumaPs;
+}
+
+/* C.5.2 output limits and A.4.1 MaxDpbSize, from the active SPS. */
+static void update_sps_limits(hevc_decoder_context *context, GstH265SPS *sps)
+{
+    uint32_t PicSizeInSamplesY, MaxLumaPs;
+    uint8_t HighestTid = min(context->HighestTid, sps->max_sub_layers_minus1);
+
+    /* For HighestTid. */
+    context->sps_max_num_reorder_pics =
+        sps->max_num_reorder_pics[HighestTid];
+    context->sps_max_dec_pic_buffering =
+        sps->max_dec_pic_buffering_minus1[HighestTid] + 1;
+    /* (7-9) */
+    if(sps->max_latency_increase_plus1[HighestTid])
+        context->SpsMaxLatencyPictures =
+            context->sps_max_num_reorder_pics +
+            sps->max_latency_increase_plus1[HighestTid] - 1;
+    else
+        context->SpsMaxLatencyPictures = 0;
+
+    /* A.4.1 General tier and level limits. Calculate MaxDpbSize.*/
+    MaxLumaPs = get_max_luma_ps(sps->profile_tier_level.level_idc);
+    PicSizeInSamplesY = sps->pic_width_in_luma_samples
+                        * sps->pic_height_in_luma_samples;
+    if((uint64_t) sps->pic_width_in_luma_samples *
+            sps->pic_width_in_luma_samples > 8 * (uint64_t) MaxLumaPs ||
+            (uint64_t) sps->pic_height_in_luma_samples *
+            sps->pic_height_in_luma_samples > 8 * (uint64_t) MaxLumaPs)
+        HEVC_LOG_ERROR("ERROR: picture width/height is out of bounds.\n");
+
+    /* (A-2) */
+    if(PicSizeInSamplesY <= (MaxLumaPs >> 2))
+        context->MaxDpbSize = min(4*MAX_DPB_PIC_BUF, 16);
+    else if(PicSizeInSamplesY <= (MaxLumaPs >> 1))
+        context->MaxDpbSize = min(2*MAX_DPB_PIC_BUF, 16);
+    else if(PicSizeInSamplesY <= ((3*MaxLumaPs)>>2))
+        context->MaxDpbSize = min((4*MAX_DPB_PIC_BUF)/3, 16);
+    else
+        context->MaxDpbSize = MAX_DPB_PIC_BUF;
+
+    /* A conforming SPS stays within the level. Decode the rest anyway. */
+    if(context->sps_max_dec_pic_buffering > context->MaxDpbSize)
+    {
+        HEVC_LOG_WARNING("WARNING: sps_max_dec_pic_buffering exceeds the "
+                         "level limit of %u pictures.\n", context->MaxDpbSize);
+        context->MaxDpbSize = min(context->sps_max_dec_pic_buffering,
+                                  HEVC_MAX_REFERENCES);
+    }
+}
+
+/*
+   7.4.2.4.2 Activation of parameter sets
+
+   The first slice segment of a picture activates its PPS, and the SPS that
+   PPS refers to. Their cached fields are copied into pi, so pi is correct
+   even when pictures switch between parameter sets.
+ */
+static int activate_parameter_sets(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    GstH265SliceHdr *slice)
+{
+    GstH265PPS *pps = slice->pps;
+    const VdpPictureInfoHEVC *sps_block, *pps_block;
+
+    if(pps == NULL || pps->sps == NULL ||
+            (sps_block = context->sps_info[pps->sps->id]) == NULL ||
+            (pps_block = context->pps_info[pps->id]) == NULL)
+    {
+        HEVC_LOG_ERROR("ERROR: slice refers to a missing parameter set.\n");
+        return -1;
+    }
+
+    copy_picture_info_fields(pi, sps_block,
+                             PICTURE_INFO_SPS_BEGIN, PICTURE_INFO_SPS_END);
+    copy_picture_info_fields(pi, pps_block,
+                             PICTURE_INFO_PPS_BEGIN, PICTURE_INFO_PPS_END);
+    copy_picture_info_fields(pi,
+                             context->pps_scaling_lists[pps->id] ?
+                             pps_block : sps_block,
+                             PICTURE_INFO_SCALING_LISTS_BEGIN,
+                             PICTURE_INFO_SCALING_LISTS_END);
+    update_sps_limits(context, pps->sps);
+    return 0;
+}
+
+/*
+   8.3.1 Decoding process for picture order count
+
+   Per the Specification, "Output of this process is PicOrderCntVal, the
+   picture order count of the current picture".
+
+   - Store PicOrderCntVal in pi->CurrPicOrderCntVal.
+   - Storesslice_pic_order_cnt_lsb in context->current_slice_pic_order_cnt_lsb.
+   - Stash prevPicOrderCntLsb and prevPicOrderCntMsb in the context for
+   future use.
+
+ */
+static void decode_picture_order_count(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    GstH265SliceHdr *slice,
+    GstH265NalUnit *nalu)
+{
+    int PicOrderCntMsb = 0;
+    int MaxPicOrderCntLsb = 1<<(pi->log2_max_pic_order_cnt_lsb_minus4 + 4);
+
+    if(pi->IDRPicFlag)
+    {
+        context->prevPicOrderCntLsb = 0;
+        context->prevPicOrderCntMsb = 0;
+    }
+
+    if(pi->RAPPicFlag && context->NoRaslOutputFlag)
+    {
+        PicOrderCntMsb = 0;
+    }
+    /* (8-1) */
+    else if((slice->pic_order_cnt_lsb < context->prevPicOrderCntLsb) &&
+            ((context->prevPicOrderCntLsb - slice->pic_order_cnt_lsb)
+             >= (MaxPicOrderCntLsb/2)))
+    {
+        PicOrderCntMsb = context->prevPicOrderCntMsb + MaxPicOrderCntLsb;
+    }
+    else if((slice->pic_order_cnt_lsb > context->prevPicOrderCntLsb) &&
+            ((slice->pic_order_cnt_lsb - context->prevPicOrderCntLsb)
+             > (MaxPicOrderCntLsb/2)))
+    {
+        PicOrderCntMsb = context->prevPicOrderCntMsb - MaxPicOrderCntLsb;
+    }
+    else
+    {
+        PicOrderCntMsb = context->prevPicOrderCntMsb;
+    }
+
+    /* (8-2) */
+    pi->CurrPicOrderCntVal = slice->pic_order_cnt_lsb + PicOrderCntMsb;
+
+    /* Store the slice_pic_order_cnt_lsb for (8-6) later in the process. */
+    context->current_slice_pic_order_cnt_lsb = slice->pic_order_cnt_lsb;
+
+    if((nalu->temporal_id_plus1 - 1) == 0)
+    {
+        context->prevPicOrderCntLsb = slice->pic_order_cnt_lsb;
+        context->prevPicOrderCntMsb = PicOrderCntMsb;
+    }
+}
+
+static uint32_t poc_table_hash(int32_t poc)
+{
+    /* Fibonacci hashing, the top bits for POC_TABLE_SIZE buckets. */
+    return ((uint32_t) poc * 2654435761u) >> 27;
+}
+
+static void poc_table_clear(hevc_poc_table *table)
+{
+    memset(table->entry, -1, sizeof(table->entry));
+}
+
+static void poc_table_insert(hevc_poc_table *table, int32_t poc, int8_t i)
+{
+    uint32_t b;
+
+    for(b = poc_table_hash(poc); table->entry[b] >= 0;
+            b = (b + 1) & (POC_TABLE_SIZE - 1))
+        ;
+    table->poc[b] = poc;
+    table->entry[b] = i;
+}
+
+static void poc_table_remove(hevc_poc_table *table, int32_t poc, int8_t i)
+{
+    uint32_t b, next, home;
+
+    for(b = poc_table_hash(poc); table->entry[b] != i;
+            b = (b + 1) & (POC_TABLE_SIZE - 1))
+    {
+        if(table->entry[b] < 0)
+        {
+            HEVC_LOG_ERROR("ERROR: DPB entry %d is not indexed!\n", i);
+            return;
+        }
+    }
+
+    /* Backward shift deletion: pull later buckets of the same probe
+       sequence into the hole, so that lookups can stop at empty ones. */
+    for(;;)
+    {
+        table->entry[b] = -1;
+        next = b;
+        do
+        {
+            next = (next + 1) & (POC_TABLE_SIZE - 1);
+            if(table->entry[next] < 0)
+                return;
+            home = poc_table_hash(table->poc[next]);
+        }
+        while(b <= next ? (b < home && home <= next)
+                : (b < home || home <= next));
+        table->poc[b] = table->poc[next];
+        table->entry[b] = table->entry[next];
+        b = next;
+    }
+}
+
+static void dpb_index_clear(hevc_dpb_index *index)
+{
+    poc_table_clear(&index->by_poc);
+    poc_table_clear(&index->by_lsb);
+    index->count = 0;
+}
+
+/* DPB entry i now holds a picture. */
+static void dpb_index_insert(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    int8_t i)
+{
+    hevc_dpb_index *index = &context->dpb_index;
+    int32_t poc = pi->PicOrderCntVal[i];
+    int j;
+
+    poc_table_insert(&index->by_poc, poc, i);
+    poc_table_insert(&index->by_lsb,
+                     context->dpb_slice_pic_order_cnt_lsb[i], i);
+
+    for(j = index->count; j > 0; j--)
+    {
+        int8_t k = index->poc_order[j - 1];
+
+        if(pi->PicOrderCntVal[k] < poc ||
+                (pi->PicOrderCntVal[k] == poc && k < i))
+            break;
+        index->poc_order[j] = k;
+    }
+    index->poc_order[j] = i;
+    index->count++;
+}
+
+/* DPB entry i no longer holds a picture. */
+static void dpb_index_remove(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    int8_t i)
+{
+    hevc_dpb_index *index = &context->dpb_index;
+    int j;
+
+    poc_table_remove(&index->by_poc, pi->PicOrderCntVal[i], i);
+    poc_table_remove(&index->by_lsb,
+                     context->dpb_slice_pic_order_cnt_lsb[i], i);
+
+    for(j = 0; j < index->count && index->poc_order[j] != i; j++)
+        ;
+    if(j == index->count)
+        return;
+    index->count--;
+    memmove(&index->poc_order[j], &index->poc_order[j + 1],
+            index->count - j);
+}
+
+/*
+   Helper function for RPS derivation process in (8-6) and (8-7). Implements:
+   "if there is a (maybe short term) reference picture picX in the DPB with
+   (slice_pic_order_cnt_lsb or PicOrderCntVal" equal to some particular POC".
+
+   Looks the POC up in context->dpb_index, and checks the marking of the
+   pictures that have it.
+
+   Returns the index of the picture in the DPB array, pi->RefPics[], that
+   matches the requested poc value, or -1 if one is not found. Callers shall
+   interpret a return value of -1 as "no reference picture".
+ */
+static int32_t find_pic_in_dpb_with_poc(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    int32_t poc,
+    uint8_t short_term_only,
+    uint8_t lsb_only)
+{
+    const hevc_poc_table *table;
+    uint8_t usage_mask;
+    uint32_t b;
+    int8_t i, found = -1;
+
+    usage_mask = USED_FOR_SHORT_TERM_REFERENCE;
+
+    if(!short_term_only)
+        usage_mask |= USED_FOR_LONG_TERM_REFERENCE;
+
+    if(lsb_only)
+        table = &context->dpb_index.by_lsb;
+    else
+        table = &context->dpb_index.by_poc;
+
+    /* Only the LSBs can be shared, by a reference and a picture that is
+       waiting for output. Prefer the lowest entry, as a scan would. */
+    for(b = poc_table_hash(poc); (i = table->entry[b]) >= 0;
+            b = (b + 1) & (POC_TABLE_SIZE - 1))
+    {
+        if(table->poc[b] == poc &&
+                (context->dpb_reference_values[i] & usage_mask) &&
+                (found < 0 || i < found))
+            found = i;
+    }
+
+    if(found < 0)
+        HEVC_LOG_DEBUG("NOTICE: Unable to find pic in DPB with POC: %d\n",
+                       poc);
+    return found;
+}
+
+/* TODO - Break out H265 spec handling code into a separate file. */
+/*
+   8.3.2 Decoding process for reference picture set
+
+   This process generates five lists of picture order counts:
+   PocStCurrBefore, PocStCurrAfter, PocStFoll,
+   PocLtCurr, and PocLtFoll.
+
+   These five lists have these corresponding numbers of elements:
+   NumPocStCurrBefore, NumPocStCurrAfter, NumPocStFoll,
+   NumPocLtCurr, NumPocLtFoll.
+
+   These five lists (and their corresponding numbers of elements) are then
+   used to generate the five reference picture set (RPS) lists of the current
+   picture:
+   RefPicSetStCurrBefore, RefPicSetStCurrAfter, RefPicSetStFoll,
+   RefPicSetLtCurr, RefPicSetLtFoll.
+
+   As a side effect, this function sets the dpb_reference_values array in
+   hevc_decoder_context, marking whether or not particular DPB entries are
+   used for reference.
+
+   For VDPAU playback, we do not need to pass in "Foll" lists as they are not
+   helpful for decoding the current picture. The "Curr" lists are stored in
+   VdpPictureInfoHEVC and passed to the VDPAU implementation. The "Foll" lists
+   are stored locally, in this implementation's hevc_decoder_context.
+
+Q: What per-picture state do we need to track in the player? Perhaps an
+|  array of POC values for pictures in the DPB, er, RefPics[] array?
+A: Per picture player state is stored in hevc_decoder_context.
+
+Q: The caller needs to make sure we've got the correct SPS...
+A: Not quite. We just need to make sure that CurrRpsIdx is being handled
+correctly.
+ */
+static void decode_reference_picture_set(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    GstH265SliceHdr *slice,
+    GstH265SPS *sps
+)
+{
+    int32_t PocStCurrBefore[16];
+    int32_t PocStCurrAfter[16];
+    int32_t PocStFoll[16];
+    int32_t PocLtCurr[16];
+    int32_t PocLtFoll[16];
+
+    uint8_t CurrDeltaPocMsbPresentFlag[16];
+    uint8_t FollDeltaPocMsbPresentFlag[16];
+
+    uint8_t NumPocStCurrBefore;
+    uint8_t NumPocStCurrAfter;
+    uint8_t NumPocStFoll;
+    uint8_t NumPocLtCurr;
+    uint8_t NumPocLtFoll;
+
+    uint8_t NumPocTotalCurr;
+
+    /*
+       VDPAU provides these three reference picture sets in VdpPictureInfoHEVC:
+       int8_t RefPicSetStCurrBefore[8];
+       int8_t RefPicSetStCurrAfter[8];
+       int8_t RefPicSetLtCurr[8];
+
+       Store remaining two Foll reference picture sets in hevc_decoder_context:
+       int8_t RefPicSetStFoll[HEVC_MAX_REFERENCES];
+       int8_t RefPicSetLtFoll[HEVC_MAX_REFERENCES];
+     */
+
+    int i, j, k;
+    uint8_t CurrRpsIdx;
+    GstH265ShortTermRefPicSet *stRPS = NULL;
+    int pocLt, UsedByCurrPicLt;
+    int MaxPicOrderCntLsb = 1<<(pi->log2_max_pic_order_cnt_lsb_minus4 + 4);
+    uint16_t pictures_in_use = 0;
+
+    if(pi->IDRPicFlag && context->NoRaslOutputFlag)
+    {
+        for(i=0; i<HEVC_MAX_REFERENCES; i++)
+        {
+            context->dpb_reference_values[i] = UNUSED_FOR_REFERENCE;
+        }
+    }
+
+    /* (8-5) */
+    /* (7-43) for calculation of NumPocTotalCurr */
+    for(i = 0; i < 16; i++)
+    {
+        PocStCurrBefore[i] = 0;
+        PocStCurrAfter[i] = 0;
+        PocStFoll[i] = 0;
+        PocLtCurr[i] = 0;
+        PocLtFoll[i] = 0;
+    }
+    NumPocStCurrBefore = 0;
+    NumPocStCurrAfter = 0;
+    NumPocStFoll = 0;
+    NumPocLtCurr = 0;
+    NumPocLtFoll = 0;
+
+    NumPocTotalCurr = 0;
+
+    /* With irap_only, nothing before the IRAP picture is kept. */
+    if(!pi->IDRPicFlag && !context->irap_only)
+    {
+        if (slice->short_term_ref_pic_set_sps_flag)
+        {
+            CurrRpsIdx = slice->short_term_ref_pic_set_idx;
+            stRPS = &sps->short_term_ref_pic_set[CurrRpsIdx];
+        }
+        else
+        {
+            CurrRpsIdx = sps->num_short_term_ref_pic_sets;
+            stRPS = &slice->short_term_ref_pic_sets;
+        }
+
+        for(i=0, j=0, k=0; i < stRPS->NumNegativePics; i++)
+        {
+            if(stRPS->UsedByCurrPicS0[i])
+            {
+                PocStCurrBefore[j++] =
+                    pi->CurrPicOrderCntVal + stRPS->DeltaPocS0[i];
+                NumPocTotalCurr++;
+            }
+            else
+                PocStFoll[k++] =
+                    pi->CurrPicOrderCntVal + stRPS->DeltaPocS0[i];
+        }
+        NumPocStCurrBefore = j;
+
+        for(i=0, j=0; i < stRPS->NumPositivePics; i++)
+        {
+            if(stRPS->UsedByCurrPicS1[i])
+            {
+                PocStCurrAfter[j++] =
+                    pi->CurrPicOrderCntVal + stRPS->DeltaPocS1[i];
+                NumPocTotalCurr++;
+            }
+            else
+                PocStFoll[k++] = pi->CurrPicOrderCntVal + stRPS->DeltaPocS1[i];
+        }
+        NumPocStCurrAfter = j;
+        NumPocStFoll = k;
+
+        for(i=0, j=0, k=0;
+                i < slice->num_long_term_sps + slice->num_long_term_pics;
+                i++)
+        {
+            /* 7.4.7.1 PocLsbLt[i] UsedByCurrPicLt[i] */
+            if(i < slice->num_long_term_sps)
+            {
+                pocLt = sps->lt_ref_pic_poc_lsb_sps[slice->lt_idx_sps[i]];
+                UsedByCurrPicLt =
+                    sps->used_by_curr_pic_lt_sps_flag[slice->lt_idx_sps[i]];
+            }
+            else
+            {
+                pocLt = slice->poc_lsb_lt[i];
+                UsedByCurrPicLt = slice->used_by_curr_pic_lt_flag[i];
+            }
+
+            if(slice->delta_poc_msb_present_flag[i])
+                pocLt += pi->CurrPicOrderCntVal
+                         - (slice->delta_poc_msb_cycle_lt[i]*MaxPicOrderCntLsb)
+                         - slice->pic_order_cnt_lsb;
+
+            if(UsedByCurrPicLt)
+            {
+                PocLtCurr[j] = pocLt;
+                CurrDeltaPocMsbPresentFlag[j++] =
+                    slice->delta_poc_msb_present_flag[i];
+                NumPocTotalCurr++;
+            }
+            else
+            {
+                PocLtFoll[k] = pocLt;
+                FollDeltaPocMsbPresentFlag[k++] =
+                    slice->delta_poc_msb_present_flag[i];
+            }
+        }
+        NumPocLtCurr = j;
+        NumPocLtFoll = k;
+    }
+
+    /* TODO - Implement error checking as defined on p.96-97 */
+
+    /* Derivation process for RPS and picture marking. */
+
+    /* Step 1. */
+    /* (8-6) Generation of long term reference picture sets. */
+    for(i=0; i < NumPocLtCurr; i++)
+    {
+        if(!CurrDeltaPocMsbPresentFlag[i])
+        {
+            pi->RefPicSetLtCurr[i] =
+                find_pic_in_dpb_with_poc(pi, context, PocLtCurr[i], 0, 1);
+        }
+        else
+        {
+            pi->RefPicSetLtCurr[i] =
+                find_pic_in_dpb_with_poc(pi, context, PocLtCurr[i], 0, 0);
+        }
+    }
+    for(i=0; i < NumPocLtFoll; i++)
+    {
+        if(!FollDeltaPocMsbPresentFlag[i])
+        {
+            context->RefPicSetLtFoll[i] =
+                find_pic_in_dpb_with_poc(pi, context, PocLtFoll[i], 0, 1);
+        }
+        else
+        {
+            context->RefPicSetLtFoll[i] =
+                find_pic_in_dpb_with_poc(pi, context, PocLtFoll[i], 0, 0);
+        }
+    }
+
+    /* Step 2. Marking of long term reference pictures. */
+    for(i=0; i < NumPocLtCurr; i++)
+    {
+        if(pi->RefPicSetLtCurr[i] >= 0)
+        {
+            context->dpb_reference_values[pi->RefPicSetLtCurr[i]] =
+                USED_FOR_LONG_TERM_REFERENCE;
+            pictures_in_use |= 1 << pi->RefPicSetLtCurr[i];
+        }
+    }
+    for(i=0; i < NumPocLtFoll; i++)
+    {
+        if(context->RefPicSetLtFoll[i] >= 0)
+        {
+            context->dpb_reference_values[context->RefPicSetLtFoll[i]] =
+                USED_FOR_LONG_TERM_REFERENCE;
+            pictures_in_use |= 1 << context->RefPicSetLtFoll[i];
+        }
+    }
+
+    /* Step 3. */
+    /* (8-7) Generation of short term reference picture sets. */
+    for(i=0; i < NumPocStCurrBefore; i++)
+    {
+        pi->RefPicSetStCurrBefore[i] =
+            find_pic_in_dpb_with_poc(pi, context, PocStCurrBefore[i], 1, 0);
+        if(pi->RefPicSetStCurrBefore[i] >= 0)
+            pictures_in_use |= 1 << pi->RefPicSetStCurrBefore[i];
+    }
+
+    for(i=0; i < NumPocStCurrAfter; i++)
+    {
+        pi->RefPicSetStCurrAfter[i] =
+            find_pic_in_dpb_with_poc(pi, context, PocStCurrAfter[i], 1, 0);
+        if(pi->RefPicSetStCurrAfter[i] >= 0)
+            pictures_in_use |= 1 << pi->RefPicSetStCurrAfter[i];
+    }
+
+    for(i=0; i < NumPocStFoll; i++)
+    {
+        context->RefPicSetStFoll[i] =
+            find_pic_in_dpb_with_poc(pi, context, PocStFoll[i], 1, 0);
+        if(context->RefPicSetStFoll[i] >= 0)
+            pictures_in_use |= 1 << context->RefPicSetStFoll[i];
+    }
+
+    /* Step 4. Marking of unused reference pictures. */
+    /* Implement this using a bit mask which we set previously. */
+    for(i=0; i < HEVC_MAX_REFERENCES; i++)
+        if(!(pictures_in_use & (1 << i)))
+            context->dpb_reference_values[i] = UNUSED_FOR_REFERENCE;
+
+    /* TODO - Implement error checking as defined on p.98-99 */
+    context->NumPocStFoll = NumPocStFoll;
+    context->NumPocLtFoll = NumPocLtFoll;
+    memcpy(context->PocStFoll, PocStFoll, sizeof(PocStFoll));
+    memcpy(context->PocLtFoll, PocLtFoll, sizeof(PocLtFoll));
+    memcpy(context->PocStCurrBefore, PocStCurrBefore, sizeof(PocStCurrBefore));
+    memcpy(context->PocStCurrAfter, PocStCurrAfter, sizeof(PocStCurrAfter));
+    memcpy(context->PocLtCurr, PocLtCurr, sizeof(PocLtCurr));
+
+    pi->NumPocStCurrBefore = NumPocStCurrBefore;
+    pi->NumPocStCurrAfter = NumPocStCurrAfter;
+    pi->NumPocLtCurr = NumPocLtCurr;
+
+    pi->NumPocTotalCurr = NumPocTotalCurr;
+
+    if(stRPS)
+        pi->NumDeltaPocsOfRefRpsIdx = stRPS->NumDeltaPocs;
+    else
+        pi->NumDeltaPocsOfRefRpsIdx = 0;
+}
+
+/*
+    Update decoder state with the information contained in an incoming slice
+    header.
+
+    Implements:
+    8.1 General decoding process
+    Generates upper-case variables from clause 7 as required.
+    8.2 NAL unit decoding process
+    Works together with gst_h265_parser_parse_slice_hdr_vdpau to parse NAL
+    unit.
+ */
+static void update_picture_info_slice_header(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    GstH265SliceHdr *slice,
+    GstH265NalUnit *nalu,
+    GstH265SPS *sps
+)
+{
+    int stRpsIdx, RefRpsIdx;
+    /* int UseAltCpbParamsFlag = 0; - NOT USED */
+
+    /*
+       7.4.7.1 General slice segment header semantics
+
+       The variable CurrRpsIdx is derived as follows:
+       – If short_term_ref_pic_set_sps_flag is equal to 1, CurrRpsIdx is set
+         equal to short_term_ref_pic_set_idx.
+       – Otherwise, CurrRpsIdx is set equal to num_short_term_ref_pic_sets.
+     */
+    if(slice->short_term_ref_pic_set_sps_flag)
+        pi->CurrRpsIdx = slice->short_term_ref_pic_set_idx;
+    else
+        pi->CurrRpsIdx = pi->num_short_term_ref_pic_sets;
+
+    if(nalu->type == GST_H265_NAL_SLICE_IDR_W_RADL ||
+            nalu->type == GST_H265_NAL_SLICE_IDR_N_LP)
+        pi->IDRPicFlag = 1;
+    else
+        pi->IDRPicFlag = 0;
+
+    if(nalu->type >= GST_H265_NAL_SLICE_BLA_W_LP &&
+            nalu->type <= 23) /* RSV_IRAP_VCL23, undefined in GStreamer */
+        pi->RAPPicFlag = 1;
+    else
+        pi->RAPPicFlag = 0;
+
+    /*
+       7.4.8 Short-term reference picture set semantics
+
+       NumDeltaPocsOfRefRpsIdx
+
+       The variable RefRpsIdx is derived as follows:
+       RefRpsIdx = stRpsIdx − ( delta_idx_minus1 + 1 ) (7-45)
+     */
+    if(slice->short_term_ref_pic_set_sps_flag)
+    {
+        /* Do short term RPS stuff based on what is in SPS. */
+        pi->NumDeltaPocsOfRefRpsIdx = 0; /* not used */
+    }
+    else
+    {
+        /* Use slice segment header for SPS stuff. */
+        stRpsIdx = sps->num_short_term_ref_pic_sets;
+        RefRpsIdx = stRpsIdx -
+                    (sps->short_term_ref_pic_set[stRpsIdx].delta_idx_minus1+1);
+        pi->NumDeltaPocsOfRefRpsIdx =
+            sps->short_term_ref_pic_set[RefRpsIdx].NumDeltaPocs;
+    }
+
+    /*
+       7.4.7.2 Reference picture list modification semantics
+     */
+    pi->NumShortTermPictureSliceHeaderBits =
+        slice->NumShortTermPictureSliceHeaderBits;
+    pi->NumLongTermPictureSliceHeaderBits =
+        slice->NumLongTermPictureSliceHeaderBits;
+
+    /* 8.1 Decoding process for a coded picture
+       with nuh_layer_id equal to 0        */
+    if (nalu->type == GST_H265_NAL_SLICE_BLA_W_LP ||
+            nalu->type == GST_H265_NAL_SLICE_CRA_NUT)
+    {
+        /* TODO - Handle UseAltCpbParamsFlag. */
+        //UseAltCpbParamsFlag = 0;
+    }
+
+    /*
+       NoRaslOutputFlag belongs to the IRAP picture, and holds for the
+       pictures associated with it, which is what RASL pictures check.
+     */
+    if(!pi->RAPPicFlag)
+        return;
+    if (nalu->type == GST_H265_NAL_SLICE_IDR_W_RADL ||
+            nalu->type == GST_H265_NAL_SLICE_IDR_N_LP   ||
+            nalu->type == GST_H265_NAL_SLICE_BLA_W_LP   ||
+            nalu->type == GST_H265_NAL_SLICE_BLA_W_RADL ||
+            nalu->type == GST_H265_NAL_SLICE_BLA_N_LP   ||
+            /* first picture in bitstream in decoding order */
+            /* first picture after end of stream */
+            context->IsFirstPicture)
+    {
+        context->NoRaslOutputFlag = 1;
+    }
+    /* Set by external means, when decoding starts at a seek point. */
+    else
+    {
+        context->NoRaslOutputFlag = context->HandleCraAsBlaFlag;
+    }
+    context->HandleCraAsBlaFlag = 0;
+}
+
+/*
+   Number of pictures in the DPB, and how many of them are "needed for
+   output".
+ */
+static int count_pictures_in_dpb(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    int *needed_for_output)
+{
+    int i, pictures = 0;
+
+    *needed_for_output = 0;
+    for(i=0; i<HEVC_MAX_REFERENCES; i++)
+    {
+        if(pi->RefPics[i] != VDP_INVALID_HANDLE)
+        {
+            pictures++;
+            if(context->PicOutputFlag[i])
+                (*needed_for_output)++;
+        }
+    }
+
+    return pictures;
+}
+
+/*
+   The conditions of C.5.2.2 and C.5.2.3 under which the "bumping" process
+   is invoked. The DPB fullness condition only applies before the current
+   picture is decoded.
+ */
+static int bumping_needed(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    uint8_t check_fullness)
+{
+    int i, pictures, needed_for_output;
+
+    pictures = count_pictures_in_dpb(pi, context, &needed_for_output);
+
+    if(needed_for_output > context->sps_max_num_reorder_pics)
+        return 1;
+
+    if(context->SpsMaxLatencyPictures)
+    {
+        for(i=0; i<HEVC_MAX_REFERENCES; i++)
+        {
+            if(pi->RefPics[i] != VDP_INVALID_HANDLE &&
+                    context->PicOutputFlag[i] &&
+                    context->PicLatencyCount[i] >=
+                    context->SpsMaxLatencyPictures)
+                return 1;
+        }
+    }
+
+    return check_fullness && pictures >= context->sps_max_dec_pic_buffering;
+}
+
+/* Removes the picture in DPB entry i without outputting it. */
+static void empty_picture_storage_buffer(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    int i)
+{
+    dpb_index_remove(pi, context, i);
+    pi->RefPics[i] = VDP_INVALID_HANDLE;
+    context->dpb_fullness--;
+    if(context->dpb_fullness < 0)
+        HEVC_LOG_ERROR("ERROR: dpb_fullness should not be negative!\n");
+}
+
+/* Appends DPB entry i to the display queue, in output order. */
+static void queue_for_display(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    int i)
+{
+    int j;
+
+    for(j = 0; j < ARSIZE(context->displayQueue); j++)
+    {
+        if(context->displayQueue[j] == -1)
+        {
+            context->displayQueue[j] = i;
+            context->displayPicOrderCnt[j] = pi->PicOrderCntVal[i];
+            context->displayDroppable[j] = context->SubLayerNonReference[i];
+            context->displayOutputTime[j] = context->OutputTime[i];
+            context->inUse[i] |= QUEUED_FOR_DISPLAY;
+            return;
+        }
+    }
+    HEVC_LOG_ERROR("ERROR: display queue overflow!\n");
+}
+
+/*
+   C.5.2.4 "Bumping" process
+
+   Outputs the picture that is first in output order, meaning the smallest
+   PicOrderCntVal of all pictures marked as "needed for output", and empties
+   its picture storage buffer if it is no longer used for reference.
+   Returns 0 if no picture is needed for output.
+ */
+static int bump_picture(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context)
+{
+    const hevc_dpb_index *index = &context->dpb_index;
+    int i, first = -1;
+
+    for(i=0; i < index->count; i++)
+    {
+        if(context->PicOutputFlag[index->poc_order[i]])
+        {
+            first = index->poc_order[i];
+            break;
+        }
+    }
+
+    if(first < 0)
+        return 0;
+
+    /* Cropping is left to the video mixer. */
+    queue_for_display(pi, context, first);
+    context->PicOutputFlag[first] = 0;
+    if(context->dpb_reference_values[first] == UNUSED_FOR_REFERENCE)
+        empty_picture_storage_buffer(pi, context, first);
+
+    return 1;
+}
+
+/*
+   C.5.2.2 Output and removal of pictures from the DPB
+
+   Walks the DPB, emptying pictures which are neither used for reference nor
+   needed for output, and invokes the "bumping" process as long as the DPB
+   holds more pictures than the active SPS allows. Modifies state variables
+   in hevc_decoder_context.
+
+   Must be called immediately after decode_reference_picture_set() as noted
+   in the Specification.
+ */
+static void remove_pictures_from_dpb(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    GstH265SliceHdr *slice,
+    GstH265NalUnit *nalu)
+{
+    int i;
+
+    if(pi->RAPPicFlag &&
+            context->NoRaslOutputFlag)
+    {
+        /* 1. Determine NoOutputOfPriorPicsFlag. */
+        if(nalu->type == GST_H265_NAL_SLICE_CRA_NUT &&
+                !(context->IsFirstPicture))
+            context->NoOutputOfPriorPicsFlag = 1;
+        /* TODO - NoOutputOfPriorPicsFlag may be set if
+        pic_width_in_luma_samples,
+           pic_height_in_luma_samples, or
+           sps_max_dec_pic_buffering_minus1[HighestTid] have changed.
+           This is not implemented here. */
+        else if(context->IsFirstPicture)
+            /* Not defined in Specification but a convenient place
+               to handle picture 0 */
+            context->NoOutputOfPriorPicsFlag = 1;
+        else
+            context->NoOutputOfPriorPicsFlag =
+                slice->no_output_of_prior_pics_flag;
+
+        /* 2. Apply NoOutputOfPriorPicsFlag. */
+        if(!context->NoOutputOfPriorPicsFlag)
+        {
+            /* Output everything still waiting, in output order. */
+            while(bump_picture(pi, context))
+                ;
+        }
+        for(i=0; i<HEVC_MAX_REFERENCES; i++)
+        {
+            context->dpb_reference_values[i] = UNUSED_FOR_REFERENCE;
+            context->PicOutputFlag[i] = 0;
+            /* Not required in Specification but convenient to do
+            this here. */
+            pi->PicOrderCntVal[i] = 0;
+            context->dpb_slice_pic_order_cnt_lsb[i] = 0;
+            pi->RefPics[i] = VDP_INVALID_HANDLE;
+        }
+        dpb_index_clear(&context->dpb_index);
+        context->dpb_fullness = 0;
+        return;
+    }
+
+    /* Remove pictures from DPB. */
+    for(i=0; i<HEVC_MAX_REFERENCES; i++)
+    {
+        if(pi->RefPics[i] != VDP_INVALID_HANDLE &&
+                context->dpb_reference_values[i] == UNUSED_FOR_REFERENCE &&
+                context->PicOutputFlag[i] == 0)
+            empty_picture_storage_buffer(pi, context, i);
+    }
+
+    /* Make room for the current picture. A DPB full of reference pictures
+       can not be bumped any further. */
+    while(bumping_needed(pi, context, 1) && bump_picture(pi, context))
+        ;
+}
+
+/*
+   C.5.2.3 Picture decoding, marking, additional bumping and storage
+
+   Stores the current picture in DPB entry target_index. Ages every picture
+   waiting for output, and bumps pictures out as soon as the reorder and
+   latency limits of the SPS require it.
+ */
+static void store_current_picture(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    int8_t target_index)
+{
+    int i;
+
+    pi->PicOrderCntVal[target_index] = pi->CurrPicOrderCntVal;
+    pi->RefPics[target_index] = context->scratch_frames[target_index];
+    dpb_index_insert(pi, context, target_index);
+
+    for(i=0; i<HEVC_MAX_REFERENCES; i++)
+    {
+        if(i != target_index &&
+                pi->RefPics[i] != VDP_INVALID_HANDLE &&
+                context->PicOutputFlag[i])
+            context->PicLatencyCount[i]++;
+    }
+    context->PicLatencyCount[target_index] = 0;
+
+    while(bumping_needed(pi, context, 0) && bump_picture(pi, context))
+        ;
+}
+
+/*
+   Outputs every picture still needed for output, at the end of the
+   bitstream or of a coded video sequence.
+ */
+static void flush_dpb(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context)
+{
+    while(bump_picture(pi, context))
+        ;
+}
+
+/*
+   C.3.4 Current decoded picture marking and storage
+
+   Walks the DPB looking for an empty entry. Marks it as "used for short term
+   reference" and returns the index. Returns -1 in case of error.
+
+   An entry is empty once its picture is neither used for reference nor
+   needed for output, and no consumer holds it. An entry without a scratch
+   frame yet, which is always entry num_scratch_frames, is only taken if no
+   allocated entry is empty. The caller then allocates one. Entries that
+   were just bumped out for display are only reused if MaxDpbSize entries
+   are allocated. Exported pictures may be held for a while after they
+   leave the DPB, so exporting sessions allocate up to HEVC_MAX_REFERENCES,
+   and never reuse an entry that is still to be exported.
+ */
+
+static int8_t mark_decoded_picture_index(
+    hevc_decoder_context *context,
+    int8_t i)
+{
+    context->dpb_reference_values[i] = USED_FOR_SHORT_TERM_REFERENCE;
+    context->dpb_fullness++;
+    return i;
+}
+
+static int8_t get_decoded_picture_index(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context)
+{
+    int i, pass, entries;
+    uint8_t in_use;
+
+    entries = context->hold_outputs ? HEVC_MAX_REFERENCES : context->MaxDpbSize;
+
+    /* Find a place for the decoded picture to go. */
+    for(pass = 0; pass < 2; pass++)
+    {
+        for(i=0; i < context->num_scratch_frames && i < entries; i++)
+        {
+            in_use = context->inUse[i];
+            if(pi->RefPics[i] == VDP_INVALID_HANDLE &&
+                    !(in_use & HELD_BY_CONSUMER) &&
+                    !((!pass || context->hold_outputs) &&
+                      (in_use & QUEUED_FOR_DISPLAY)))
+                return mark_decoded_picture_index(context, i);
+        }
+        if(pass == 0 && context->num_scratch_frames < entries)
+            return mark_decoded_picture_index(context,
+                                              context->num_scratch_frames);
+    }
+
+    return -1;
+}
+
+/*
+   8.1 decoding process step 2 bullet 4
+   Calculation of PicOutputFlag
+ */
+static void calculate_PicOutputFlag(
+    hevc_decoder_context *context,
+    GstH265SliceHdr *slice,
+    GstH265NalUnit *nalu,
+    int8_t target_index)
+{
+    if((nalu->type == GST_H265_NAL_SLICE_RASL_N ||
+            nalu->type == GST_H265_NAL_SLICE_RASL_R) &&
+            context->NoRaslOutputFlag)
+    {
+        context->PicOutputFlag[target_index] = 0;
+    }
+    else
+    {
+        context->PicOutputFlag[target_index] = slice->pic_output_flag;
+    }
+}
+
+/*
+   Picks up what get_output_time() needs from the SEI messages of a NAL
+   unit, and frees them. Only the ones of the current access unit count.
+ */
+static void update_picture_info_sei(
+    hevc_decoder_context *context,
+    GstH265SEIMessage *messages,
+    unsigned int n_messages
+)
+{
+    hevc_hrd_timing *hrd = &context->hrd;
+    unsigned int i;
+
+    for(i = 0; i < n_messages; i++)
+    {
+        switch(messages[i].payloadType)
+        {
+        case GST_H265_SEI_BUF_PERIOD:
+            hrd->BufferingPeriodPresent = 1;
+            break;
+        case GST_H265_SEI_PIC_TIMING:
+            hrd->PicTimingPresent = 1;
+            /* C.3.3 (C-11) and C.5.2.3 (C-16) */
+            hrd->AuCpbRemovalDelayVal =
+                messages[i].payload.pic_timing.au_cpb_removal_delay_minus1 + 1;
+            hrd->PicDpbOutputDelay =
+                messages[i].payload.pic_timing.pic_dpb_output_delay;
+            break;
+        default:
+            break;
+        }
+        gst_h265_sei_free(&messages[i]);
+    }
+}
+
+/*
+   The output time of the current picture, in ns from the start of the
+   stream, or -1 if the stream does not say.
+
+   With picture timing SEI messages, that is the DPB output time of C.5.2.3
+   (C-16), from the nominal CPB removal time of C.3.3 (C-11) and its
+   buffering period. The initial CPB removal delay is left out: it delays
+   every picture alike. Without them, but with
+   vui_poc_proportional_to_timing_flag, it follows from PicOrderCntVal
+   (E.3.1). Every coded video sequence starts one clock tick after the last
+   output time of the one before.
+ */
+static int64_t get_output_time(
+    VdpPictureInfoHEVC *pi,
+    hevc_decoder_context *context,
+    const GstH265SPS *sps)
+{
+    const GstH265VUIParams *vui = &sps->vui_params;
+    hevc_hrd_timing *hrd = &context->hrd;
+    double tick_ns;
+    uint64_t ticks;
+    int64_t output_ns = -1;
+    int64_t next_ns;
+
+    if(!sps->vui_parameters_present_flag ||
+            !vui->timing_info_present_flag ||
+            !vui->num_units_in_tick || !vui->time_scale)
+        goto done;
+    /* ClockTick, (E-8) */
+    tick_ns = 1e9 * vui->num_units_in_tick / vui->time_scale;
+    next_ns = hrd->last_output_ns < 0 ? 0 :
+              hrd->last_output_ns + (int64_t)tick_ns;
+
+    if(hrd->PicTimingPresent)
+    {
+        if(hrd->BufferingPeriodPresent &&
+                (context->IsFirstPicture || !hrd->started))
+        {
+            hrd->started = 1;
+            hrd->base_ns = next_ns;
+            hrd->RemovalTicksNb = 0;
+            ticks = 0;
+        }
+        else if(hrd->started)
+        {
+            ticks = hrd->RemovalTicksNb + hrd->AuCpbRemovalDelayVal;
+            if(hrd->BufferingPeriodPresent)
+                hrd->RemovalTicksNb = ticks;
+        }
+        else
+            goto done;
+        output_ns = hrd->base_ns +
+                    (int64_t)((ticks + hrd->PicDpbOutputDelay) * tick_ns);
+    }
+    else if(vui->poc_proportional_to_timing_flag)
+    {
+        if((pi->RAPPicFlag && context->NoRaslOutputFlag) || !hrd->started)
+        {
+            hrd->started = 1;
+            hrd->base_ns = next_ns;
+            hrd->base_poc = pi->CurrPicOrderCntVal;
+        }
+        output_ns = hrd->base_ns + (int64_t)(
+                        (double)(pi->CurrPicOrderCntVal - hrd->base_poc) *
+                        (vui->num_ticks_poc_diff_one_minus1 + 1) * tick_ns);
+    }
+
+    if(output_ns > hrd->last_output_ns)
+        hrd->last_output_ns = output_ns;
+done:
+    hrd->BufferingPeriodPresent = 0;
+    hrd->PicTimingPresent = 0;
+    return output_ns;
+}
+
+/*
+   The render stage: VdpDecoderRender and C.3.3 picture output.
+
+   Runs either inline, right after a picture has been parsed, or on its own
+   thread, fed through a hevc_picture_queue.
+ */
+typedef struct _hevc_renderer
+{
+    /* Pipelined mode only. */
+    hevc_picture_queue queue;
+    pthread_t thread;
+    uint8_t running;
+    atomic_int quit;
+} hevc_renderer;
+
+struct _hevc_session
+{
+    hevc_session_options options;
+
+    hevc_nal_index index;
+    hevc_access_unit au;
+    /* Next NAL unit to parse. */
+    uint32_t n;
+    int nals;
+    int32_t frame;
+    uint8_t done;
+    /* options.seek_*: where decoding starts, until the parameter sets of
+       it have been parsed. */
+    hevc_seek_index seek;
+    const hevc_seek_point *seek_point;
+    /* Skip the RASL pictures of IRAP pictures with NoRaslOutputFlag. */
+    uint8_t skip_rasl;
+    /* Pictures picture_is_decoded() said no to. */
+    uint32_t skipped;
+    /* Error resilience: from an error until a picture is decoded again. */
+    uint8_t recovering;
+    uint64_t recovery_start_ns;
+
+    GstH265Parser* parser;
+    GstH265NalUnit* nalu;
+    GstH265SliceHdr* slice;
+    GstH265VPS* vps;
+    GstH265SPS* sps;
+    GstH265PPS* pps;
+    GstH265SEIMessage* sei;
+    VdpPictureInfoHEVC infoHEVC;
+    hevc_decoder_context context;
+
+    unsigned short vid_width, vid_height;
+    VdpDecoder decoder;
+    /* The decoder is only replaced when a stream needs a bigger one. */
+    VdpDecoderProfile decoder_profile;
+    uint32_t decoder_width, decoder_height;
+    /* Where scratch_frames[] come from, and go back to. */
+    hevc_surface_pool *pool;
+    hevc_surface_pool own_pool;
+    hevc_surface_format surface_format;
+    /* Every 8.3.3 generated picture, filled once per surface format. */
+    VdpVideoSurface unavailable_surface;
+    /*
+       Created on first use, at the size of the first window. Each one is
+       re-created at the new size once it is idle after a resize.
+     */
+    VdpOutputSurface outputSurfaces[NUM_OUTPUT_SURFACES];
+    uint32_t outputSurfaceWidth[NUM_OUTPUT_SURFACES];
+    uint32_t outputSurfaceHeight[NUM_OUTPUT_SURFACES];
+    /* With -trace: when the picture shown in each one was decoded. */
+    uint64_t outputSurfaceDecodeTime[NUM_OUTPUT_SURFACES];
+    int32_t outputSurfacePoc[NUM_OUTPUT_SURFACES];
+    VdpVideoMixer videoMixer;
+    uint32_t displayFrameNumber;
+    /* Width << 32 | height, see hevc_session_set_window_size(). */
+    _Atomic uint64_t windowSize;
+    /* The window and video size outRect and outRectVid are for. */
+    uint32_t outWidth, outHeight;
+    uint32_t outVidWidth, outVidHeight;
+    VdpRect outRect;
+    VdpRect outRectVid;
+    VdpTime gtime;
+    /* With output times: the VdpTime of output time 0, once anchored. */
+    VdpTime time_base;
+    uint8_t time_base_valid;
+    /* Presentation period of the pictures parsed now, see begin_job(). */
+    uint64_t period;
+    /* How long a mixer render and present took lately, in ns. */
+    uint64_t present_ns;
+#if DEBUG_TIMES
+    /* What each of outputSurfaces[] was last scheduled for. */
+    hevc_surface_times surface_times[NUM_OUTPUT_SURFACES];
+    uint8_t is_stream_start;
+    VdpTime stream_start_time;
+#endif
+
+    hevc_renderer renderer;
+    hevc_picture_job serial_job;
+    /*
+       options.loop: the jobs of the first pass, replayed by the later
+       ones. Output times are offset by replay_span_ns per pass, as if the
+       stream had been parsed again.
+     */
+    hevc_replay_cache replay;
+    int64_t replay_span_ns;
+    int64_t replay_offset_ns;
+
+    /*
+       hevc_session_pull_frame() only: serial_job is waiting to be handed
+       out, up to output[next_output].
+     */
+    uint8_t pull;
+    uint8_t pending;
+    uint8_t rendered;
+    uint8_t next_output;
+    uint32_t output_number;
+    /* When the picture in each DPB entry was decoded. */
+    uint64_t decode_time[HEVC_MAX_REFERENCES];
+    /* options.yuv_writer only: the cropping window of each DPB entry. */
+    VdpRect crop[HEVC_MAX_REFERENCES];
+
+    /*
+       options.frame_callback only: counts hevc_session_release_frame().
+       Exported frames of an earlier picture size are detached from the
+       DPB, and go to the pool once released.
+     */
+    pthread_mutex_t export_lock;
+    pthread_cond_t export_released;
+    uint32_t releases;
+    VdpVideoSurface detached[2 * HEVC_MAX_REFERENCES];
+    hevc_surface_format detached_format[2 * HEVC_MAX_REFERENCES];
+    uint8_t num_detached;
+
+    hevc_bench bench;
+};
+
+/* Creates outputSurfaces[slot] at the size of the window, cleared. */
+static VdpOutputSurface CreateOutputSurface(hevc_session *s, int slot)
+{
+    VdpStatus vdp_st;
+
+    vdp_st = vdp_output_surface_create(
+                 /* inputs */
+                 vdp_device, /* device */
+                 s->options.bits_10 ?
+                 VDP_RGBA_FORMAT_R10G10B10A2 :
+                 VDP_RGBA_FORMAT_B8G8R8A8, /* rgba_format */
+                 s->outWidth, /* width */
+                 s->outHeight, /* height */
+                 /* output */
+                 &s->outputSurfaces[slot] /* surface */
+             );
+    CHECK_STATE
+    vdp_st = vdp_output_surface_render_output_surface(
+                 s->outputSurfaces[slot], /* destination_surface */
+                 NULL, /* destination_rect */
+                 VDP_INVALID_HANDLE, /* source_surface */
+                 NULL, /* source_rect */
+                 NULL, /* colors */
+                 NULL, /* blend_state */
+                 0 /* flags */
+             );
+    CHECK_STATE
+    s->outputSurfaceWidth[slot] = s->outWidth;
+    s->outputSurfaceHeight[slot] = s->outHeight;
+
+    return s->outputSurfaces[slot];
+}
+
+/*
+   With -trace, keeps the time from the VdpDecoderRender of the picture that
+   was in output surface slot to its first presentation, as a
+   "decode_to_display" span. That is not how long the GPU took to decode
+   it: it also covers the presentation schedule, the 1/4 s head start, -f
+   or HRD pacing and vsync included. VDPAU can not tell when decoding is
+   done by itself.
+ */
+static void TraceDecodeToDisplay(
+    hevc_session *s,
+    int slot,
+    VdpTime displayed_at)
+{
+    VdpStatus vdp_st;
+    VdpTime vdp_now;
+    uint64_t now, decoded_at;
+
+    decoded_at = s->outputSurfaceDecodeTime[slot];
+    s->outputSurfaceDecodeTime[slot] = 0;
+    if (!decoded_at || !displayed_at)
+    {
+        return;
+    }
+
+    /* VdpTime has a clock of its own. */
+    vdp_st = vdp_presentation_queue_get_time(
+                 vdp_flip_queue[s->options.first_win], &vdp_now);
+    CHECK_STATE
+    now = hevc_bench_now();
+    if (displayed_at > vdp_now || now - (vdp_now - displayed_at) < decoded_at)
+    {
+        return;
+    }
+
+    hevc_trace_add_async("decode_to_display", decoded_at, now - (vdp_now - displayed_at),
+                         s->outputSurfacePoc[slot], TRACE_NO_NAL_TYPE);
+}
+
+static VdpOutputSurface WaitForSurface(hevc_session *s)
+{
+    VdpOutputSurface outputSurface;
+    VdpStatus vdp_st;
+    VdpTime displayed_at;
+    VdpPresentationQueueStatus status;
+    int i, slot;
+#if DEBUG_TIMES
+    hevc_surface_times *times =
+        &s->surface_times[s->displayFrameNumber % NUM_OUTPUT_SURFACES];
+#endif
+
+    slot = s->displayFrameNumber % NUM_OUTPUT_SURFACES;
+    outputSurface = s->outputSurfaces[slot];
+    s->displayFrameNumber++;
+
+    if (outputSurface == VDP_INVALID_HANDLE)
+    {
+        return CreateOutputSurface(s, slot);
+    }
+
+    for (i = s->options.first_win; i < s->options.first_win + s->options.num_wins; i++)
+    {
+        vdp_st = vdp_presentation_queue_block_until_surface_idle(
+                     /* inputs */
+                     vdp_flip_queue[i], /* presentation_queue */
+                     outputSurface, /* surface */
+                     /* output */
+                     &displayed_at /* first_presentation_time */
+                 );
+        CHECK_STATE
+    }
+
+    if (hevc_trace_enabled)
+    {
+        TraceDecodeToDisplay(s, slot, displayed_at);
+    }
+
+    /* The oldest surface is never the one on screen, so it can go. */
+    if (s->outputSurfaceWidth[slot] != s->outWidth ||
+            s->outputSurfaceHeight[slot] != s->outHeight)
+    {
+        vdp_st = vdp_output_surface_destroy(outputSurface);
+        CHECK_STATE
+        return CreateOutputSurface(s, slot);
+    }
+
+    vdp_st = vdp_presentation_queue_query_surface_status(
+                 /* inputs */
+                 vdp_flip_queue[s->options.first_win], /* presentation_queue */
+                 outputSurface, /* surface */
+                 /* outputs */
+                 &status, /* status */
+                 &displayed_at /* first_presentation_time */
+             );
+    CHECK_STATE
+
+#if DEBUG_TIMES
+    if (
+        (DEBUG_TIMES & DEBUG_TIMES_PRINT_DISPLAYED_AT)
+        ||
+        (
+            (DEBUG_TIMES & DEBUG_TIMES_PRINT_DISPLAYED_AT_LATE)
+            &&
+            times->schedule_time
+            &&
+            (displayed_at > times->schedule_time)
+        )
+    )
+    {
+        HEVC_LOG_INFO(
+            "Displayed %u at %" PRIu64 " (+%" PRId64 ") [%d]\n",
+            outputSurface,
+            displayed_at,
+            (int64_t)(displayed_at - times->schedule_time),
+            (int)status
+        );
+    }
+#endif
+
+#if DEBUG_TIMES & DEBUG_TIMES_PRINT_STREAM_TIME
+    if (times->is_start_of_stream)
+    {
+        s->stream_start_time = displayed_at;
+        times->is_start_of_stream = 0;
+    }
+
+    if (times->is_end_of_stream)
+    {
+        double elapsed = (double)displayed_at - (double)s->stream_start_time;
+
+        HEVC_LOG_INFO("Display took  %f seconds\n", elapsed * 1e-9);
+
+        times->is_end_of_stream = 0;
+    }
+#endif
+
+    return outputSurface;
+}
+
+static void RecalcOutputRect(hevc_session *s)
+{
+    uint32_t screenWidth, screenHeight;
+    float vidAspect, monAspect, factor;
+    uint64_t windowSize;
+
+    /*
+       Only a new window size, from hevc_session_set_window_size(), or a
+       new picture size change the rectangles.
+     */
+    windowSize = atomic_load(&s->windowSize);
+    screenWidth = windowSize >> 32;
+    screenHeight = (uint32_t) windowSize;
+    if (!screenWidth || !screenHeight)
+    {
+        screenWidth = s->vid_width;
+        screenHeight = s->vid_height;
+    }
+    if (screenWidth == s->outWidth && screenHeight == s->outHeight &&
+            s->vid_width == s->outVidWidth && s->vid_height == s->outVidHeight)
+    {
+        return;
+    }
+    s->outWidth = screenWidth;
+    s->outHeight = screenHeight;
+    s->outVidWidth = s->vid_width;
+    s->outVidHeight = s->vid_height;
+
+    s->outRect.x0 = 0;
+    s->outRect.x1 = screenWidth;
+    s->outRect.y0 = 0;
+    s->outRect.y1 = screenHeight;
+
+    /* This is not the right way to get the aspect ratios */
+    vidAspect = (float)s->vid_width / (float)s->vid_height;
+    monAspect = (float)screenWidth / (float)screenHeight;
+
+    if(vidAspect > monAspect)    /* letter box */
+    {
+        factor = (1.0 - (monAspect / vidAspect)) * 0.5;
+        factor *= (float)screenHeight;
+
+        s->outRectVid.x0 = 0;
+        s->outRectVid.x1 = screenWidth;
+        s->outRectVid.y0 = factor;
+        s->outRectVid.y1 = screenHeight - factor;
+    }
+    else
+    {
+        factor = (1.0 - (vidAspect / monAspect)) * 0.5;
+        factor *= (float)screenWidth;
+
+        s->outRectVid.x0 = factor;
+        s->outRectVid.x1 = screenWidth - factor;
+        s->outRectVid.y0 = 0;
+        s->outRectVid.y1 = screenHeight;
+    }
+}
+
+/*
+   The earliest presentation time of the next picture: one period after the
+   previous one, starting 1/4 s from now. 0 to present as soon as possible.
+   A picture with an output time (options.hrd_timing) is scheduled at that,
+   from where the first such picture would have been scheduled instead.
+ */
+static VdpTime SchedulePicture(
+    hevc_session *s,
+    uint64_t period,
+    int64_t output_time)
+{
+    VdpStatus vdp_st;
+#if DEBUG_TIMES & DEBUG_TIMES_PRINT_SCHEDULED_AT
+    VdpTime last_time = s->gtime;
+#endif
+
+    if (!period)
+    {
+        return 0;
+    }
+
+    if (!s->gtime)
+    {
+        /* have it start in 1/4 sec */
+        vdp_st = vdp_presentation_queue_get_time(
+                     /* input */
+                     vdp_flip_queue[s->options.first_win], /* presentation_queue */
+                     /* output */
+                     &s->gtime /* current_time */
+                 );
+        CHECK_STATE
+        s->gtime += 250000000;
+#if DEBUG_TIMES & DEBUG_TIMES_PRINT_SCHEDULED_AT
+        last_time = s->gtime;
+#endif
+    }
+    else
+    {
+        s->gtime += period;
+    }
+
+    if (output_time >= 0)
+    {
+        if (!s->time_base_valid)
+        {
+            s->time_base = s->gtime - output_time;
+            s->time_base_valid = 1;
+        }
+        s->gtime = s->time_base + output_time;
+    }
+
+#if DEBUG_TIMES & DEBUG_TIMES_PRINT_SCHEDULED_AT
+    HEVC_LOG_INFO(
+        "Schedule  %u at %" PRIu64 " (+%" PRId64 ")\n",
+        s->displayFrameNumber,
+        s->gtime,
+        (int64_t)(s->gtime - last_time)
+    );
+#endif
+
+    return s->gtime;
+}
+
+/*
+   Whether a picture scheduled for this_time should be dropped: it would only
+   be ready after that, going by present_ns, and it has a *_N nal_unit_type.
+   Dropping it saves the mixer render and the present. Nothing refers to
+   the output surface of a picture, so the picture may well be a reference
+   picture of a higher sub-layer. If a picture that has to be shown is very
+   late instead, the schedule starts over from now, instead of leaving every
+   picture after it late as well.
+ */
+static int DropLatePicture(
+    hevc_session *s,
+    VdpTime this_time,
+    uint64_t period,
+    uint8_t droppable)
+{
+    VdpTime now;
+    VdpStatus vdp_st;
+
+    if (!this_time)
+    {
+        return 0;
+    }
+
+    vdp_st = vdp_presentation_queue_get_time(
+                 /* input */
+                 vdp_flip_queue[s->options.first_win], /* presentation_queue */
+                 /* output */
+                 &now /* current_time */
+             );
+    CHECK_STATE
+
+    if (now + s->present_ns <= this_time)
+    {
+        return 0;
+    }
+
+    s->bench.late_pictures++;
+#if DEBUG_TIMES & DEBUG_TIMES_PRINT_DISPLAYED_AT_LATE
+    HEVC_LOG_INFO(
+        "Late      %u by %" PRId64 "%s\n",
+        s->displayFrameNumber,
+        (int64_t)(now + s->present_ns - this_time),
+        droppable ? ", dropped" : ""
+    );
+#endif
+    if (droppable)
+    {
+        s->bench.dropped_pictures++;
+        return 1;
+    }
+    if (now > this_time + RESYNC_PERIODS * period)
+    {
+        s->time_base += now + s->present_ns - this_time;
+        s->gtime = now + s->present_ns;
+    }
+
+    return 0;
+}
+
+static void Flip(
+    hevc_session *s,
+    VdpOutputSurface outputSurface,
+    VdpTime this_time
+)
+{
+    VdpStatus vdp_st;
+    int i;
+#if DEBUG_TIMES
+    hevc_surface_times *times =
+        &s->surface_times[(s->displayFrameNumber - 1) % NUM_OUTPUT_SURFACES];
+
+    if (s->is_stream_start)
+    {
+        times->is_start_of_stream = 1;
+        s->is_stream_start = 0;
+    }
+    times->schedule_time = this_time;
+#endif
+
+    for (i = s->options.first_win; i < s->options.first_win + s->options.num_wins; i++)
+    {
+        vdp_st = vdp_presentation_queue_display(
+                     vdp_flip_queue[i], /* presentation_queue */
+                     outputSurface, /* surface */
+                     s->outRect.x1, /* clip_width */
+                     s->outRect.y1, /* clip_height */
+                     this_time /* earliest_presentation_time */
+                 );
+        CHECK_STATE
+    }
+}
+
+static void MoveQueue(hevc_decoder_context *context)
+{
+    int i;
+
+    if (context->displayQueue[0] != -1)
+    {
+        context->inUse[context->displayQueue[0]] &= ~QUEUED_FOR_DISPLAY;
+    }
+
+    for (i = 0; i < ARSIZE(context->displayQueue) - 1; i++)
+    {
+        context->displayQueue[i] = context->displayQueue[i+1];
+        context->displayPicOrderCnt[i] = context->displayPicOrderCnt[i+1];
+        context->displayDroppable[i] = context->displayDroppable[i+1];
+        context->displayOutputTime[i] = context->displayOutputTime[i+1];
+    }
+
+    context->displayQueue[ARSIZE(context->displayQueue)-1] = -1;
+}
+
+/* Presents output i of the job. */
+static void DisplayFrame(hevc_session *s, const hevc_picture_job *job, int i)
+{
+    VdpVideoSurface videoSurface = job->output[i];
+    VdpOutputSurface outputSurface;
+    VdpStatus vdp_st;
+    VdpTime this_time;
+    uint64_t t0, start;
+    int slot;
+
+    this_time = SchedulePicture(s, job->period, job->output_time[i]);
+    if (DropLatePicture(s, this_time, job->period, job->output_droppable[i]))
+    {
+        return;
+    }
+
+    t0 = hevc_bench_begin(&s->bench);
+    RecalcOutputRect(s);
+    outputSurface = WaitForSurface(s);
+    hevc_bench_end(&s->bench, BENCH_STAGE_PRESENT, t0);
+
+    if (hevc_trace_enabled)
+    {
+        slot = (s->displayFrameNumber - 1) % NUM_OUTPUT_SURFACES;
+        s->outputSurfaceDecodeTime[slot] =
+            s->decode_time[job->output_index[i]];
+        s->outputSurfacePoc[slot] = job->output_poc[i];
+    }
+
+    start = t0 = hevc_bench_now();
+
+    /*
+
+       VDPAU implementations must allow VDP_VIDEO_MIXER_PICTURE_STRUCTURE_FRAME
+       to work correctly here. Players should not need to use a hack here by
+       declaring this frame to be a top or bottom field.
+
+       For VDPAU HEVC decoding, video_surface_past and video_surface_future
+       should be NULL for progressive frames. Presentation of interlaced
+       frames will work as for formats with native interlaced decoding but
+       note that each field will be an HEVC frame in its own right.
+
+     */
+
+    vdp_st = vdp_video_mixer_render(
+                 s->videoMixer, /* mixer */
+                 VDP_INVALID_HANDLE, /* background_surface */
+                 0, /* background_source_rect */
+                 /* current_picture_structure*/
+                 VDP_VIDEO_MIXER_PICTURE_STRUCTURE_FRAME,
+                 0, /* video_surface_past_count */
+                 NULL, /* video_surface_past */
+                 videoSurface, /* video_surface_current */
+                 0, /* video_surface_future_count */
+                 NULL, /* video_surface_future */
+                 NULL, /* video_source_rect */
+                 outputSurface, /* destination_surface */
+                 &s->outRect, /* destination_rect */
+                 &s->outRectVid, /* destination_video_rect */
+                 0, /* layer_count */
+                 NULL /* layers */
+             );
+    CHECK_STATE
+    hevc_bench_end(&s->bench, BENCH_STAGE_MIX, t0);
+
+    t0 = hevc_bench_begin(&s->bench);
+    Flip(s, outputSurface, this_time);
+    hevc_bench_end(&s->bench, BENCH_STAGE_PRESENT, t0);
+
+    /* Weighs the last eight pictures the most. */
+    t0 = hevc_bench_now() - start;
+    s->present_ns = s->present_ns ? (7 * s->present_ns + t0) / 8 : t0;
+}
+
+static void CreateVideoMixer(hevc_session *s)
+{
+    VdpStatus vdp_st;
+
+    {
+        // Order is important in code below, where enables are set.
+        VdpVideoMixerFeature features[] =
+        {
+            VDP_VIDEO_MIXER_FEATURE_NOISE_REDUCTION,
+            VDP_VIDEO_MIXER_FEATURE_SHARPNESS,
+            VDP_VIDEO_MIXER_FEATURE_INVERSE_TELECINE,
+            VDP_VIDEO_MIXER_FEATURE_DEINTERLACE_TEMPORAL,
+            VDP_VIDEO_MIXER_FEATURE_DEINTERLACE_TEMPORAL_SPATIAL
+        };
+        VdpBool feature_enables[] =
+        {
+            VDP_FALSE,
+            VDP_FALSE,
+            VDP_FALSE,
+            VDP_FALSE,
+            VDP_FALSE
+        };
+
+        uint32_t vdp_width = s->vid_width;
+        uint32_t vdp_height = s->vid_height;
+        VdpChromaType vdp_chroma_type = s->surface_format.chroma_type;
+
+        VdpVideoMixerParameter parameters[] =
+        {
+            VDP_VIDEO_MIXER_PARAMETER_VIDEO_SURFACE_WIDTH,
+            VDP_VIDEO_MIXER_PARAMETER_VIDEO_SURFACE_HEIGHT,
+            VDP_VIDEO_MIXER_PARAMETER_CHROMA_TYPE
+        };
+        void const * parameter_values[ARSIZE(parameters)] =
+        {
+            &vdp_width,
+            &vdp_height,
+            &vdp_chroma_type
+        };
+
+        vdp_st = vdp_video_mixer_create(
+                     vdp_device,
+                     ARSIZE(features),
+                     features,
+                     ARSIZE(parameters),
+                     parameters,
+                     parameter_values,
+                     &s->videoMixer
+                 );
+        CHECK_STATE
+
+        vdp_st = vdp_video_mixer_set_feature_enables(
+                     s->videoMixer, /* mixer */
+                     ARSIZE(features), /* feature_count */
+                     features, /* features */
+                     feature_enables /* feature_enables */
+                 );
+        CHECK_STATE
+    }
+
+    if (s->options.csc)
+    {
+        VdpCSCMatrix matrix;
+        VdpProcamp procamp =
+        {
+            VDP_PROCAMP_VERSION,
+            s->options.cscBrightness,
+            s->options.cscContrast,
+            s->options.cscSaturation,
+            s->options.cscHue
+        };
+        VdpVideoMixerAttribute attributes[] =
+        {
+            VDP_VIDEO_MIXER_ATTRIBUTE_CSC_MATRIX
+        };
+        const void *attribute_values[] = { &matrix };
+
+        vdp_st = vdp_generate_csc_matrix(
+                     /* inputs */
+                     &procamp, /* procamp */
+                     /* standard */
+                     VDP_COLOR_STANDARD_ITUR_BT_601,
+                     &matrix /* csc_matrix */
+                 );
+        CHECK_STATE
+
+        vdp_st = vdp_video_mixer_set_attribute_values(
+                     s->videoMixer, /* mixer */
+                     1, /* attribute_count */
+                     attributes, /* attributes */
+                     attribute_values /* attribute_values */
+                 );
+        CHECK_STATE
+    }
+}
+
+static void DestroyVideoMixer(hevc_session *s)
+{
+    VdpStatus vdp_st;
+
+    if(s->videoMixer == VDP_INVALID_HANDLE)
+        return;
+
+    vdp_st = vdp_video_mixer_destroy(
+                 s->videoMixer
+             );
+    CHECK_STATE
+    s->videoMixer = VDP_INVALID_HANDLE;
+}
+
+/*
+   Replaces the decoder if the stream needs a higher profile or a bigger
+   picture size than it was created for. Otherwise it is kept, smaller
+   pictures decode just as well.
+ */
+static void UpdateDecoder(
+    hevc_session *s,
+    VdpDecoderProfile profile,
+    uint32_t width,
+    uint32_t height)
+{
+    VdpStatus vdp_st;
+
+    if(s->decoder != VDP_INVALID_HANDLE)
+    {
+        if(s->decoder_profile == VDP_DECODER_PROFILE_HEVC_MAIN_10)
+            profile = VDP_DECODER_PROFILE_HEVC_MAIN_10;
+        if(profile == s->decoder_profile &&
+                width <= s->decoder_width && height <= s->decoder_height)
+            return;
+
+        width = width > s->decoder_width ? width : s->decoder_width;
+        height = height > s->decoder_height ? height : s->decoder_height;
+        vdp_st = vdp_decoder_destroy(
+                     s->decoder
+                 );
+        CHECK_STATE
+    }
+
+    vdp_st = vdp_decoder_create(
+                 /* inputs */
+                 vdp_device, /* device */
+                 profile, /* profile */
+                 width, /* width */
+                 height, /* height */
+                 HEVC_MAX_REFERENCES, /* max_references */
+                 /* output */
+                 &s->decoder
+             );
+    CHECK_STATE
+    s->decoder_profile = profile;
+    s->decoder_width = width;
+    s->decoder_height = height;
+}
+
+/*
+   Takes a surface from the pool for the next scratch frame. Without VDPAU,
+   the DPB only needs a handle other than VDP_INVALID_HANDLE there.
+ */
+static void AllocateScratchFrame(hevc_session *s)
+{
+    hevc_decoder_context *context = &s->context;
+    int i = context->num_scratch_frames;
+    VdpStatus vdp_st;
+
+    if(s->options.use_vdpau)
+    {
+        vdp_st = hevc_surface_pool_get(
+                     s->pool,
+                     &s->surface_format,
+                     &context->scratch_frames[i]);
+        CHECK_STATE
+    }
+    else
+        context->scratch_frames[i] = 0;
+    /* init surface accounting */
+    context->serialNumbers[i] = 0;
+    context->inUse[i] = 0;
+    context->num_scratch_frames++;
+}
+
+/*
+   Hands every scratch frame back to the pool. The DPB must be empty.
+   Frames a consumer still holds are detached instead, which waits for
+   releases while there might not be room for all of them.
+ */
+static void ReleaseScratchFrames(hevc_session *s)
+{
+    hevc_decoder_context *context = &s->context;
+    int i;
+
+    pthread_mutex_lock(&s->export_lock);
+    while(s->num_detached > ARSIZE(s->detached) - HEVC_MAX_REFERENCES)
+        pthread_cond_wait(&s->export_released, &s->export_lock);
+    while(context->num_scratch_frames > 0)
+    {
+        i = --context->num_scratch_frames;
+        if(context->inUse[i] & HELD_BY_CONSUMER)
+        {
+            context->inUse[i] &= ~HELD_BY_CONSUMER;
+            s->detached[s->num_detached] = context->scratch_frames[i];
+            s->detached_format[s->num_detached++] = s->surface_format;
+        }
+        else
+        {
+            hevc_surface_pool_put(
+                s->pool,
+                &s->surface_format,
+                context->scratch_frames[i]);
+        }
+        context->scratch_frames[i] = VDP_INVALID_HANDLE;
+    }
+    pthread_mutex_unlock(&s->export_lock);
+
+    if(s->unavailable_surface != VDP_INVALID_HANDLE)
+    {
+        hevc_surface_pool_put(s->pool, &s->surface_format,
+                              s->unavailable_surface);
+        s->unavailable_surface = VDP_INVALID_HANDLE;
+    }
+}
+
+/*
+   8.3.3.2 Generation of one unavailable picture
+
+   Every generated picture has all of its samples set to 1 << (BitDepth - 1),
+   so they all alias one surface of the current format, which is filled
+   once. Returns VDP_INVALID_HANDLE for chroma formats PutBits can not fill.
+ */
+static VdpVideoSurface GetUnavailableSurface(hevc_session *s)
+{
+    const hevc_surface_format *format = &s->surface_format;
+    VdpYCbCrFormat ycbcr_format;
+    uint32_t pitch, i;
+    uint16_t *samples;
+    void *data;
+    const void *source_data[2];
+    uint32_t source_pitches[2];
+    VdpStatus vdp_st;
+
+    if(!s->options.use_vdpau)
+        return 0;
+    if(s->unavailable_surface != VDP_INVALID_HANDLE)
+        return s->unavailable_surface;
+    if(!hevc_surface_format_is_420(format))
+    {
+        HEVC_LOG_WARNING("WARNING: Unavailable pictures are only generated "
+                         "for 4:2:0.\n");
+        return VDP_INVALID_HANDLE;
+    }
+
+    /*
+       Luma and CbCr rows are the same size, so both planes come from the
+       one buffer. The high bit of each sample is mid-gray for any depth:
+       0x80 in NV12, 0x8000 in P010 and P016, which keep the bits at the top.
+     */
+    pitch = format->bit_depth > 8 ? format->width * 2 : format->width;
+    data = malloc((size_t)pitch * format->height);
+    if(data == NULL)
+        return VDP_INVALID_HANDLE;
+    if(format->bit_depth > 8)
+    {
+        ycbcr_format = format->bit_depth > 10 ?
+                       VDP_YCBCR_FORMAT_P016 : VDP_YCBCR_FORMAT_P010;
+        samples = data;
+        for(i = 0; i < format->width * format->height; i++)
+            samples[i] = 0x8000;
+    }
+    else
+    {
+        ycbcr_format = VDP_YCBCR_FORMAT_NV12;
+        memset(data, 0x80, (size_t)pitch * format->height);
+    }
+    source_data[0] = data;
+    source_data[1] = data;
+    source_pitches[0] = pitch;
+    source_pitches[1] = pitch;
+
+    vdp_st = hevc_surface_pool_get(s->pool, format, &s->unavailable_surface);
+    CHECK_STATE
+    vdp_st = vdp_video_surface_put_bits_y_cb_cr(
+                 s->unavailable_surface,
+                 ycbcr_format,
+                 source_data,
+                 source_pitches);
+    CHECK_STATE
+    free(data);
+
+    return s->unavailable_surface;
+}
+
+/*
+   Error resilience: the NAL unit at s->n, or the picture it starts, is
+   broken. Returns -1 unless options.resilient. Otherwise the error is
+   counted, and pictures are only decoded again from an IRAP picture, or
+   from one with all of its references, see references_are_available().
+ */
+static int begin_recovery(hevc_session *s, const char *what)
+{
+    if(!s->options.resilient)
+        return -1;
+
+    s->bench.errors++;
+    HEVC_LOG_WARNING("WARNING: %s at NAL unit %u, resynchronizing.\n",
+                     what, s->n);
+    if(!s->recovering)
+    {
+        s->recovering = 1;
+        s->recovery_start_ns = hevc_bench_now();
+    }
+    return 0;
+}
+
+/* A picture was decoded again after an error. */
+static void end_recovery(hevc_session *s)
+{
+    uint64_t ns = hevc_bench_now() - s->recovery_start_ns;
+
+    s->recovering = 0;
+    s->bench.recoveries++;
+    s->bench.recovery_ns += ns;
+    if(ns > s->bench.max_recovery_ns)
+        s->bench.max_recovery_ns = ns;
+    HEVC_LOG_INFO("Recovered at picture %d, after %.3f ms.\n",
+                  s->frame, ns * 1e-6);
+}
+
+/*
+   8.3.3.2 Generates one unavailable picture with the POC the RPS asked
+   for, into *entry, which is "no reference picture". It takes a DPB entry
+   of its own, and is never output. Returns -1 if it can not be generated.
+ */
+static int generate_unavailable_picture(
+    hevc_session *s,
+    int8_t *entry,
+    int32_t poc,
+    int long_term)
+{
+    VdpPictureInfoHEVC *pi = &s->infoHEVC;
+    hevc_decoder_context *context = &s->context;
+    int MaxPicOrderCntLsb = 1<<(pi->log2_max_pic_order_cnt_lsb_minus4 + 4);
+    VdpVideoSurface surface;
+
+    surface = GetUnavailableSurface(s);
+    if(surface == VDP_INVALID_HANDLE)
+        return -1;
+    /* (8-9) and (8-10); the entry keeps its own scratch frame. */
+    *entry = get_decoded_picture_index(pi, context);
+    if(*entry < 0)
+    {
+        HEVC_LOG_ERROR("ERROR: No room for an unavailable picture\n");
+        return -1;
+    }
+    if(*entry == context->num_scratch_frames)
+        AllocateScratchFrame(s);
+    if(long_term)
+        context->dpb_reference_values[*entry] = USED_FOR_LONG_TERM_REFERENCE;
+    context->dpb_slice_pic_order_cnt_lsb[*entry] =
+        poc & (MaxPicOrderCntLsb - 1);
+    context->PicOutputFlag[*entry] = 0;
+    context->SubLayerNonReference[*entry] = 0;
+    pi->PicOrderCntVal[*entry] = poc;
+    pi->RefPics[*entry] = surface;
+    dpb_index_insert(pi, context, *entry);
+    HEVC_LOG_DEBUG("Generated unavailable picture POC %d in entry %d\n",
+                   poc, *entry);
+
+    return 0;
+}
+
+/*
+   8.3.3.1 Generates a picture for every entry of the Foll lists that is
+   "no reference picture", when the current picture is a BLA picture or a
+   CRA picture with NoRaslOutputFlag equal to 1. Its RASL pictures refer to
+   them.
+ */
+static void generate_unavailable_reference_pictures(
+    hevc_session *s,
+    GstH265NalUnit *nalu)
+{
+    hevc_decoder_context *context = &s->context;
+    int32_t poc;
+    int8_t *entry;
+    int i, n;
+
+    if(!(nalu->type == GST_H265_NAL_SLICE_BLA_W_LP ||
+            nalu->type == GST_H265_NAL_SLICE_BLA_W_RADL ||
+            nalu->type == GST_H265_NAL_SLICE_BLA_N_LP ||
+            (nalu->type == GST_H265_NAL_SLICE_CRA_NUT &&
+             context->NoRaslOutputFlag)))
+        return;
+
+    n = context->NumPocStFoll + context->NumPocLtFoll;
+    for(i = 0; i < n; i++)
+    {
+        if(i < context->NumPocStFoll)
+        {
+            entry = &context->RefPicSetStFoll[i];
+            poc = context->PocStFoll[i];
+        }
+        else
+        {
+            entry = &context->RefPicSetLtFoll[i - context->NumPocStFoll];
+            poc = context->PocLtFoll[i - context->NumPocStFoll];
+        }
+        if(*entry >= 0)
+            continue;
+        if(generate_unavailable_picture(s, entry, poc,
+                                        i >= context->NumPocStFoll) < 0)
+            return;
+    }
+}
+
+/*
+   Error resilience: whether every picture the current one refers to, in
+   RefPicSetStCurrBefore, RefPicSetStCurrAfter and RefPicSetLtCurr, is in
+   the DPB. With options.conceal, those that are not are generated like
+   8.3.3 does instead, and the picture is decoded from them. A missing
+   reference is an error of its own, unless the session is recovering
+   from one already.
+ */
+static int references_are_available(hevc_session *s)
+{
+    VdpPictureInfoHEVC *pi = &s->infoHEVC;
+    hevc_decoder_context *context = &s->context;
+    int concealed = 0;
+    int32_t poc;
+    uint8_t *ref;
+    int8_t entry;
+    int i, n;
+
+    n = pi->NumPocStCurrBefore + pi->NumPocStCurrAfter + pi->NumPocLtCurr;
+    for(i = 0; i < n; i++)
+    {
+        if(i < pi->NumPocStCurrBefore)
+        {
+            ref = &pi->RefPicSetStCurrBefore[i];
+            poc = context->PocStCurrBefore[i];
+        }
+        else if(i < pi->NumPocStCurrBefore + pi->NumPocStCurrAfter)
+        {
+            ref = &pi->RefPicSetStCurrAfter[i - pi->NumPocStCurrBefore];
+            poc = context->PocStCurrAfter[i - pi->NumPocStCurrBefore];
+        }
+        else
+        {
+            ref = &pi->RefPicSetLtCurr[
+                      i - pi->NumPocStCurrBefore - pi->NumPocStCurrAfter];
+            poc = context->PocLtCurr[
+                      i - pi->NumPocStCurrBefore - pi->NumPocStCurrAfter];
+        }
+        /* "no reference picture" is -1, stored as 0xFF. */
+        if((int8_t) *ref >= 0)
+            continue;
+
+        HEVC_LOG_DEBUG("Reference picture POC %d is missing\n", poc);
+        if(!s->recovering)
+            begin_recovery(s, "A missing reference picture");
+        if(!s->options.conceal ||
+                generate_unavailable_picture(
+                    s, &entry, poc, i >= n - pi->NumPocLtCurr) < 0)
+            return 0;
+        *ref = entry;
+        concealed = 1;
+    }
+    if(concealed)
+        s->bench.concealed_pictures++;
+
+    return 1;
+}
+
+static void DestroyVdpapiObjects(hevc_session *s)
+{
+    int i;
+    VdpStatus vdp_st;
+
+    DestroyVideoMixer(s);
+
+    for (i = 0; i < NUM_OUTPUT_SURFACES; i++)
+    {
+        if (s->outputSurfaces[i] == VDP_INVALID_HANDLE)
+        {
+            continue;
+        }
+        vdp_st = vdp_output_surface_destroy(
+                     s->outputSurfaces[i]
+                 );
+        CHECK_STATE
+        s->outputSurfaces[i] = VDP_INVALID_HANDLE;
+    }
+
+    ReleaseScratchFrames(s);
+
+    if(s->decoder != VDP_INVALID_HANDLE)
+    {
+        vdp_st = vdp_decoder_destroy(
+                     s->decoder
+                 );
+        CHECK_STATE
+        s->decoder = VDP_INVALID_HANDLE;
+    }
+
+    s->context.vdpau_initialized = 0;
+}
+
+/* Describes output i of the job, for hevc_session_pull_frame() and
+   options.frame_callback. */
+static void get_frame(
+    hevc_session *s,
+    hevc_picture_job *job,
+    int i,
+    hevc_frame *frame)
+{
+    frame->surface = job->output[i];
+    frame->width = s->vid_width;
+    frame->height = s->vid_height;
+    frame->format = s->surface_format.bit_depth > 8 ?
+                    HEVC_FRAME_FORMAT_P010 : HEVC_FRAME_FORMAT_NV12;
+    frame->dpb_index = job->output_index[i];
+    frame->poc = job->output_poc[i];
+    frame->output_number = s->output_number++;
+    frame->decode_time_ns = s->decode_time[job->output_index[i]];
+}
+
+static void output_pictures(
+    hevc_session *s,
+    hevc_picture_job *job,
+    int first,
+    int last)
+{
+    hevc_frame frame;
+    VdpStatus vdp_st;
+    uint64_t t0;
+    int i;
+
+    if(s->options.use_vdpau && s->options.do_display)
+    {
+        for(i = first; i < last; i++)
+        {
+            hevc_trace_set_picture(job->output_poc[i], TRACE_NO_NAL_TYPE);
+            DisplayFrame(s, job, i);
+        }
+    }
+
+    if(s->options.use_vdpau && s->options.yuv_writer)
+    {
+        for(i = first; i < last; i++)
+        {
+            /* Waits for the picture to be decoded, so it is traced too. */
+            hevc_trace_set_picture(job->output_poc[i], TRACE_NO_NAL_TYPE);
+            t0 = hevc_trace_begin();
+            vdp_st = hevc_yuv_writer_write(
+                         s->options.yuv_writer,
+                         job->output[i],
+                         &s->surface_format,
+                         &s->crop[job->output_index[i]]);
+            CHECK_STATE
+            hevc_trace_end("readback", t0);
+        }
+    }
+
+    /* The surfaces are handed over as they are: no mixer, no copy. */
+    if(s->options.frame_callback)
+    {
+        for(i = first; i < last; i++)
+        {
+            get_frame(s, job, i, &frame);
+            s->options.frame_callback(s->options.frame_opaque, &frame);
+        }
+    }
+}
+
+/* nal_unit_type of a slice segment, after its start code. */
+static uint8_t get_buffer_nal_type(const VdpBitstreamBuffer *buffer)
+{
+    const uint8_t *data = buffer->bitstream;
+    uint32_t i = 0;
+
+    while(i + 1 < buffer->bitstream_bytes && data[i] == 0)
+        i++;
+    return (data[i + 1] >> 1) & 0x3f;
+}
+
+/* VdpDecoderRender for the job's picture, if it has one. */
+static void decode_picture(hevc_session *s, hevc_picture_job *job)
+{
+    VdpStatus vdp_st;
+    uint64_t t0;
+
+    if(job->target_index < 0)
+        return;
+
+    hevc_trace_set_picture(job->info.CurrPicOrderCntVal,
+                           get_buffer_nal_type(&job->buffers[0]));
+    if(s->options.use_vdpau)
+    {
+        t0 = hevc_bench_begin(&s->bench);
+        vdp_st = vdp_decoder_render(
+                     s->decoder,
+                     job->target,
+                     (void*)&job->info,
+                     job->buffer_count,
+                     job->buffers
+                 );
+        CHECK_STATE
+        hevc_bench_end(&s->bench, BENCH_STAGE_DECODE, t0);
+    }
+    s->bench.pictures++;
+    if(s->pull || s->options.frame_callback || hevc_trace_enabled)
+        s->decode_time[job->target_index] = hevc_bench_now();
+    if(s->options.yuv_writer)
+        s->crop[job->target_index] = job->crop;
+}
+
+/* Returns -1 if the user asked to quit. */
+static int render_picture(hevc_session *s, hevc_picture_job *job)
+{
+    /* C.5.2.2 output before the current picture is decoded. */
+    output_pictures(s, job, 0, job->output_before);
+
+    decode_picture(s, job);
+
+    /* C.5.2.3 "bumping" right after decoding. */
+    output_pictures(s, job, job->output_before, job->output_count);
+
+    if(job->target_index < 0)
+        return 0;
+    if(s->options.delay)
+        usleep(s->options.delay);
+    else if (s->options.step)
+    {
+        printf("Press 'q' to quit, <any key> for next frame.\n");
+        if(getchar() == 'q') return -1;
+    }
+
+    return 0;
+}
+
+static void *render_thread(void *arg)
+{
+    hevc_session *s = arg;
+    hevc_renderer *renderer = &s->renderer;
+    hevc_picture_job *job;
+
+    hevc_trace_thread_name("render");
+    for(;;)
+    {
+        job = hevc_picture_queue_front(&renderer->queue);
+        if(job->end_of_stream)
+        {
+            hevc_picture_queue_pop(&renderer->queue);
+            break;
+        }
+        /* After a quit, keep draining so the producer never blocks. */
+        if(!atomic_load(&renderer->quit) &&
+                render_picture(s, job) < 0)
+            atomic_store(&renderer->quit, 1);
+        hevc_picture_queue_pop(&renderer->queue);
+    }
+
+    return NULL;
+}
+
+/*
+   Queues the end of stream, and waits until everything queued before it has
+   been rendered. The calling thread owns the session's VDPAU objects again
+   afterwards.
+ */
+static void stop_render_thread(hevc_renderer *renderer)
+{
+    hevc_picture_job *job;
+
+    if(!renderer->running)
+        return;
+
+    job = hevc_picture_queue_back(&renderer->queue);
+    job->end_of_stream = 1;
+    hevc_picture_queue_push(&renderer->queue);
+
+    pthread_join(renderer->thread, NULL);
+    renderer->running = 0;
+}
+
+/*
+   Returns the job to fill in for the next picture. In pipelined mode, this
+   starts the render thread on first use and may wait for a free slot.
+ */
+static hevc_picture_job *begin_job(hevc_session *s)
+{
+    hevc_renderer *renderer = &s->renderer;
+    hevc_picture_job *job;
+
+    if(renderer->queue.depth == 0)
+        job = &s->serial_job;
+    else
+    {
+        if(!renderer->running)
+        {
+            atomic_store(&renderer->quit, 0);
+            if(pthread_create(&renderer->thread, NULL,
+                              render_thread, s))
+            {
+                HEVC_LOG_ERROR("Error: unable to create the render thread.\n");
+                exit(1);
+            }
+            renderer->running = 1;
+        }
+        job = hevc_picture_queue_back(&renderer->queue);
+    }
+
+    job->target_index = -1;
+    job->period = s->period;
+    job->end_of_stream = 0;
+    job->output_count = 0;
+    job->output_before = 0;
+    job->buffer_count = 0;
+
+    return job;
+}
+
+/*
+   Queues or renders the job, or keeps it for hevc_session_pull_frame().
+   Returns -1 if the user asked to quit.
+ */
+static int submit_job(hevc_session *s, hevc_picture_job *job)
+{
+    if(s->pull)
+    {
+        s->pending = 1;
+        s->rendered = 0;
+        s->next_output = 0;
+        return 0;
+    }
+
+    hevc_replay_cache_record(&s->replay, job);
+
+    if(s->renderer.queue.depth == 0)
+        return render_picture(s, job);
+
+    hevc_picture_queue_push(&s->renderer.queue);
+    return 0;
+}
+
+/* Moves the pictures bumped out so far over to the job, in output order. */
+static void take_display_queue(
+    hevc_picture_job *job,
+    hevc_decoder_context *context)
+{
+    while(context->displayQueue[0] != -1 &&
+            job->output_count < PICTURE_JOB_MAX_OUTPUTS)
+    {
+        job->output_index[job->output_count] = context->displayQueue[0];
+        job->output_poc[job->output_count] = context->displayPicOrderCnt[0];
+        job->output_droppable[job->output_count] =
+            context->displayDroppable[0];
+        job->output_time[job->output_count] = context->displayOutputTime[0];
+        /* Before the parser can pick the entry for another picture. */
+        if(context->hold_outputs)
+            context->inUse[context->displayQueue[0]] |= HELD_BY_CONSUMER;
+        job->output[job->output_count++] =
+            context->scratch_frames[context->displayQueue[0]];
+        MoveQueue(context);
+    }
+}
+
+/* Outputs whatever is in the display queue, without decoding anything. */
+static int submit_display_queue(hevc_session *s)
+{
+    hevc_picture_job *job;
+
+    if(s->context.displayQueue[0] == -1)
+        return 0;
+
+    job = begin_job(s);
+    take_display_queue(job, &s->context);
+    job->release = 0;
+
+    return submit_job(s, job);
+}
+
+/*
+   Exporting sessions: how many frames were released so far. Read it before
+   looking for a free DPB entry, and wait for the next release if there is
+   none.
+ */
+static uint32_t get_releases(hevc_session *s)
+{
+    uint32_t releases;
+
+    pthread_mutex_lock(&s->export_lock);
+    releases = s->releases;
+    pthread_mutex_unlock(&s->export_lock);
+
+    return releases;
+}
+
+/*
+   Waits until a frame is released, unless one was since releases was read.
+   Returns -1 right away if the consumer holds no frames, so that no release
+   will come.
+ */
+static int wait_for_release(hevc_session *s, uint32_t releases)
+{
+    int i;
+
+    for(i = 0; i < HEVC_MAX_REFERENCES; i++)
+    {
+        if(s->context.inUse[i] & HELD_BY_CONSUMER)
+            break;
+    }
+    if(i == HEVC_MAX_REFERENCES)
+        return -1;
+
+    pthread_mutex_lock(&s->export_lock);
+    while(s->releases == releases)
+        pthread_cond_wait(&s->export_released, &s->export_lock);
+    pthread_mutex_unlock(&s->export_lock);
+
+    return 0;
+}
+
+/* The video surfaces the active SPS needs. */
+static void get_surface_format(
+    const VdpPictureInfoHEVC *pi,
+    hevc_surface_format *format)
+{
+    memset(format, 0, sizeof(*format));
+    switch(pi->chroma_format_idc)
+    {
+    case 2:
+        format->chroma_type = VDP_CHROMA_TYPE_422;
+        break;
+    case 3:
+        format->chroma_type = VDP_CHROMA_TYPE_444;
+        break;
+    default:
+        format->chroma_type = VDP_CHROMA_TYPE_420;
+        break;
+    }
+    format->width = pi->pic_width_in_luma_samples;
+    format->height = pi->pic_height_in_luma_samples;
+    format->bit_depth = 8 + (pi->bit_depth_luma_minus8 >
+                             pi->bit_depth_chroma_minus8 ?
+                             pi->bit_depth_luma_minus8 :
+                             pi->bit_depth_chroma_minus8);
+
+    /*
+       Deeper samples need surfaces of 16 bit samples, which are read and
+       written as P010 or P016. VDPAU headers before 1.2 have none, and the
+       pictures are then decoded into 8 bit surfaces, and handled as such.
+     */
+    if(format->bit_depth > 8)
+    {
+#ifdef VDP_CHROMA_TYPE_420_16
+        switch(format->chroma_type)
+        {
+        case VDP_CHROMA_TYPE_422:
+            format->chroma_type = VDP_CHROMA_TYPE_422_16;
+            break;
+        case VDP_CHROMA_TYPE_444:
+            format->chroma_type = VDP_CHROMA_TYPE_444_16;
+            break;
+        default:
+            format->chroma_type = VDP_CHROMA_TYPE_420_16;
+            break;
+        }
+#else
+        format->bit_depth = 8;
+#endif
+    }
+}
+
+/* 7.4.3.2.1 The conformance cropping window, in luma samples. */
+static void get_conformance_window(const GstH265SPS *sps, VdpRect *crop)
+{
+    uint32_t sub_width = sps->chroma_format_idc == 1 ||
+                         sps->chroma_format_idc == 2 ? 2 : 1;
+    uint32_t sub_height = sps->chroma_format_idc == 1 ? 2 : 1;
+
+    crop->x0 = 0;
+    crop->y0 = 0;
+    crop->x1 = sps->pic_width_in_luma_samples;
+    crop->y1 = sps->pic_height_in_luma_samples;
+    if(sps->conformance_window_flag)
+    {
+        crop->x0 += sub_width * sps->conf_win_left_offset;
+        crop->x1 -= sub_width * sps->conf_win_right_offset;
+        crop->y0 += sub_height * sps->conf_win_top_offset;
+        crop->y1 -= sub_height * sps->conf_win_bottom_offset;
+    }
+}
+
+/*
+   E.3.1 The presentation period for one picture per clock tick of the VUI
+   timing information, or period if the SPS has none.
+ */
+static uint64_t get_vui_period(const GstH265SPS *sps, uint64_t period)
+{
+    const GstH265VUIParams *vui = &sps->vui_params;
+
+    if(!sps->vui_parameters_present_flag ||
+            !vui->timing_info_present_flag ||
+            !vui->num_units_in_tick || !vui->time_scale)
+        return period;
+
+    return (uint64_t)vui->num_units_in_tick * 1000000000ull / vui->time_scale;
+}
+
+/*
+   Fits the decoder, scratch frames and video mixer to the SPS the current
+   picture activated. Only the first picture of a coded video sequence can
+   change the surface format. Its scratch frames then go back to the pool,
+   once the prior pictures are out. Returns 0, 1 if those have to be handed
+   out by hevc_session_pull_frame() first, or -1 on errors.
+ */
+static int UpdateVdpapiObjects(hevc_session *s, GstH265SliceHdr *slice)
+{
+    VdpPictureInfoHEVC *pi = &s->infoHEVC;
+    hevc_decoder_context *context = &s->context;
+    hevc_surface_format format;
+    int i;
+
+    /* Output surfaces are only created once there is something to
+       show, see WaitForSurface(). */
+    context->vdpau_initialized = 1;
+
+    get_surface_format(pi, &format);
+    if(context->num_scratch_frames &&
+            !hevc_surface_format_equal(&format, &s->surface_format))
+    {
+        /* Recorded jobs refer to the surfaces about to go. */
+        hevc_replay_cache_disable(&s->replay);
+        /*
+           C.5.2.2 allows prior pictures to be dropped when the picture size
+           changes, but recommends against it. Output them as usual, unless
+           the IRAP picture asks not to, out of the surfaces they are in.
+         */
+        if(!slice->no_output_of_prior_pics_flag)
+            flush_dpb(pi, context);
+        if(submit_display_queue(s) < 0)
+            return -1;
+        if(s->pending)
+            return 1;
+        stop_render_thread(&s->renderer);
+
+        for(i = 0; i < HEVC_MAX_REFERENCES; i++)
+        {
+            if(pi->RefPics[i] != VDP_INVALID_HANDLE)
+                empty_picture_storage_buffer(pi, context, i);
+        }
+        ReleaseScratchFrames(s);
+        DestroyVideoMixer(s);
+        HEVC_LOG_INFO("Picture size changed to %ux%u, %u bits.\n",
+                      format.width, format.height, format.bit_depth);
+    }
+    /*
+       The render thread reads the format and picture size. It is stopped
+       whenever they change, and only starts again with the next job, which
+       publishes them, so they need no lock.
+     */
+    if(!hevc_surface_format_equal(&format, &s->surface_format))
+    {
+        stop_render_thread(&s->renderer);
+        s->surface_format = format;
+        s->vid_width = format.width;
+        s->vid_height = format.height;
+    }
+
+    UpdateDecoder(s,
+                  s->options.bits_10 || pi->bit_depth_luma_minus8 ||
+                  pi->bit_depth_chroma_minus8
+                  ? VDP_DECODER_PROFILE_HEVC_MAIN_10
+                  : VDP_DECODER_PROFILE_HEVC_MAIN,
+                  format.width, format.height);
+    if(s->videoMixer == VDP_INVALID_HANDLE)
+        CreateVideoMixer(s);
+
+    return 0;
+}
+
+/* Pushed input: whether the next NAL unit just has not arrived yet. */
+static int waiting_for_push(hevc_session *s)
+{
+    return s->index.fd < 0 && !s->index.eof;
+}
+
+/*
+   Whether every slice segment of the picture starting at NAL unit s->n
+   is in. Only pushed input can be short of some.
+ */
+static int picture_is_complete(hevc_session *s)
+{
+    const hevc_nal_entry *entry;
+    uint32_t n = s->n;
+
+    if(s->index.fd >= 0)
+        return 1;
+
+    /* The picture ends at the first NAL unit that is not part of it, as
+       in hevc_access_unit_assemble(). */
+    do
+        entry = hevc_nal_index_get(&s->index, ++n);
+    while(entry != NULL &&
+            (NAL_INDEX_IS_SUFFIX(entry->type) ||
+             (NAL_INDEX_IS_VCL(entry->type) &&
+              !entry->first_slice_segment_in_pic_flag)));
+
+    return entry != NULL || s->index.eof;
+}
+
+/*
+   Trick play: whether the picture that starts with nalu is decoded at all.
+
+   options.max_tid extracts the sub-bitstream of clause 10 up to HighestTid.
+   Nothing below refers to the higher sub-layers, so their pictures are
+   just dropped. Lowering the limit takes effect right away. Raising it
+   only takes effect where the higher sub-layers can be decoded from: at
+   an IDR or BLA picture, or at a TSA picture of the next sub-layer for all
+   of them, or an STSA picture for just that one.
+
+   With irap_only, only IRAP pictures are decoded. RASL pictures are also
+   skipped after a seek, see replay_parameter_sets(), and with
+   options.resilient, after an IRAP picture with NoRaslOutputFlag.
+ */
+static int picture_is_decoded(hevc_session *s, const GstH265NalUnit *nalu)
+{
+    hevc_decoder_context *context = &s->context;
+    uint8_t tid = nalu->temporal_id_plus1 - 1;
+    uint8_t max_tid = s->options.max_tid < 0 ?
+                      MAX_TEMPORAL_ID : s->options.max_tid;
+
+    if(max_tid < context->HighestTid)
+    {
+        context->HighestTid = max_tid;
+    }
+    else if(max_tid > context->HighestTid)
+    {
+        if(nalu->type >= GST_H265_NAL_SLICE_BLA_W_LP &&
+                nalu->type <= GST_H265_NAL_SLICE_IDR_N_LP)
+            context->HighestTid = max_tid;
+        else if(tid == context->HighestTid + 1 &&
+                (nalu->type == GST_H265_NAL_SLICE_TSA_N ||
+                 nalu->type == GST_H265_NAL_SLICE_TSA_R))
+            context->HighestTid = max_tid;
+        else if(tid == context->HighestTid + 1 &&
+                (nalu->type == GST_H265_NAL_SLICE_STSA_N ||
+                 nalu->type == GST_H265_NAL_SLICE_STSA_R))
+            context->HighestTid = tid;
+    }
+
+    if(tid > context->HighestTid)
+        return 0;
+    if(context->irap_only &&
+            (nalu->type < GST_H265_NAL_SLICE_BLA_W_LP || nalu->type > 23))
+        return 0;
+    if((s->skip_rasl || s->options.resilient) && context->NoRaslOutputFlag &&
+            (nalu->type == GST_H265_NAL_SLICE_RASL_N ||
+             nalu->type == GST_H265_NAL_SLICE_RASL_R))
+        return 0;
+
+    return 1;
+}
+
+/*
+   Moves past the picture that starts at nalu, s->n, with all of its slice
+   segments, without decoding it. None of them count as parsed NAL units.
+ */
+static int skip_picture(hevc_session *s, const GstH265NalUnit *nalu)
+{
+    if(hevc_access_unit_assemble(&s->au, &s->index, s->n) < 0)
+        return -1;
+    HEVC_LOG_DEBUG("Skipping a picture of nal_unit_type %u\n", nalu->type);
+    s->skipped++;
+    /* Its SEI messages do not carry over to the next picture. */
+    s->context.hrd.BufferingPeriodPresent = 0;
+    s->context.hrd.PicTimingPresent = 0;
+    if(s->recovering)
+        s->bench.recovery_skipped_pictures++;
+    s->n = s->au.last + 1;
+    return 0;
+}
+
+/*
+   Parses the VPS, SPS or PPS in s->nalu, for slices to activate later.
+   With options.resilient, one that does not parse is dropped, and any
+   earlier one with the same id stays.
+ */
+static int parse_parameter_set(hevc_session *s)
+{
+    GstH265ParserResult result = GST_H265_PARSER_OK;
+    int resilient = s->options.resilient;
+
+    switch(s->nalu->type)
+    {
+    case GST_H265_NAL_VPS:
+        HEVC_LOG_TRACE("Video Parameter Set\n");
+        /* Populate GstH265VPS */
+        result = gst_h265_parser_parse_vps(
+                     s->parser,
+                     s->nalu,
+                     s->vps);
+        if(result != GST_H265_PARSER_OK && resilient)
+            break;
+        update_picture_info_vps(&s->infoHEVC, s->vps);
+        break;
+    case GST_H265_NAL_SPS:
+        HEVC_LOG_TRACE("Sequence Parameter Set\n");
+        /* Populate GstH265SPS */
+        result = gst_h265_parser_parse_sps(
+                     s->parser,
+                     s->nalu,
+                     s->sps,
+                     (gboolean) TRUE);
+        if(result != GST_H265_PARSER_OK && resilient)
+            break;
+        if(cache_sps_info(&s->context, s->sps) < 0)
+            return -1;
+        break;
+    case GST_H265_NAL_PPS:
+        HEVC_LOG_TRACE("Picture Parameter Set\n");
+        /* Populate GstH265PPS */
+        result = gst_h265_parser_parse_pps(
+                     s->parser,
+                     s->nalu,
+                     s->pps);
+        if(result != GST_H265_PARSER_OK && resilient)
+            break;
+        if(cache_pps_info(&s->context, s->pps) < 0)
+            return -1;
+        break;
+    }
+
+    if(result != GST_H265_PARSER_OK && resilient)
+        return begin_recovery(s, "A broken parameter set");
+    return 0;
+}
+
+/*
+   Opens the file at the random access point options.seek_picture or
+   options.seek_ns asks for, leaving it in s->seek_point. Only the NAL
+   units from there on are indexed.
+ */
+static int open_at_seek_point(hevc_session *s)
+{
+    const hevc_session_options *options = &s->options;
+    uint64_t period, picture;
+
+    if(hevc_seek_index_open(&s->seek, options->path) < 0)
+        return -1;
+
+    picture = options->seek_picture;
+    if(options->seek_picture < 0)
+    {
+        period = options->period ? options->period : s->seek.period;
+        if(period == 0)
+        {
+            HEVC_LOG_ERROR("Error: seeking to a time needs a frame rate, "
+                           "from -f or the VUI of the stream.\n");
+            return -1;
+        }
+        picture = options->seek_ns / period;
+    }
+    if(picture > UINT32_MAX)
+        picture = UINT32_MAX;
+
+    s->seek_point = hevc_seek_index_find(&s->seek, picture);
+    if(s->seek_point == NULL)
+    {
+        HEVC_LOG_ERROR("Error: %s has no IRAP picture to seek to.\n",
+                       options->path);
+        return -1;
+    }
+    HEVC_LOG_INFO("Seeking to picture %u, nal_unit_type %u with POC %d, "
+                  "at byte %" PRIu64 ".\n",
+                  s->seek_point->picture, s->seek_point->type,
+                  s->seek_point->poc, s->seek_point->offset);
+
+    return hevc_nal_index_open_at(&s->index, options->path,
+                                  s->seek_point->offset);
+}
+
+/*
+   Parses the parameter sets of s->seek_point from wherever they are in
+   the stream, as if they came right before it. 8.1.3: the CRA picture
+   there is then handled as a BLA picture, and its RASL pictures, which
+   refer to pictures before it, are skipped.
+ */
+static int replay_parameter_sets(hevc_session *s)
+{
+    const hevc_seek_point *point = s->seek_point;
+    const hevc_seek_nal *nal;
+    uint32_t i;
+
+    for(i = 0; i < point->num_nals; i++)
+    {
+        nal = &s->seek.nals[point->first_nal + i];
+        if(check_nalu_result(gst_h265_parser_identify_nalu_unchecked(
+                                 s->parser,
+                                 (const guint8 *) s->index.data + nal->offset,
+                                 0,
+                                 (gsize) nal->size,
+                                 s->nalu)) ||
+                parse_parameter_set(s) < 0)
+            return -1;
+    }
+    s->context.HandleCraAsBlaFlag = 1;
+    s->skip_rasl = 1;
+
+    return 0;
+}
+
+/*
+   The end of the bitstream: outputs every picture still in the DPB, and
+   starts over if looping. Returns 1 when the session goes on, 0 when it is
+   done, or -1 on errors.
+ */
+static int end_of_stream(hevc_session *s)
+{
+    int quit = atomic_load(&s->renderer.quit);
+
+    if(!quit)
+    {
+        flush_dpb(&s->infoHEVC, &s->context);
+        if(submit_display_queue(s) < 0)
+            return -1;
+    }
+    stop_render_thread(&s->renderer);
+
+    HEVC_LOG_INFO("Found %d NAL units!\n", s->nals);
+    if(s->skipped)
+        HEVC_LOG_INFO("Skipped %u pictures.\n", s->skipped);
+    if(s->bench.errors)
+        HEVC_LOG_INFO("%" PRIu64 " errors, recovered from %" PRIu64
+                      " times, %" PRIu64 " pictures skipped and %" PRIu64
+                      " concealed meanwhile.\n",
+                      s->bench.errors, s->bench.recoveries,
+                      s->bench.recovery_skipped_pictures,
+                      s->bench.concealed_pictures);
+
+    HEVC_LOG_INFO("%s\n", "Parsing complete.");
+
+    if(s->bench.late_pictures)
+        HEVC_LOG_INFO("%" PRIu64 " pictures were late, %" PRIu64
+                      " of them dropped.\n",
+                      s->bench.late_pictures, s->bench.dropped_pictures);
+#if DEBUG_TIMES & DEBUG_TIMES_PRINT_STREAM_TIME
+    if(s->displayFrameNumber)
+        s->surface_times[(s->displayFrameNumber - 1) %
+                         NUM_OUTPUT_SURFACES].is_end_of_stream = 1;
+    s->is_stream_start = 1;
+#endif
+
+    if(s->options.loop && s->index.streaming)
+    {
+        HEVC_LOG_WARNING("Streamed input can not be looped.\n");
+    }
+    else if(s->options.loop && !quit)
+    {
+        /* xkcd.com/292 */
+        s->n = 0;
+        s->context.IsFirstPicture = 1;
+        s->context.HandleCraAsBlaFlag = s->skip_rasl;
+        /* Whatever parameter sets were active at the end do not apply
+           at the seek point. */
+        if(s->seek_point && replay_parameter_sets(s) < 0)
+            return -1;
+        if(s->replay.state == HEVC_REPLAY_RECORDING &&
+                s->context.hrd.last_output_ns >= 0)
+            s->replay_span_ns = s->context.hrd.last_output_ns + s->period;
+        if(hevc_replay_cache_rewind(&s->replay) == HEVC_REPLAY_READY)
+            s->replay_offset_ns += s->replay_span_ns;
+        return 1;
+    }
+
+    hevc_bench_stop(&s->bench);
+    s->done = 1;
+    return 0;
+}
+
+/*
+   Parses NAL units until the next picture has been handed to the render
+   stage. Returns 1 then, 0 once the session is done or pushed input ran
+   out, or -1 on errors and when the user asked to quit.
+
+   The most interesting API usage is in here. The flow is:
+
+   Parse the incoming bitstream.
+   Pull out the next NAL unit.
+   Parse every individual NAL unit.
+   Update decoder state after each NAL unit, saving it to
+   VdpPictureInfoHEVC.
+
+   For VCL NAL units ("frames"), the player must handle some parts of
+   Clause 8 as well as Annex C for correct decoding.
+
+   The order of operations for decoding a VCL NAL unit is:
+
+   8.2 NAL unit decoding process
+   8.3.1 Decoding process for picture order count
+   8.3.2 Decoding process for reference picture set
+   C.5.2.2 Output and removal of pictures from the DPB
+   8.3.3 Decoding process for generating unavailable reference pictures
+   C.3.4 Current decoded picture marking and storage
+   8.1 PicOutputFlag
+   (8.3.4 through 8.7 - handled by VdpDecoderRender - see note below)
+   C.5.2.3 Additional "bumping" and storage of the current picture
+
+   This player does _not_ implement a coded picture buffer (CPB) as
+   specified in C.2. A bitstream is either a file that we map in its
+   entirety, or a stream that we read as we go, and we do not handle
+   underflows or calculate timing.
+
+   VdpDecoderRender models an instantaneous decoding process. A decoding
+   process is defined in 8.1 as: NAL unit decoding (8.2), slice segment
+   layer decoding (8.3), and decoding using all syntax elements (8.4, 8.5,
+   8.6, 8.7). Since VDPAU is a NAL unit level API, any actions that are
+   done per slice are handled by the implementation. This includes 8.3.4,
+   8.4, 8.5, 8.6 and 8.7.
+
+   This implementation uses VdpPictureInfoHEVC.RefPics[] as the decoded
+   picture buffer (DPB). Other players are free to use RefPics[] directly,
+   or to keep a local, separate DPB. Other implementations may also choose
+   to maintain decoder state using a separate means, and copy data to
+   VdpPictureInfoHEVC on the fly prior to calling VdpDecoderRender.
+
+   Pictures are output in display order, through the "bumping" process of
+   C.5.2, as early as sps_max_num_reorder_pics and
+   sps_max_latency_increase_plus1 allow.
+ */
+static int decode_next_picture(hevc_session *s)
+{
+    const hevc_session_options *options = &s->options;
+    VdpPictureInfoHEVC *pi = &s->infoHEVC;
+    hevc_decoder_context *context = &s->context;
+    hevc_access_unit *au = &s->au;
+    GstH265NalUnit *nalu = s->nalu;
+    GstH265SliceHdr *slice = s->slice;
+    const hevc_nal_entry *entry;
+    GstH265ParserResult result;
+    hevc_picture_job *job;
+    int8_t target_index;
+    uint32_t n, releases;
+    unsigned int n_messages;
+    uint64_t t0;
+    int ret;
+
+    /*
+       The start locations of NAL units were determined up front, when the
+       file was indexed, or are found as streamed input arrives. Walk the
+       index.
+     */
+    for(;;)
+    {
+        /* Nothing before this NAL unit is referenced any more, unless it is
+           still waiting to be rendered. */
+        if(options->pipeline)
+        {
+            if(atomic_load(&s->renderer.quit))
+            {
+                ret = end_of_stream(s);
+                if(ret <= 0)
+                    return ret;
+            }
+            hevc_nal_index_release(&s->index,
+                min(s->n, hevc_picture_queue_completed(&s->renderer.queue)));
+        }
+        else
+            hevc_nal_index_release(&s->index, s->n);
+
+        hevc_trace_set_picture(TRACE_NO_POC, TRACE_NO_NAL_TYPE);
+        t0 = hevc_bench_begin(&s->bench);
+        entry = hevc_nal_index_get(&s->index, s->n);
+        hevc_bench_end(&s->bench, BENCH_STAGE_SCAN, t0);
+        if(entry == NULL)
+        {
+            if(waiting_for_push(s))
+                return 0;
+            ret = end_of_stream(s);
+            if(ret <= 0)
+                return ret;
+            /* The flushed pictures go out before anything else. */
+            if(s->pending || s->replay.state == HEVC_REPLAY_READY)
+                return 1;
+            continue;
+        }
+        hevc_bench_count_nal(&s->bench, entry->type, entry->size);
+        hevc_trace_set_picture(TRACE_NO_POC, entry->type);
+
+        /* Got a NAL unit. Now parse it. */
+
+        /* The index already knows where this NAL unit ends. */
+        t0 = hevc_bench_begin(&s->bench);
+        result = gst_h265_parser_identify_nalu_unchecked(
+                     s->parser,
+                     (const guint8 *) hevc_nal_index_data(&s->index, entry),
+                     0,
+                     (gsize) entry->size,
+                     nalu);
+        hevc_bench_end(&s->bench, BENCH_STAGE_PARSE, t0);
+        /* 7.4.2.2 forbidden_zero_bit is set in corrupt NAL units only. */
+        if(result == GST_H265_PARSER_OK && options->resilient &&
+                (nalu->data[nalu->offset] & 0x80))
+            result = GST_H265_PARSER_BROKEN_DATA;
+
+        if(check_nalu_result(result))
+        {
+            if(begin_recovery(s, "A broken NAL unit") < 0)
+                return -1;
+            s->n++;
+            continue;
+        }
+
+        HEVC_LOG_TRACE("NAL decoded.\n");
+        switch(nalu->type)
+        {
+            /* Video Coding Layer NAL Units */
+        case GST_H265_NAL_SLICE_TRAIL_N:
+        case GST_H265_NAL_SLICE_TRAIL_R:
+        case GST_H265_NAL_SLICE_TSA_N:
+        case GST_H265_NAL_SLICE_TSA_R:
+        case GST_H265_NAL_SLICE_STSA_N:
+        case GST_H265_NAL_SLICE_STSA_R:
+        case GST_H265_NAL_SLICE_RADL_N:
+        case GST_H265_NAL_SLICE_RADL_R:
+        case GST_H265_NAL_SLICE_RASL_N:
+        case GST_H265_NAL_SLICE_RASL_R:
+        case GST_H265_NAL_SLICE_BLA_W_LP:
+        case GST_H265_NAL_SLICE_BLA_W_RADL:
+        case GST_H265_NAL_SLICE_BLA_N_LP:
+        case GST_H265_NAL_SLICE_IDR_W_RADL:
+        case GST_H265_NAL_SLICE_IDR_N_LP:
+        case GST_H265_NAL_SLICE_CRA_NUT:
+            HEVC_LOG_TRACE("Video Coding Layer\n");
+
+            if(!picture_is_complete(s))
+                return 0;
+
+            /* The first slice segment of this picture was lost, which is
+               usually the error that is being recovered from already. */
+            if(options->resilient && !entry->first_slice_segment_in_pic_flag)
+            {
+                if(!s->recovering)
+                    begin_recovery(s, "A lost first slice segment");
+                if(skip_picture(s, nalu) < 0)
+                    return -1;
+                continue;
+            }
+            if(!picture_is_decoded(s, nalu))
+            {
+                if(skip_picture(s, nalu) < 0)
+                    return -1;
+                s->nals++;
+                continue;
+            }
+            /* Trick play, or recovery from an error: every IRAP picture
+               starts afresh. */
+            if((context->irap_only || s->recovering) &&
+                    nalu->type >= GST_H265_NAL_SLICE_BLA_W_LP &&
+                    nalu->type <= 23)
+                context->HandleCraAsBlaFlag = 1;
+
+            /* 8.2 NAL unit decoding process. */
+            /* Populate GstH265SliceHdr, up to the long-term reference
+               pictures of the first slice segment. VDPAU parses the rest,
+               and the other slice segments, itself... */
+            t0 = hevc_bench_begin(&s->bench);
+            result = gst_h265_parser_parse_slice_hdr_vdpau(
+                         s->parser, nalu, slice);
+            /* ...pick up the parameter sets it activates... */
+            if((result != GST_H265_PARSER_OK && options->resilient) ||
+                    activate_parameter_sets(pi, context, slice) < 0)
+            {
+                if(begin_recovery(s, "A broken slice header") < 0 ||
+                        skip_picture(s, nalu) < 0)
+                    return -1;
+                continue;
+            }
+            if(options->vui_timing)
+                s->period = get_vui_period(slice->pps->sps, options->period);
+            /* ...and propagate information to VdpPictureInfoHEVC. */
+            update_picture_info_slice_header(
+                pi, context, slice, nalu, slice->pps->sps);
+            hevc_bench_end(&s->bench, BENCH_STAGE_PARSE, t0);
+
+            /* Create or update VDPAU API objects: decoder, renderer.
+               Nothing of this picture has been decoded yet if it has to
+               wait, so it starts over at the same NAL unit. */
+
+            if(options->use_vdpau)
+            {
+                ret = UpdateVdpapiObjects(s, slice);
+                if(ret != 0)
+                    return ret;
+            }
+
+            t0 = hevc_bench_begin(&s->bench);
+            /* 8.3.1 Decoding process for picture order count */
+            decode_picture_order_count(pi, context, slice, nalu);
+            hevc_trace_set_picture(pi->CurrPicOrderCntVal, nalu->type);
+            /* 8.3.2 Decoding process for reference picture set */
+            decode_reference_picture_set(
+                pi, context, slice, slice->pps->sps);
+            /* Error resilience: pictures that depend on a lost one are
+               not decoded, nor output. */
+            if(options->resilient && !references_are_available(s))
+            {
+                hevc_bench_end(&s->bench, BENCH_STAGE_DPB, t0);
+                if(skip_picture(s, nalu) < 0)
+                    return -1;
+                continue;
+            }
+            s->nals++;
+            /* C.5.2.2 Output and removal of pictures from the DPB */
+            remove_pictures_from_dpb(pi, context, slice, nalu);
+            /* 8.3.3 Decoding process for generating unavailable reference
+               pictures */
+            generate_unavailable_reference_pictures(s, nalu);
+            /* C.3.4 Current decoded picture marking and storage. Exported
+               frames may hold every free entry for now, and the pictures
+               the IRAP flushed out have to be exported first. */
+            for(;;)
+            {
+                releases = context->hold_outputs ? get_releases(s) : 0;
+                target_index = get_decoded_picture_index(pi, context);
+                if(target_index >= 0 || !context->hold_outputs)
+                    break;
+                if(context->displayQueue[0] != -1)
+                {
+                    ret = submit_display_queue(s);
+                    if(ret < 0)
+                        return ret;
+                }
+                else if(wait_for_release(s, releases) < 0)
+                    break;
+            }
+            /* Nothing of the picture may be stored without an entry. */
+            if(target_index < 0)
+            {
+                HEVC_LOG_ERROR("ERROR: Invalid target_index value\n");
+                hevc_bench_end(&s->bench, BENCH_STAGE_DPB, t0);
+                if(begin_recovery(s, "A full DPB") < 0 ||
+                        skip_picture(s, nalu) < 0)
+                    return -1;
+                continue;
+            }
+            if(target_index == context->num_scratch_frames)
+                AllocateScratchFrame(s);
+            context->dpb_slice_pic_order_cnt_lsb[target_index] =
+                slice->pic_order_cnt_lsb;
+            context->SubLayerNonReference[target_index] =
+                nalu->type < GST_H265_NAL_SLICE_BLA_W_LP && !(nalu->type & 1);
+            /* 8.1 PicOutputFlag */
+            calculate_PicOutputFlag(context, slice, nalu, target_index);
+            context->OutputTime[target_index] = options->hrd_timing ?
+                get_output_time(pi, context, slice->pps->sps) : -1;
+            hevc_bench_end(&s->bench, BENCH_STAGE_DPB, t0);
+            /* Remainder of decoding process - 8.3.4 8.4 8.5 8.6 8.7 */
+
+            /*
+               Subsequent slice segments of the same picture follow the
+               first one in the bitstream. Each one becomes its own
+               VdpBitstreamBuffer, and VDPAU decodes them all as one
+               picture.
+             */
+            t0 = hevc_bench_begin(&s->bench);
+            if(hevc_access_unit_assemble(au, &s->index, s->n) < 0)
+                return -1;
+            hevc_bench_end(&s->bench, BENCH_STAGE_SCAN, t0);
+            HEVC_LOG_DEBUG("Decoding %u slice segments, %u bytes\n",
+                           au->count, au->bytes);
+            for(n = au->first + 1; n <= au->last; n++)
+            {
+                entry = hevc_nal_index_get(&s->index, n);
+                hevc_bench_count_nal(&s->bench, entry->type, entry->size);
+            }
+            s->n = au->last + 1;
+
+            /*
+               Snapshot everything the render stage needs. In pipelined
+               mode, parsing carries on with the next picture while this
+               one waits in the queue.
+             */
+            job = begin_job(s);
+            t0 = hevc_bench_begin(&s->bench);
+            memcpy(&job->info, pi, sizeof(*pi));
+            job->target = context->scratch_frames[target_index];
+            job->target_index = target_index;
+            get_conformance_window(slice->pps->sps, &job->crop);
+            job->release = s->n;
+            if(hevc_picture_job_set_buffers(job, au->buffers, au->count) < 0)
+                return -1;
+            /* Pictures bumped by C.5.2.2 go out first. */
+            take_display_queue(job, context);
+            job->output_before = job->output_count;
+
+            /* C.5.2.3 Store the current picture and bump as needed. */
+            store_current_picture(pi, context, target_index);
+            /* With irap_only, nothing comes before it in output order. */
+            if(context->irap_only)
+                flush_dpb(pi, context);
+            take_display_queue(job, context);
+            hevc_bench_end(&s->bench, BENCH_STAGE_DPB, t0);
+
+            if(submit_job(s, job) < 0)
+                return -1;
+            context->IsFirstPicture = 0;
+            if(s->recovering)
+                end_recovery(s);
+            s->frame++;
+            if(options->frames > 0 && s->frame > options->frames)
+            {
+                stop_render_thread(&s->renderer);
+                hevc_bench_stop(&s->bench);
+                s->done = 1;
+                return 0;
+            }
+            return 1;
+            /* Video, Sequence and Picture Parameter Sets */
+        case GST_H265_NAL_VPS:
+        case GST_H265_NAL_SPS:
+        case GST_H265_NAL_PPS:
+            t0 = hevc_bench_begin(&s->bench);
+            if(parse_parameter_set(s) < 0)
+                return -1;
+            hevc_bench_end(&s->bench, BENCH_STAGE_PARSE, t0);
+            s->nals++;
+            break;
+            /* Supplemental Enhancement Information */
+        case GST_H265_NAL_PREFIX_SEI:
+        case GST_H265_NAL_SUFFIX_SEI:
+            HEVC_LOG_TRACE("Supplemental Enhancement Information\n");
+            t0 = hevc_bench_begin(&s->bench);
+            /* Populate GstH265SEIMessage, one per sei_message() */
+            gst_h265_parser_parse_sei_messages(
+                s->parser,
+                nalu,
+                s->sei,
+                MAX_SEI_MESSAGES,
+                &n_messages);
+            update_picture_info_sei(context, s->sei, n_messages);
+            hevc_bench_end(&s->bench, BENCH_STAGE_PARSE, t0);
+            s->nals++;
+            break;
+        case GST_H265_NAL_EOS:
+            /* The coded video sequence is over, output all of it. */
+            flush_dpb(pi, context);
+            if(submit_display_queue(s) < 0)
+                return -1;
+            context->IsFirstPicture = 1;
+            s->nals++;
+            if(s->pending)
+            {
+                s->n++;
+                return 1;
+            }
+            break;
+            /* All others. */
+        default:
+            HEVC_LOG_TRACE("Uknown NAL Unit type...\n");
+            gst_h265_parser_parse_nal(s->parser, nalu);
+            break;
+        }
+        s->n++;
+    }
+}
+
+/*
+   decode_next_picture() for the passes after the first, with
+   options.loop: submits the next job the first pass did, from the replay
+   cache, without reading or parsing anything.
+ */
+static int replay_next_picture(hevc_session *s)
+{
+    const hevc_session_options *options = &s->options;
+    hevc_picture_job *job;
+    uint32_t i;
+    int ret;
+
+    while(!hevc_replay_cache_more(&s->replay) ||
+            (options->pipeline && atomic_load(&s->renderer.quit)))
+    {
+        ret = end_of_stream(s);
+        if(ret <= 0)
+            return ret;
+        /* Parse the next pass after all. */
+        if(s->replay.state != HEVC_REPLAY_READY)
+            return 1;
+    }
+
+    job = begin_job(s);
+    if(hevc_replay_cache_next(&s->replay, job) < 0)
+        return -1;
+    for(i = 0; i < job->output_count; i++)
+    {
+        if(job->output_time[i] >= 0)
+            job->output_time[i] += s->replay_offset_ns;
+    }
+    for(i = 0; i < job->buffer_count; i++)
+        hevc_bench_count_nal(&s->bench, get_buffer_nal_type(&job->buffers[i]),
+                             job->buffers[i].bitstream_bytes);
+
+    if(submit_job(s, job) < 0)
+        return -1;
+    if(job->target_index < 0)
+        return 1;
+    s->nals++;
+    s->frame++;
+    if(options->frames > 0 && s->frame > options->frames)
+    {
+        stop_render_thread(&s->renderer);
+        hevc_bench_stop(&s->bench);
+        s->done = 1;
+        return 0;
+    }
+
+    return 1;
+}
+
+void hevc_session_default_options(hevc_session_options *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->flush_ms = -1;
+    options->use_vdpau = 1;
+    options->do_display = 1;
+    options->num_wins = 1;
+    options->frames = -1;
+    options->seek_picture = -1;
+    options->seek_ns = -1;
+    options->max_tid = -1;
+    options->replay_cache_size = REPLAY_CACHE_DEFAULT_SIZE;
+    /* TODO: Alternately parse these from the SPS. */
+    options->width = 1920;
+    options->height = 1080;
+    options->cscContrast = 1.0;
+    options->cscSaturation = 1.0;
+}
+
+/*
+   Opens the input, and sets up everything but the VDPAU objects, which are
+   only created once the first slice has activated an SPS.
+ */
+hevc_session *hevc_session_create(const hevc_session_options *options)
+{
+    hevc_session *s;
+    int i, status;
+    uint64_t t0;
+
+    s = calloc(1, sizeof(*s));
+    if(s == NULL)
+    {
+        HEVC_LOG_ERROR("Error: MALLOC: session.\n");
+        return NULL;
+    }
+    s->options = *options;
+    s->period = options->period;
+#if DEBUG_TIMES
+    s->is_stream_start = 1;
+#endif
+    pthread_mutex_init(&s->export_lock, NULL);
+    pthread_cond_init(&s->export_released, NULL);
+    s->context.hold_outputs = options->frame_callback != NULL;
+    s->index.fd = -1;
+    s->decoder = VDP_INVALID_HANDLE;
+    s->videoMixer = VDP_INVALID_HANDLE;
+    s->unavailable_surface = VDP_INVALID_HANDLE;
+    for(i = 0; i < NUM_OUTPUT_SURFACES; i++)
+    {
+        s->outputSurfaces[i] = VDP_INVALID_HANDLE;
+    }
+    s->vid_width = options->width;
+    s->vid_height = options->height;
+    s->bench.enabled = options->bench;
+    s->context.IsFirstPicture = 1;
+    s->context.hrd.last_output_ns = -1;
+    s->context.HighestTid = options->max_tid < 0 ?
+                            MAX_TEMPORAL_ID : options->max_tid;
+    s->context.irap_only = options->irap_only;
+    dpb_index_clear(&s->context.dpb_index);
+    for(i = 0; i < HEVC_MAX_REFERENCES; i++)
+    {
+        s->infoHEVC.RefPics[i] = VDP_INVALID_HANDLE;
+        s->context.scratch_frames[i] = VDP_INVALID_HANDLE;
+    }
+    for(i = 0; i < ARSIZE(s->context.displayQueue); i++)
+    {
+        s->context.displayQueue[i] = -1;
+    }
+
+    if(options->pipeline &&
+            hevc_picture_queue_init(&s->renderer.queue, options->pipeline) < 0)
+        goto failure;
+
+    s->pool = options->surface_pool;
+    if(s->pool == NULL)
+    {
+        if(hevc_surface_pool_init(&s->own_pool, 0) < 0)
+            goto failure;
+        s->pool = &s->own_pool;
+    }
+
+    /* Map and index the file, or set up streaming, or die trying. */
+    hevc_bench_start(&s->bench);
+    t0 = hevc_bench_begin(&s->bench);
+    if(options->path &&
+            (options->seek_picture >= 0 || options->seek_ns >= 0))
+        status = open_at_seek_point(s);
+    else if(options->path)
+        status = hevc_nal_index_open(&s->index, options->path,
+                                     options->ring_size, options->flush_ms);
+    else
+        status = hevc_nal_index_open_push(&s->index, options->ring_size);
+    if(status < 0)
+    {
+        if(options->path)
+            HEVC_LOG_ERROR("Input file %s not found\n", options->path);
+        goto failure;
+    }
+    hevc_bench_end(&s->bench, BENCH_STAGE_SCAN, t0);
+    /* Exported frames are handed back in any order, so the DPB does not
+       repeat itself from one pass to the next. */
+    if(options->loop && !s->index.streaming && !options->frame_callback)
+        hevc_replay_cache_init(&s->replay, options->replay_cache_size);
+
+    /* Initialize GStreamer library for HEVC NAL Unit parsing. */
+    s->parser = gst_h265_parser_new();
+    if(!s->parser)
+    {
+        HEVC_LOG_ERROR("Error: unable to call gst_h265_parser_new.\n");
+        goto failure;
+    }
+
+    if(allocate_gst_objects(&s->nalu, &s->slice, &s->vps,
+                            &s->sps, &s->pps, &s->sei) < 0)
+    {
+        HEVC_LOG_ERROR("Failed to allocate Gst objects.\n");
+        gst_h265_parser_free(s->parser);
+        s->parser = NULL;
+        goto failure;
+    }
+
+    /* Looping goes back to the seek point, with its parameter sets. */
+    if(s->seek_point)
+    {
+        if(replay_parameter_sets(s) < 0)
+            goto failure;
+        if(!options->loop)
+        {
+            s->seek_point = NULL;
+            hevc_seek_index_close(&s->seek);
+        }
+    }
+
+    return s;
+failure:
+    hevc_session_destroy(s);
+    return NULL;
+}
+
+void hevc_session_destroy(hevc_session *s)
+{
+    if(s == NULL)
+        return;
+
+    stop_render_thread(&s->renderer);
+    if(s->context.vdpau_initialized)
+    {
+        DestroyVdpapiObjects(s);
+    }
+    if(s->pool == &s->own_pool)
+    {
+        hevc_surface_pool_destroy(&s->own_pool);
+    }
+
+    free_parameter_set_cache(&s->context);
+    if(s->parser)
+    {
+        free_gst_objects(&s->nalu, &s->slice, &s->vps,
+                         &s->sps, &s->pps, &s->sei);
+        gst_h265_parser_free(s->parser);
+    }
+
+    hevc_picture_queue_destroy(&s->renderer.queue);
+    hevc_replay_cache_destroy(&s->replay);
+    free(s->serial_job.buffers);
+    hevc_access_unit_free(&s->au);
+    hevc_nal_index_close(&s->index);
+    hevc_seek_index_close(&s->seek);
+    hevc_bench_free(&s->bench);
+    pthread_cond_destroy(&s->export_released);
+    pthread_mutex_destroy(&s->export_lock);
+    free(s);
+}
+
+int hevc_session_decode(hevc_session *s)
+{
+    if(s->done)
+        return 0;
+
+    if(s->replay.state == HEVC_REPLAY_READY)
+        return replay_next_picture(s);
+    return decode_next_picture(s);
+}
+
+ssize_t hevc_session_push(hevc_session *s, const void *data, size_t size)
+{
+    if(s->index.fd >= 0)
+    {
+        HEVC_LOG_ERROR("Error: the session reads its own input.\n");
+        return -1;
+    }
+
+    /* Entries up to the picture being handed out are no longer needed. */
+    if(!s->pending)
+        hevc_nal_index_release(&s->index, s->n);
+
+    return hevc_nal_index_push(&s->index, data, size);
+}
+
+int hevc_session_pull_frame(hevc_session *s, hevc_frame *frame)
+{
+    hevc_picture_job *job = &s->serial_job;
+    int i, ret;
+
+    if(s->options.pipeline || s->options.frame_callback)
+    {
+        HEVC_LOG_ERROR("Error: frames can not be pulled in pipelined "
+                       "or exporting mode.\n");
+        return -1;
+    }
+    s->pull = 1;
+
+    for(;;)
+    {
+        if(s->pending)
+        {
+            /* The rest of the pictures were bumped after decoding. */
+            if(s->next_output == job->output_before && !s->rendered)
+            {
+                decode_picture(s, job);
+                s->rendered = 1;
+            }
+
+            if(s->next_output < job->output_count)
+            {
+                i = s->next_output++;
+                get_frame(s, job, i, frame);
+                return 1;
+            }
+            s->pending = 0;
+        }
+
+        if(s->done)
+            return 0;
+        ret = decode_next_picture(s);
+        if(ret < 0)
+            return -1;
+        if(!s->pending)
+            return 0;
+    }
+}
+
+void hevc_session_release_frame(hevc_session *s, const hevc_frame *frame)
+{
+    int i;
+
+    pthread_mutex_lock(&s->export_lock);
+    for(i = 0; i < s->num_detached; i++)
+    {
+        if(s->detached[i] == frame->surface)
+            break;
+    }
+    if(i < s->num_detached)
+    {
+        hevc_surface_pool_put(s->pool, &s->detached_format[i],
+                              frame->surface);
+        s->num_detached--;
+        s->detached[i] = s->detached[s->num_detached];
+        s->detached_format[i] = s->detached_format[s->num_detached];
+    }
+    else
+        s->context.inUse[frame->dpb_index] &= ~HELD_BY_CONSUMER;
+    s->releases++;
+    pthread_cond_broadcast(&s->export_released);
+    pthread_mutex_unlock(&s->export_lock);
+}
+
+void hevc_session_set_max_tid(hevc_session *s, int max_tid)
+{
+    s->options.max_tid = max_tid;
+    /* The recorded pass has the sub-layers of the old limit. */
+    hevc_replay_cache_disable(&s->replay);
+}
+
+hevc_bench *hevc_session_bench(hevc_session *s)
+{
+    return &s->bench;
+}
+
+void hevc_session_set_window_size(
+    hevc_session *s,
+    uint32_t width,
+    uint32_t height)
+{
+    atomic_store(&s->windowSize, (uint64_t) width << 32 | height);
+}
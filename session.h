@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    session: decodes one H.265/HEVC elementary stream with VDPAU.
+
+    A session owns everything that belongs to one stream: the NAL unit
+    index, the parser, VdpPictureInfoHEVC and the DPB, and the VdpDecoder
+    with its surfaces. It does not own the VdpDevice. Set that up with
+    win_x11_init_vdpau_procs() before creating a session that uses VDPAU,
+    and keep it until the last such session is destroyed. Any number of
+    sessions can share the device. A session itself must only be used by
+    one thread at a time.
+
+    There are two ways to drive a session.
+
+    A session opened on a file (options.path) can be run with
+    hevc_session_decode(), one picture per call. Pictures are presented in
+    the session's windows, in display order, as vdpau_hw_hevc does, and/or
+    exported through options.frame_callback.
+
+    Otherwise, the stream is fed with hevc_session_push(), and decoded
+    pictures are taken out with hevc_session_pull_frame() instead, in
+    display order. Those are never presented.
+
+    Exported and pulled frames are the decoder's own VdpVideoSurfaces, in
+    the layout of hevc_frame.format. Register them for CUDA
+    (cuVDPAURegisterVideoSurface) or OpenGL (GL_NV_vdpau_interop) to get at
+    the pixels without a copy.
+ */
+
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vdpau/vdpau.h>
+#include "bench.h"
+#include "surfacepool.h"
+#include "yuvwriter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _hevc_session hevc_session;
+typedef struct _hevc_frame hevc_frame;
+
+typedef struct _hevc_session_options
+{
+    /*
+       A file to map, or to stream if ring_size is not 0; "-" for stdin.
+       NULL to push the stream with hevc_session_push(), through a ring
+       buffer of ring_size bytes (NAL_INDEX_DEFAULT_RING_SIZE if 0).
+     */
+    const char *path;
+    size_t ring_size;
+    /* See hevc_nal_index_open(). */
+    int flush_ms;
+    /* Without VDPAU, only the parsing and DPB management run. */
+    uint8_t use_vdpau;
+    /* Present decoded pictures in windows first_win and up. */
+    uint8_t do_display;
+    int first_win;
+    int num_wins;
+    /*
+       Presentation period in ns, or 0 to present as soon as possible. With
+       a period, late pictures of the *_N nal_unit_types are dropped.
+     */
+    uint64_t period;
+    /* Take the period from the VUI timing information where there is any. */
+    uint8_t vui_timing;
+    /*
+       Present each picture at its DPB output time, from the buffering
+       period and picture timing SEI messages and the VUI, or from
+       PicOrderCntVal if the VUI says it is proportional to timing. Pictures
+       without one are scheduled by the period. Needs a period to drop or
+       resync late pictures by.
+     */
+    uint8_t hrd_timing;
+    /* Microseconds to wait after each picture. */
+    int32_t delay;
+    /* Wait for a key press after each picture. */
+    uint8_t step;
+    /* Start over at the end of the stream. */
+    uint8_t loop;
+    /*
+       Looping over a file: the first pass is recorded into up to this many
+       bytes, and replayed from there by the later ones, without reading or
+       parsing the file again. 0 to parse every pass. See replaycache.h.
+     */
+    size_t replay_cache_size;
+    /* Stop after this many pictures, unless it is negative. */
+    int32_t frames;
+    /*
+       A file only: start at the IRAP picture at or before picture
+       seek_picture, counted in decoding order, or at or before seek_ns
+       into the stream. -1 for neither. Looping goes back there too. The
+       random access points come from the sidecar index <path>.idx, which
+       is built first if it is missing or stale. See seekindex.h.
+     */
+    int64_t seek_picture;
+    int64_t seek_ns;
+    /*
+       Trick play. Only decode the temporal sub-layers up to max_tid, or all
+       of them if it is negative. With irap_only, only decode IDR, CRA and
+       BLA pictures, and output each one right away.
+     */
+    int8_t max_tid;
+    uint8_t irap_only;
+    /*
+       Error resilience. Rather than stop at a NAL unit that does not
+       parse, drop the picture it belongs to and go on. Later pictures with
+       a reference that is missing are dropped too, until an IRAP picture
+       or a picture whose references are all there. With conceal, missing
+       references are stood in for by mid-gray pictures instead, and those
+       pictures are decoded and output. See hevc_bench for the counters.
+     */
+    uint8_t resilient;
+    uint8_t conceal;
+    /* Queue up to this many pictures for a render thread, or 0 for none. */
+    uint32_t pipeline;
+    uint8_t bench;
+    /* Assumed picture size, until the first SPS is active. */
+    unsigned short width, height;
+    int bits_10;
+    /* Video mixer color space conversion. */
+    int csc;
+    float cscBrightness, cscContrast;
+    float cscSaturation, cscHue;
+    /*
+       Video surfaces come from, and go back to, this pool, which may be
+       shared with other sessions. NULL for a pool of the session's own.
+     */
+    hevc_surface_pool *surface_pool;
+    /*
+       Zero-copy export: called with every picture in display order, by the
+       thread that renders, which is the render thread with pipeline. The
+       surface is not reused before the frame is handed back with
+       hevc_session_release_frame(), from any thread. Decoding waits for
+       that when every surface is held. Not with hevc_session_pull_frame().
+     */
+    void (*frame_callback)(void *opaque, const hevc_frame *frame);
+    void *frame_opaque;
+    /*
+       Every picture is also read back into this writer, in display order,
+       with its conformance cropping window. NULL for none.
+     */
+    hevc_yuv_writer *yuv_writer;
+} hevc_session_options;
+
+/* Memory layout of a video surface: 4:2:0, luma plane then CbCr plane. */
+typedef enum _hevc_frame_format
+{
+    HEVC_FRAME_FORMAT_NV12,
+    /* 16 bit samples, with the 10 bits at the top. */
+    HEVC_FRAME_FORMAT_P010
+} hevc_frame_format;
+
+/*
+   One decoded picture, as returned by hevc_session_pull_frame() or passed
+   to options.frame_callback.
+ */
+struct _hevc_frame
+{
+    VdpVideoSurface surface;
+    uint32_t width;
+    uint32_t height;
+    hevc_frame_format format;
+    /* The DPB entry the picture was decoded into. */
+    int8_t dpb_index;
+    /* PicOrderCntVal. */
+    int32_t poc;
+    /* Counts every frame the session output, from 0. */
+    uint32_t output_number;
+    /* CLOCK_MONOTONIC time at which the picture was decoded. */
+    uint64_t decode_time_ns;
+};
+
+/* Fills options in with the defaults of vdpau_hw_hevc. */
+void hevc_session_default_options(hevc_session_options *options);
+
+/* Returns a new session, or NULL on failure. options are copied. */
+hevc_session *hevc_session_create(const hevc_session_options *options);
+void hevc_session_destroy(hevc_session *session);
+
+/*
+   Decodes the next picture of a session opened on a file, and hands it to
+   the render stage. Returns 1, 0 once the stream is over, or -1 on errors
+   and when the user asked to quit.
+ */
+int hevc_session_decode(hevc_session *session);
+
+/*
+   Appends up to size bytes of the stream. Returns how many are taken,
+   which may be fewer than size while the ring buffer is full: pull frames
+   and push the rest afterwards. Push 0 bytes to end the stream. Returns
+   -1 on errors.
+ */
+ssize_t hevc_session_push(
+    hevc_session *session,
+    const void *data,
+    size_t size);
+
+/*
+   Decodes as much as needed to return the next frame in display order.
+   Returns 1 with a frame, 0 if more data has to be pushed first, or all
+   of it has been output, or -1 on errors. The surface holds the frame
+   until the next call to any of these functions. Requires options.pipeline
+   to be 0.
+ */
+int hevc_session_pull_frame(hevc_session *session, hevc_frame *frame);
+
+/*
+   Hands a frame from options.frame_callback back, so that its surface can
+   be reused. Every frame has to be released before the session is
+   destroyed.
+ */
+void hevc_session_release_frame(hevc_session *session, const hevc_frame *frame);
+
+/*
+   Changes options.max_tid while decoding, to scrub faster or slower. More
+   sub-layers are only decoded from the next picture that allows switching
+   up to them: IDR, BLA, TSA or STSA.
+ */
+void hevc_session_set_max_tid(hevc_session *session, int max_tid);
+
+/*
+   The size of the windows a session presents pictures in. Xlib is not
+   thread safe, so the render thread never polls X events: the thread that
+   owns the Display does, and hands on the size with this, from any thread.
+   Pictures are presented at their own size until then, or with 0.
+ */
+void hevc_session_set_window_size(
+    hevc_session *session,
+    uint32_t width,
+    uint32_t height);
+
+/* The session's -bench measurements. */
+hevc_bench *hevc_session_bench(hevc_session *session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SESSION_H__ */
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "win_x11.h"
+#include "surfacepool.h"
+#include "logging.h"
+
+int hevc_surface_format_equal(
+    const hevc_surface_format *a,
+    const hevc_surface_format *b)
+{
+    return a->chroma_type == b->chroma_type &&
+           a->width == b->width &&
+           a->height == b->height &&
+           a->bit_depth == b->bit_depth;
+}
+
+int hevc_surface_format_is_420(const hevc_surface_format *format)
+{
+#ifdef VDP_CHROMA_TYPE_420_16
+    if(format->chroma_type == VDP_CHROMA_TYPE_420_16)
+        return 1;
+#endif
+    return format->chroma_type == VDP_CHROMA_TYPE_420;
+}
+
+/* Drops idle entry i, keeping the others in order. Called with the lock. */
+static void remove_entry(hevc_surface_pool *pool, uint32_t i)
+{
+    pool->count--;
+    memmove(&pool->surfaces[i], &pool->surfaces[i + 1],
+            (pool->count - i) * sizeof(pool->surfaces[0]));
+    memmove(&pool->formats[i], &pool->formats[i + 1],
+            (pool->count - i) * sizeof(pool->formats[0]));
+}
+
+int hevc_surface_pool_init(hevc_surface_pool *pool, uint32_t capacity)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->capacity = capacity ? capacity : SURFACE_POOL_DEFAULT_CAPACITY;
+    pool->surfaces = malloc(pool->capacity * sizeof(pool->surfaces[0]));
+    pool->formats = malloc(pool->capacity * sizeof(pool->formats[0]));
+    if(pool->surfaces == NULL || pool->formats == NULL)
+    {
+        HEVC_LOG_ERROR("Error: MALLOC: surface pool.\n");
+        free(pool->surfaces);
+        free(pool->formats);
+        return -1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+
+    return 0;
+}
+
+void hevc_surface_pool_destroy(hevc_surface_pool *pool)
+{
+    uint32_t i;
+
+    if(pool->surfaces == NULL)
+        return;
+
+    for(i = 0; i < pool->count; i++)
+        vdp_video_surface_destroy(pool->surfaces[i]);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->surfaces);
+    free(pool->formats);
+    memset(pool, 0, sizeof(*pool));
+}
+
+VdpStatus hevc_surface_pool_get(
+    hevc_surface_pool *pool,
+    const hevc_surface_format *format,
+    VdpVideoSurface *surface)
+{
+    uint32_t i;
+
+    pthread_mutex_lock(&pool->lock);
+    /* The most recently returned ones are the likeliest to match. */
+    for(i = pool->count; i-- > 0; )
+    {
+        if(hevc_surface_format_equal(&pool->formats[i], format))
+        {
+            *surface = pool->surfaces[i];
+            remove_entry(pool, i);
+            pthread_mutex_unlock(&pool->lock);
+            return VDP_STATUS_OK;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return vdp_video_surface_create(
+               /* inputs */
+               vdp_device, /* device */
+               format->chroma_type, /* chroma_type */
+               format->width, /* width */
+               format->height, /* height */
+               /* output */
+               surface /* surface */
+           );
+}
+
+void hevc_surface_pool_put(
+    hevc_surface_pool *pool,
+    const hevc_surface_format *format,
+    VdpVideoSurface surface)
+{
+    VdpVideoSurface evicted = VDP_INVALID_HANDLE;
+
+    pthread_mutex_lock(&pool->lock);
+    if(pool->count == pool->capacity)
+    {
+        evicted = pool->surfaces[0];
+        remove_entry(pool, 0);
+    }
+    pool->surfaces[pool->count] = surface;
+    pool->formats[pool->count++] = *format;
+    pthread_mutex_unlock(&pool->lock);
+
+    if(evicted != VDP_INVALID_HANDLE)
+        vdp_video_surface_destroy(evicted);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+    surfacepool: recycles VdpVideoSurfaces between coded video sequences and
+    sessions.
+
+    Creating a full set of video surfaces takes long enough to drop frames
+    when a stream switches resolution every few seconds, as adaptive streams
+    do. Surfaces no longer needed go back to the pool instead, and are
+    handed out again to whoever next asks for the same format. The pool may
+    be shared by any number of sessions on the same VdpDevice, from any
+    thread.
+ */
+
+#ifndef __SURFACE_POOL_H__
+#define __SURFACE_POOL_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vdpau/vdpau.h>
+
+/* Two full sets of HEVC reference surfaces. */
+#define SURFACE_POOL_DEFAULT_CAPACITY 32
+
+/*
+   What a surface is pooled under. Beyond 8 bits, chroma_type is one of the
+   16 bit types of VDPAU 1.2, VDP_CHROMA_TYPE_420_16 and so on.
+ */
+typedef struct _hevc_surface_format
+{
+    VdpChromaType chroma_type;
+    uint32_t width;
+    uint32_t height;
+    uint8_t bit_depth;
+} hevc_surface_format;
+
+typedef struct _hevc_surface_pool
+{
+    pthread_mutex_t lock;
+    /* Idle surfaces, oldest first. */
+    VdpVideoSurface *surfaces;
+    hevc_surface_format *formats;
+    uint32_t count;
+    uint32_t capacity;
+} hevc_surface_pool;
+
+int hevc_surface_format_equal(
+    const hevc_surface_format *a,
+    const hevc_surface_format *b);
+
+/* Whether the surfaces are 4:2:0, of any depth: NV12, P010 or P016. */
+int hevc_surface_format_is_420(const hevc_surface_format *format);
+
+/*
+   Keeps up to capacity idle surfaces, SURFACE_POOL_DEFAULT_CAPACITY if 0.
+   Returns 0, or -1 if memory runs out.
+ */
+int hevc_surface_pool_init(hevc_surface_pool *pool, uint32_t capacity);
+/* Destroys every idle surface. */
+void hevc_surface_pool_destroy(hevc_surface_pool *pool);
+
+/* Returns an idle surface of the format, or creates one. */
+VdpStatus hevc_surface_pool_get(
+    hevc_surface_pool *pool,
+    const hevc_surface_format *format,
+    VdpVideoSurface *surface);
+
+/*
+   Hands a surface created with hevc_surface_pool_get() back. It must no
+   longer be in use, by VDPAU either. The oldest idle surface is destroyed
+   to make room if the pool is full.
+ */
+void hevc_surface_pool_put(
+    hevc_surface_pool *pool,
+    const hevc_surface_format *format,
+    VdpVideoSurface surface);
+
+#endif /* __SURFACE_POOL_H__ */
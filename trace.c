@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+#include "trace.h"
+#if HEVC_TRACE_USDT
+#include <sys/sdt.h>
+#endif
+
+typedef struct _trace_event
+{
+    uint64_t begin_ns;
+    uint64_t end_ns;
+    const char *name;
+    int32_t poc;
+    int16_t nal_type;
+    uint8_t async;
+} trace_event;
+
+/*
+   One per thread, only ever written by that thread. Rings are not freed
+   before exit: a thread that ends gives its ring up, and the next thread
+   that starts tracing takes it over, with the spans it already has.
+ */
+typedef struct _trace_ring
+{
+    struct _trace_ring *next;
+    uint32_t tid;
+    const char *name;
+    atomic_int owned;
+    /* The tag of the spans being recorded, see hevc_trace_tag(). */
+    int32_t poc;
+    int16_t nal_type;
+    /*
+       Spans ever written. Event head % TRACE_RING_EVENTS is written first,
+       and head is stored after it, so a reader sees every span below head
+       complete, unless the writer has come round to it again.
+     */
+    _Atomic uint64_t head;
+    trace_event events[TRACE_RING_EVENTS];
+} trace_ring;
+
+int hevc_trace_enabled;
+
+static char *trace_path;
+static uint64_t trace_start_ns;
+static _Atomic(trace_ring *) trace_rings;
+static atomic_uint trace_ring_count;
+static pthread_key_t trace_ring_key;
+static pthread_mutex_t trace_dump_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t trace_dump_requested;
+static __thread trace_ring *thread_ring;
+
+static void ring_release(void *ring)
+{
+    atomic_store(&((trace_ring *) ring)->owned, 0);
+}
+
+static trace_ring *ring_get(void)
+{
+    trace_ring *ring;
+    int unowned;
+
+    if(thread_ring)
+        return thread_ring;
+
+    for(ring = atomic_load(&trace_rings); ring; ring = ring->next)
+    {
+        unowned = 0;
+        if(atomic_compare_exchange_strong(&ring->owned, &unowned, 1))
+            break;
+    }
+
+    if(!ring)
+    {
+        ring = calloc(1, sizeof(*ring));
+        if(!ring)
+            return NULL;
+        atomic_init(&ring->owned, 1);
+        atomic_init(&ring->head, 0);
+        ring->tid = atomic_fetch_add(&trace_ring_count, 1) + 1;
+        ring->next = atomic_load(&trace_rings);
+        while(!atomic_compare_exchange_weak(&trace_rings, &ring->next, ring))
+            ;
+    }
+
+    ring->name = NULL;
+    ring->poc = TRACE_NO_POC;
+    ring->nal_type = TRACE_NO_NAL_TYPE;
+    pthread_setspecific(trace_ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+static void ring_add(
+    trace_ring *ring,
+    const char *name,
+    uint64_t begin_ns,
+    uint64_t end_ns,
+    int32_t poc,
+    int nal_type,
+    uint8_t async)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    trace_event *event = &ring->events[head % TRACE_RING_EVENTS];
+
+    event->begin_ns = begin_ns;
+    event->end_ns = end_ns;
+    event->name = name;
+    event->poc = poc;
+    event->nal_type = nal_type;
+    event->async = async;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+#if HEVC_TRACE_USDT
+    DTRACE_PROBE5(vdpau_hw_hevc, span, name, begin_ns, end_ns, poc, nal_type);
+#endif
+}
+
+void hevc_trace_thread_name(const char *name)
+{
+    trace_ring *ring;
+
+    if(!hevc_trace_enabled)
+        return;
+
+    ring = ring_get();
+    if(ring)
+        ring->name = name;
+}
+
+void hevc_trace_tag(int32_t poc, int nal_type)
+{
+    trace_ring *ring = ring_get();
+
+    if(ring)
+    {
+        ring->poc = poc;
+        ring->nal_type = nal_type;
+    }
+}
+
+void hevc_trace_add(const char *name, uint64_t begin_ns, uint64_t end_ns)
+{
+    trace_ring *ring = ring_get();
+
+    if(ring)
+        ring_add(ring, name, begin_ns, end_ns, ring->poc, ring->nal_type, 0);
+}
+
+void hevc_trace_add_async(
+    const char *name,
+    uint64_t begin_ns,
+    uint64_t end_ns,
+    int32_t poc,
+    int nal_type)
+{
+    trace_ring *ring = ring_get();
+
+    if(ring)
+        ring_add(ring, name, begin_ns, end_ns, poc, nal_type, 1);
+}
+
+/* Microseconds into the trace, which Chrome trace events count in. */
+static double trace_us(uint64_t ns)
+{
+    return ns >= trace_start_ns ? (ns - trace_start_ns) / 1000.0 : 0.0;
+}
+
+static void write_args(FILE *out, const trace_event *event)
+{
+    fprintf(out, ",\"args\":{");
+    if(event->poc != TRACE_NO_POC)
+        fprintf(out, "\"poc\":%" PRId32 "%s", event->poc,
+                event->nal_type != TRACE_NO_NAL_TYPE ? "," : "");
+    if(event->nal_type != TRACE_NO_NAL_TYPE)
+        fprintf(out, "\"nal_type\":%d", event->nal_type);
+    fprintf(out, "}}");
+}
+
+static void write_event(
+    FILE *out,
+    const trace_ring *ring,
+    const trace_event *event,
+    uint64_t id,
+    int *first)
+{
+    int pid = getpid();
+
+    if(!event->async)
+    {
+        fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+                "\"tid\":%" PRIu32 ",\"ts\":%.3f,\"dur\":%.3f",
+                *first ? "" : ",", event->name, pid, ring->tid,
+                trace_us(event->begin_ns),
+                (event->end_ns - event->begin_ns) / 1000.0);
+        write_args(out, event);
+    }
+    else
+    {
+        /* Async spans overlap, each begin and end pair is matched by id. */
+        fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\","
+                "\"id\":%" PRIu64 ",\"pid\":%d,\"tid\":%" PRIu32
+                ",\"ts\":%.3f",
+                *first ? "" : ",", event->name, event->name, id, pid,
+                ring->tid, trace_us(event->begin_ns));
+        write_args(out, event);
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\","
+                "\"id\":%" PRIu64 ",\"pid\":%d,\"tid\":%" PRIu32
+                ",\"ts\":%.3f}",
+                event->name, event->name, id, pid, ring->tid,
+                trace_us(event->end_ns));
+    }
+    *first = 0;
+}
+
+int hevc_trace_dump(void)
+{
+    trace_event *copy;
+    trace_ring *ring;
+    uint64_t head, first, i, id = 0;
+    int first_event = 1, failed;
+    FILE *out;
+
+    if(!hevc_trace_enabled)
+        return 0;
+
+    copy = malloc(TRACE_RING_EVENTS * sizeof(*copy));
+    if(!copy)
+        return -1;
+
+    pthread_mutex_lock(&trace_dump_mutex);
+    out = fopen(trace_path, "w");
+    if(!out)
+    {
+        pthread_mutex_unlock(&trace_dump_mutex);
+        free(copy);
+        HEVC_LOG_ERROR("Can not write the trace to %s\n", trace_path);
+        return -1;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for(ring = atomic_load(&trace_rings); ring; ring = ring->next)
+    {
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        for(i = first; i < head; i++)
+            copy[i % TRACE_RING_EVENTS] = ring->events[i % TRACE_RING_EVENTS];
+
+        /*
+           Drop whatever the thread wrote over while it was copied, and the
+           span it may be writing now, the one after the last it stored.
+         */
+        atomic_thread_fence(memory_order_acquire);
+        i = atomic_load_explicit(&ring->head, memory_order_relaxed) + 1;
+        if(i > first + TRACE_RING_EVENTS)
+            first = i - TRACE_RING_EVENTS < head ? i - TRACE_RING_EVENTS : head;
+
+        if(ring->name)
+        {
+            fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                    "\"pid\":%d,\"tid\":%" PRIu32 ","
+                    "\"args\":{\"name\":\"%s\"}}",
+                    first_event ? "" : ",", getpid(), ring->tid, ring->name);
+            first_event = 0;
+        }
+        for(i = first; i < head; i++)
+            write_event(out, ring, &copy[i % TRACE_RING_EVENTS], id++,
+                        &first_event);
+    }
+    fprintf(out, "\n]}\n");
+
+    failed = ferror(out);
+    if(fclose(out) || failed)
+    {
+        pthread_mutex_unlock(&trace_dump_mutex);
+        free(copy);
+        HEVC_LOG_ERROR("Can not write the trace to %s\n", trace_path);
+        return -1;
+    }
+    pthread_mutex_unlock(&trace_dump_mutex);
+    free(copy);
+    return 0;
+}
+
+static void dump_at_exit(void)
+{
+    hevc_trace_dump();
+}
+
+static void request_dump(int signum)
+{
+    trace_dump_requested = 1;
+}
+
+void hevc_trace_poll(void)
+{
+    if(trace_dump_requested)
+    {
+        trace_dump_requested = 0;
+        if(!hevc_trace_dump())
+            HEVC_LOG_INFO("Trace written to %s\n", trace_path);
+    }
+}
+
+int hevc_trace_init(const char *path)
+{
+    struct sigaction action;
+    FILE *out;
+
+    /* Find out now rather than at exit if the file can not be written. */
+    out = fopen(path, "w");
+    if(!out)
+    {
+        HEVC_LOG_ERROR("Can not write the trace to %s\n", path);
+        return -1;
+    }
+    fclose(out);
+
+    trace_path = strdup(path);
+    if(!trace_path || pthread_key_create(&trace_ring_key, ring_release))
+        return -1;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_dump;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+
+    trace_start_ns = hevc_trace_now();
+    hevc_trace_enabled = 1;
+    atexit(dump_at_exit);
+    return 0;
+}
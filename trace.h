@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    trace: a per-picture timeline of the player, for chrome://tracing or
+    Perfetto, with -trace <file>.
+
+    Every stage that -bench times (see bench.h) is also kept as a span, with
+    its CLOCK_MONOTONIC begin and end and the PicOrderCntVal and
+    nal_unit_type that the thread was working on. Each thread writes spans
+    into a ring buffer of its own, which keeps the TRACE_RING_EVENTS most
+    recent ones without any locking. hevc_trace_dump() writes all of them
+    out as Chrome trace event JSON, one track per thread.
+
+    Built with HEVC_TRACE_USDT (make USDT=1), every span also fires the USDT
+    probe vdpau_hw_hevc:span(name, begin_ns, end_ns, poc, nal_type), for
+    perf and bpftrace.
+
+    Until hevc_trace_init() is called, a span costs one test of
+    hevc_trace_enabled.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define TRACE_RING_EVENTS (1u << 16)
+
+/* A span that is not about any picture, or any NAL unit. */
+#define TRACE_NO_POC INT32_MIN
+#define TRACE_NO_NAL_TYPE (-1)
+
+extern int hevc_trace_enabled;
+
+/*
+   Starts keeping spans, to be written to path at exit, and whenever the
+   process gets SIGUSR1 after that, by hevc_trace_poll(). Returns 0, or -1
+   if path can not be written.
+ */
+int hevc_trace_init(const char *path);
+
+/* Names the track of the calling thread. name must stay valid. */
+void hevc_trace_thread_name(const char *name);
+
+/* Tags the spans that the calling thread records from now on. */
+void hevc_trace_tag(int32_t poc, int nal_type);
+
+/*
+   Keeps one span, with the tag of the calling thread. An async span is
+   tagged with poc and nal_type instead, and may overlap the others: it is
+   shown apart from them, on a track named after it.
+ */
+void hevc_trace_add(const char *name, uint64_t begin_ns, uint64_t end_ns);
+void hevc_trace_add_async(
+    const char *name,
+    uint64_t begin_ns,
+    uint64_t end_ns,
+    int32_t poc,
+    int nal_type);
+
+/*
+   Writes every span still in the rings to the file of hevc_trace_init().
+   Other threads may go on recording meanwhile. Returns 0 or -1.
+ */
+int hevc_trace_dump(void);
+
+/* Dumps the trace if SIGUSR1 asked for it since the last call. */
+void hevc_trace_poll(void);
+
+static inline void hevc_trace_set_picture(int32_t poc, int nal_type)
+{
+    if(hevc_trace_enabled)
+        hevc_trace_tag(poc, nal_type);
+}
+
+static inline uint64_t hevc_trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Timestamps the start of a span, or returns 0 when not tracing. */
+static inline uint64_t hevc_trace_begin(void)
+{
+    return hevc_trace_enabled ? hevc_trace_now() : 0;
+}
+
+static inline void hevc_trace_end(const char *name, uint64_t begin_ns)
+{
+    if(hevc_trace_enabled)
+        hevc_trace_add(name, begin_ns, hevc_trace_now());
+}
+
+#endif /* __TRACE_H__ */
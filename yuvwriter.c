@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "win_x11.h"
+#include "yuvwriter.h"
+#include "logging.h"
+#include "md5.h"
+
+static void wait_for_slot(sem_t *sem)
+{
+    while(sem_wait(sem) < 0 && errno == EINTR)
+        ;
+}
+
+static void emit(
+    hevc_yuv_writer *writer,
+    hevc_md5 *md5,
+    const void *data,
+    size_t size)
+{
+    if(writer->md5)
+        hevc_md5_update(md5, data, size);
+    else if(fwrite(data, 1, size, writer->out) != size)
+        atomic_store(&writer->failed, 1);
+}
+
+/*
+   Emits the rectangle x0..x1, y0..y1 of a plane. Samples of 16 bits are
+   every step'th one of the row, with their bit_depth bits at the top.
+ */
+static void emit_plane(
+    hevc_yuv_writer *writer,
+    hevc_md5 *md5,
+    const uint8_t *plane,
+    uint32_t pitch,
+    uint8_t bit_depth,
+    uint32_t step,
+    const VdpRect *rect)
+{
+    const uint16_t *samples;
+    uint32_t x, y, width = rect->x1 - rect->x0;
+    uint16_t v;
+
+    for(y = rect->y0; y < rect->y1; y++)
+    {
+        if(bit_depth <= 8)
+        {
+            emit(writer, md5, plane + y * pitch + rect->x0, width);
+            continue;
+        }
+        samples = (const uint16_t *)(plane + y * pitch);
+        for(x = 0; x < width; x++)
+        {
+            v = samples[(rect->x0 + x) * step] >> (16 - bit_depth);
+            writer->row[2 * x] = v & 0xff;
+            writer->row[2 * x + 1] = v >> 8;
+        }
+        emit(writer, md5, writer->row, 2 * width);
+    }
+}
+
+static void write_picture(hevc_yuv_writer *writer, hevc_yuv_staging *staging)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint32_t width = staging->format.width;
+    uint32_t height = staging->format.height;
+    uint8_t bit_depth = staging->format.bit_depth;
+    uint8_t digest[MD5_DIGEST_SIZE];
+    char line[2 * MD5_DIGEST_SIZE + 2];
+    const uint8_t *chroma = staging->data + (size_t)width * height;
+    VdpRect rect;
+    hevc_md5 md5;
+    size_t row;
+    int i;
+
+    row = 2 * (size_t)(staging->crop.x1 - staging->crop.x0);
+    if(bit_depth > 8 && row > writer->row_capacity)
+    {
+        free(writer->row);
+        writer->row_capacity = 0;
+        if((writer->row = malloc(row)) == NULL)
+        {
+            HEVC_LOG_ERROR("Error: MALLOC: YUV writer row.\n");
+            atomic_store(&writer->failed, 1);
+            return;
+        }
+        writer->row_capacity = row;
+    }
+
+    hevc_md5_init(&md5);
+    if(bit_depth <= 8)
+    {
+        emit_plane(writer, &md5, staging->data, width, bit_depth, 1,
+                   &staging->crop);
+        rect.x0 = staging->crop.x0 / 2;
+        rect.x1 = staging->crop.x1 / 2;
+        rect.y0 = staging->crop.y0 / 2;
+        rect.y1 = staging->crop.y1 / 2;
+        emit_plane(writer, &md5, chroma, width / 2, bit_depth, 1, &rect);
+        emit_plane(writer, &md5, chroma + (size_t)width / 2 * height / 2,
+                   width / 2, bit_depth, 1, &rect);
+    }
+    else
+    {
+        /* Twice the bytes, and the chroma samples interleaved. */
+        chroma += (size_t)width * height;
+        emit_plane(writer, &md5, staging->data, 2 * width, bit_depth, 1,
+                   &staging->crop);
+        rect.x0 = staging->crop.x0 / 2;
+        rect.x1 = staging->crop.x1 / 2;
+        rect.y0 = staging->crop.y0 / 2;
+        rect.y1 = staging->crop.y1 / 2;
+        emit_plane(writer, &md5, chroma, 2 * width, bit_depth, 2, &rect);
+        emit_plane(writer, &md5, chroma + 2, 2 * width, bit_depth, 2, &rect);
+    }
+
+    if(!writer->md5)
+        return;
+    hevc_md5_final(&md5, digest);
+    for(i = 0; i < MD5_DIGEST_SIZE; i++)
+    {
+        line[2 * i] = hex[digest[i] >> 4];
+        line[2 * i + 1] = hex[digest[i] & 15];
+    }
+    line[2 * MD5_DIGEST_SIZE] = '\n';
+    line[2 * MD5_DIGEST_SIZE + 1] = 0;
+    if(fputs(line, writer->out) < 0)
+        atomic_store(&writer->failed, 1);
+}
+
+static void *writer_thread(void *opaque)
+{
+    hevc_yuv_writer *writer = opaque;
+    hevc_yuv_staging *staging;
+
+    for(;;)
+    {
+        wait_for_slot(&writer->used_slots);
+        staging = &writer->buffers[writer->tail % YUV_WRITER_BUFFERS];
+        if(staging->end_of_stream)
+            break;
+        write_picture(writer, staging);
+        writer->tail++;
+        sem_post(&writer->free_slots);
+    }
+
+    return NULL;
+}
+
+int hevc_yuv_writer_open(hevc_yuv_writer *writer, const char *path, int md5)
+{
+    memset(writer, 0, sizeof(*writer));
+
+    writer->out = strcmp(path, "-") ? fopen(path, "wb") : stdout;
+    if(writer->out == NULL)
+    {
+        HEVC_LOG_ERROR("Error: unable to open %s for writing.\n", path);
+        return -1;
+    }
+    writer->md5 = md5;
+    atomic_init(&writer->failed, 0);
+    sem_init(&writer->free_slots, 0, YUV_WRITER_BUFFERS);
+    sem_init(&writer->used_slots, 0, 0);
+
+    if(pthread_create(&writer->thread, NULL, writer_thread, writer))
+    {
+        HEVC_LOG_ERROR("Error: unable to create the YUV writer thread.\n");
+        sem_destroy(&writer->free_slots);
+        sem_destroy(&writer->used_slots);
+        if(writer->out != stdout)
+            fclose(writer->out);
+        writer->out = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int hevc_yuv_writer_close(hevc_yuv_writer *writer)
+{
+    int i;
+
+    if(writer->out == NULL)
+        return 0;
+
+    wait_for_slot(&writer->free_slots);
+    writer->buffers[writer->head % YUV_WRITER_BUFFERS].end_of_stream = 1;
+    writer->head++;
+    sem_post(&writer->used_slots);
+    pthread_join(writer->thread, NULL);
+
+    for(i = 0; i < YUV_WRITER_BUFFERS; i++)
+        free(writer->buffers[i].data);
+    free(writer->row);
+    sem_destroy(&writer->free_slots);
+    sem_destroy(&writer->used_slots);
+    if(writer->out == stdout ? fflush(stdout) : fclose(writer->out))
+        atomic_store(&writer->failed, 1);
+    if(atomic_load(&writer->failed))
+    {
+        HEVC_LOG_ERROR("Error: the decoded pictures could not be written.\n");
+        writer->out = NULL;
+        return -1;
+    }
+    writer->out = NULL;
+
+    return 0;
+}
+
+VdpStatus hevc_yuv_writer_write(
+    hevc_yuv_writer *writer,
+    VdpVideoSurface surface,
+    const hevc_surface_format *format,
+    const VdpRect *crop)
+{
+    hevc_yuv_staging *staging;
+    size_t luma = (size_t)format->width * format->height;
+    size_t size;
+    void *planes[3];
+    uint32_t pitches[3];
+    VdpYCbCrFormat ycbcr;
+    VdpStatus vdp_st;
+    void *data;
+
+    if(!hevc_surface_format_is_420(format))
+    {
+        HEVC_LOG_ERROR("Error: only 4:2:0 pictures can be written out.\n");
+        return VDP_STATUS_INVALID_CHROMA_TYPE;
+    }
+
+    wait_for_slot(&writer->free_slots);
+    staging = &writer->buffers[writer->head % YUV_WRITER_BUFFERS];
+
+    size = luma * 3 / 2 * (format->bit_depth > 8 ? 2 : 1);
+    if(size > staging->capacity)
+    {
+        free(staging->data);
+        staging->capacity = 0;
+        staging->data = NULL;
+        if(posix_memalign(&data, 4096, size))
+        {
+            HEVC_LOG_ERROR("Error: MALLOC: YUV staging buffer.\n");
+            sem_post(&writer->free_slots);
+            return VDP_STATUS_RESOURCES;
+        }
+        staging->data = data;
+        staging->capacity = size;
+    }
+
+    if(format->bit_depth > 8)
+    {
+        ycbcr = format->bit_depth > 10 ?
+                VDP_YCBCR_FORMAT_P016 : VDP_YCBCR_FORMAT_P010;
+        planes[0] = staging->data;
+        planes[1] = staging->data + 2 * luma;
+        pitches[0] = pitches[1] = 2 * format->width;
+    }
+    else
+    {
+        /* YV12 has Cr before Cb. Swapped, they land as I420. */
+        ycbcr = VDP_YCBCR_FORMAT_YV12;
+        planes[0] = staging->data;
+        planes[2] = staging->data + luma;
+        planes[1] = staging->data + luma + luma / 4;
+        pitches[0] = format->width;
+        pitches[1] = pitches[2] = format->width / 2;
+    }
+    vdp_st = vdp_video_surface_get_bits_y_cb_cr(
+                 surface, /* surface */
+                 ycbcr, /* destination_ycbcr_format */
+                 planes, /* destination_data */
+                 pitches /* destination_pitches */
+             );
+    if(vdp_st != VDP_STATUS_OK)
+    {
+        sem_post(&writer->free_slots);
+        return vdp_st;
+    }
+
+    staging->format = *format;
+    if(crop)
+        staging->crop = *crop;
+    else
+    {
+        staging->crop.x0 = 0;
+        staging->crop.y0 = 0;
+        staging->crop.x1 = format->width;
+        staging->crop.y1 = format->height;
+    }
+    staging->end_of_stream = 0;
+    writer->head++;
+    sem_post(&writer->used_slots);
+
+    return VDP_STATUS_OK;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2015, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License, version 2.1, as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+    yuvwriter: reads decoded pictures back from their video surfaces, and
+    writes them to a file or pipe as raw planar YUV, or as one MD5 sum per
+    picture.
+
+    Reading a surface back is the only part that needs the VDPAU device,
+    so that is done by whoever hands the picture in, into one of a few
+    staging buffers. A thread of the writer's own then writes the buffers
+    out, or sums them, while the next pictures are decoded. The buffers
+    are allocated once, for the biggest picture so far, and reused.
+
+    4:2:0 pictures of 8 bits are written as I420, and deeper ones as
+    planar 16 bit little endian samples, the layout of yuv420p10le. Only
+    the conformance cropping window is written.
+ */
+
+#ifndef __YUV_WRITER_H__
+#define __YUV_WRITER_H__
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vdpau/vdpau.h>
+#include "surfacepool.h"
+
+/* Pictures read back but not yet written out, at most. */
+#define YUV_WRITER_BUFFERS 3
+
+/* One picture, as VdpVideoSurfaceGetBitsYCbCr left it: I420 or P010. */
+typedef struct _hevc_yuv_staging
+{
+    uint8_t *data;
+    size_t capacity;
+    hevc_surface_format format;
+    VdpRect crop;
+    /* Tells the thread to finish, instead of a picture. */
+    uint8_t end_of_stream;
+} hevc_yuv_staging;
+
+typedef struct _hevc_yuv_writer
+{
+    FILE *out;
+    uint8_t md5;
+    pthread_t thread;
+    hevc_yuv_staging buffers[YUV_WRITER_BUFFERS];
+    /* head only moves on the reading side, tail on the writer thread. */
+    uint32_t head;
+    uint32_t tail;
+    sem_t free_slots;
+    sem_t used_slots;
+    /* Writer thread only: one row of 16 bit samples. */
+    uint8_t *row;
+    size_t row_capacity;
+    /* Set by the writer thread once an fwrite has failed. */
+    atomic_int failed;
+} hevc_yuv_writer;
+
+/*
+   Opens path, "-" for stdout, and starts the writer thread. With md5, one
+   line of hex digits per picture is written instead of its samples.
+   Returns 0, or -1 on errors.
+ */
+int hevc_yuv_writer_open(hevc_yuv_writer *writer, const char *path, int md5);
+/*
+   Writes out the pictures still staged, stops the thread and closes the
+   output. Returns 0, or -1 if any of the output could not be written.
+ */
+int hevc_yuv_writer_close(hevc_yuv_writer *writer);
+
+/*
+   Reads a 4:2:0 surface of the format back, waiting for a free staging
+   buffer first, and queues it to be written. crop is the part of the
+   surface to write, or NULL for all of it. Must not be called from more
+   than one thread at a time.
+ */
+VdpStatus hevc_yuv_writer_write(
+    hevc_yuv_writer *writer,
+    VdpVideoSurface surface,
+    const hevc_surface_format *format,
+    const VdpRect *crop);
+
+#endif /* __YUV_WRITER_H__ */